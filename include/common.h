@@ -55,6 +55,9 @@ enum ins_opcode_t
 	READ,  // Write data to a byte on memory
 	WRITE, // Read data from a byte on memory
 	SYSCALL,
+	EXPECT, // Check the data of a byte on memory
+	MMAP,   // Allocate memory in a vm area of its own
+	MUNMAP, // Remove the vm area of a region
 };
 
 /* instructions executed by the CPU */
@@ -114,6 +117,10 @@ struct pcb_t
 	struct mm_struct *mm;
 	struct page_table_t *page_table; // Page table
 	uint32_t bp;			 // Break pointer
+#ifdef MM_PAGING
+	uint64_t io_ns;			 // device time not yet charged as a slot
+	uint32_t io_stall;		 // slots left waiting on a device
+#endif
 };
 
 /* Kernel structure */
@@ -130,6 +137,10 @@ struct krnl_t
 	struct memphy_struct **mswp;
 	struct memphy_struct *active_mswp;
 	uint32_t active_mswp_id;
+	struct mmparam_struct mmparam;
+	struct mmstat_struct mmstat;
+	struct zswap_struct *zswap;
+	struct pgrepl_struct *pgrepl; /* shared replacement state, global scope */
 #endif
 };
 
@@ -9,5 +9,8 @@
  * Otherwise, return 1. */
 int run(struct pcb_t * proc);
 
+/* Process the calling CPU thread is running, NULL outside of run() */
+extern __thread struct pcb_t * current_proc;
+
 #endif
 
@@ -12,23 +12,33 @@
 #endif
 
 #ifdef MM64
-#define PAGING_PAGESZ  4096      /* 4KB or 12-bits PAGE NUMBER */
+#define PAGING_PAGESZ_DEFAULT 4096 /* 4KB or 12-bits PAGE NUMBER */
+#define PAGING_PAGE_SHIFT_DEFAULT 12
 #else
-#define PAGING_PAGESZ  256      /* 256B or 8-bits PAGE NUMBER */
+#define PAGING_PAGESZ_DEFAULT 256  /* 256B or 8-bits PAGE NUMBER */
+#define PAGING_PAGE_SHIFT_DEFAULT 8
 #endif
 
+/* Page size range of the pagesz kernel parameter, a MEMPHY storage
+ * chunk (64KB) must hold whole pages */
+#define PAGING_PAGESZ_MIN 256
+#define PAGING_PAGESZ_MAX 65536
+
+/* Page geometry, fixed at boot before any MEMPHY is formatted */
+extern struct paging_geom_struct paging_geom;
+int paging_set_pagesz(addr_t pagesz);
+
+#define PAGING_PAGESZ (paging_geom.pagesz)
+#define PAGING_PAGE_SHIFT (paging_geom.shift)
+
 #define PAGING_MEMRAMSZ BIT(21)
 #define PAGING_PAGE_ALIGNSZ(sz) (DIV_ROUND_UP(sz,PAGING_PAGESZ)*PAGING_PAGESZ)
 
 #define PAGING_MEMSWPSZ BIT(29)
 #define PAGING_SWPFPN_OFFSET 5  
 
-#ifdef MM64
-/* For 64-bit mode, limit max pages to avoid overflow */
-#define PAGING_MAX_PGN  (DIV_ROUND_UP(BIT_ULL(21),PAGING_PAGESZ))
-#else
-#define PAGING_MAX_PGN  (DIV_ROUND_UP(BIT(PAGING_CPU_BUS_WIDTH),PAGING_PAGESZ))
-#endif
+/* 64-bit mode keeps the limit low to avoid overflow */
+#define PAGING_MAX_PGN (paging_geom.max_pgn)
 
 #define PAGING_SBRK_INIT_SZ PAGING_PAGESZ
 
@@ -45,7 +55,7 @@
 /* 64-bit PTE Layout:
  * Bits 63:    Present flag
  * Bits 62:    Swapped flag
- * Bits 61:    Reserved flag
+ * Bits 61:    Reserved flag, in a PMD entry: maps 512 frames (huge)
  * Bits 60:    Dirty flag
  * Bits 59-32: User number (28 bits)
  * Bits 31-0:  FPN (32 bits) or Swap info
@@ -56,6 +66,7 @@
 #define PAGING_PTE_SWAPPED_MASK BIT_ULL(62)
 #define PAGING_PTE_RESERVE_MASK BIT_ULL(61)
 #define PAGING_PTE_DIRTY_MASK BIT_ULL(60)
+#define PAGING_PTE_HUGE_MASK PAGING_PTE_RESERVE_MASK
 #define PAGING_PTE_EMPTY01_MASK BIT_ULL(14)
 #define PAGING_PTE_EMPTY02_MASK BIT_ULL(13)
 
@@ -85,6 +96,7 @@
 #define PAGING_PTE_SWAPPED_MASK BIT(30)
 #define PAGING_PTE_RESERVE_MASK BIT(29)
 #define PAGING_PTE_DIRTY_MASK BIT(28)
+#define PAGING_PTE_HUGE_MASK 0 /* no huge mappings in 32-bit mode */
 #define PAGING_PTE_EMPTY01_MASK BIT(14)
 #define PAGING_PTE_EMPTY02_MASK BIT(13)
 
@@ -105,6 +117,8 @@
 /* PTE BIT PRESENT - works for both 32-bit and 64-bit modes */
 #define PAGING_PTE_SET_PRESENT(pte) (pte=pte|PAGING_PTE_PRESENT_MASK)
 #define PAGING_PAGE_PRESENT(pte) (pte&PAGING_PTE_PRESENT_MASK)
+/* A swapped page keeps PRESENT set, only a non swapped one lives in MEMRAM */
+#define PAGING_PAGE_ONLINE(pte) (PAGING_PAGE_PRESENT(pte) && !(pte&PAGING_PTE_SWAPPED_MASK))
 
 /* PTE Masks - use appropriate GENMASK based on mode */
 #ifdef MM64
@@ -127,10 +141,10 @@
 
 /* OFFSET */
 #define PAGING_ADDR_OFFST_LOBIT 0
-#define PAGING_ADDR_OFFST_HIBIT (NBITS(PAGING_PAGESZ) - 1)
+#define PAGING_ADDR_OFFST_HIBIT (PAGING_PAGE_SHIFT - 1)
 
 /* PAGE Num */
-#define PAGING_ADDR_PGN_LOBIT NBITS(PAGING_PAGESZ)
+#define PAGING_ADDR_PGN_LOBIT PAGING_PAGE_SHIFT
 #ifdef MM64
 #define PAGING_ADDR_PGN_HIBIT 63
 #else
@@ -138,13 +152,16 @@
 #endif
 
 /* Frame PHY Num */
-#define PAGING_ADDR_FPN_LOBIT NBITS(PAGING_PAGESZ)
+#define PAGING_ADDR_FPN_LOBIT PAGING_PAGE_SHIFT
 #define PAGING_ADDR_FPN_HIBIT (NBITS(PAGING_MEMRAMSZ) - 1)
 
 /* SWAPFPN */
-#define PAGING_SWP_LOBIT NBITS(PAGING_PAGESZ)
+#define PAGING_SWP_LOBIT PAGING_PAGE_SHIFT
 #define PAGING_SWP_HIBIT (NBITS(PAGING_MEMSWPSZ) - 1)
 #define PAGING_SWP(pte) ((pte&PAGING_PTE_SWPOFF_MASK) >> PAGING_SWPFPN_OFFSET)
+#define PAGING_SWPTYP(pte) GETVAL(pte,PAGING_PTE_SWPTYP_MASK,PAGING_PTE_SWPTYP_LOBIT)
+/* SWPTYP past the MEMSWP devices: SWPOFF indexes the compressed pool */
+#define PAGING_SWPTYP_ZSWAP PAGING_MAX_MMSWP
 
 /* Value operators */
 #define SETBIT(v,mask) (v=v|mask)
@@ -154,8 +171,8 @@
 #define GETVAL(v,mask,offst) ((v&mask)>>offst)
 
 /* Masks */
-#define PAGING_OFFST_MASK  GENMASK(PAGING_ADDR_OFFST_HIBIT,PAGING_ADDR_OFFST_LOBIT)
-#define PAGING_PGN_MASK  GENMASK(PAGING_ADDR_PGN_HIBIT,PAGING_ADDR_PGN_LOBIT)
+#define PAGING_OFFST_MASK  (paging_geom.offst_mask)
+#define PAGING_PGN_MASK  (paging_geom.pgn_mask)
 #define PAGING_FPN_MASK  GENMASK(PAGING_ADDR_FPN_HIBIT,PAGING_ADDR_FPN_LOBIT)
 #define PAGING_SWP_MASK  GENMASK(PAGING_SWP_HIBIT,PAGING_SWP_LOBIT)
 
@@ -188,6 +205,7 @@ addr_t vm_map_ram(struct pcb_t *caller, addr_t astart, addr_t aend, addr_t mapst
 addr_t alloc_pages_range(struct pcb_t *caller, int incpgnum, struct framephy_struct **frm_lst);
 int __swap_cp_page(struct memphy_struct *mpsrc, addr_t srcfpn,
                 struct memphy_struct *mpdst, addr_t dstfpn) ;
+int mm_swap_alloc(struct krnl_t *krnl, int *swptyp, addr_t *swpfpn);
 int get_pd_from_address(addr_t addr, addr_t* pgd, addr_t* p4d, addr_t* pud, addr_t* pmd, addr_t* pt);
 int get_pd_from_pagenum(addr_t pgn, addr_t* pgd, addr_t* p4d, addr_t* pud, addr_t* pmd, addr_t* pt);
 int pte_set_fpn(struct pcb_t *caller, addr_t pgn, addr_t fpn);
@@ -195,6 +213,17 @@ int pte_set_swap(struct pcb_t *caller, addr_t pgn, int swptyp, addr_t swpoff);
 /* PTE entry access functions - pte_t is defined in os-mm.h */
 pte_t pte_get_entry(struct pcb_t *caller, addr_t pgn);
 int pte_set_entry(struct pcb_t *caller, addr_t pgn, pte_t pte_val);
+/* PTE range operations, one page-table walk per leaf table */
+int pte_range_set_fpn(struct pcb_t *caller, addr_t pgn, int pgnum, struct framephy_struct *frames);
+int pte_range_protect(struct pcb_t *caller, addr_t pgn, int pgnum, pte_t clr, pte_t set);
+int pte_range_clear(struct pcb_t *caller, addr_t pgn, int pgnum);
+int pte_range_for_each(struct pcb_t *caller, addr_t pgn, int pgnum,
+                       int (*fn)(addr_t pgn, pte_t pte, void *arg), void *arg);
+/* Huge mappings of PAGING_HUGE_NRPG pages (MM64 only) */
+#define PAGING_HUGE_ORDER 9
+#define PAGING_HUGE_NRPG (1 << PAGING_HUGE_ORDER)
+int pte_set_huge(struct pcb_t *caller, addr_t pgn, addr_t fpn);
+int pte_split_huge(struct pcb_t *caller, addr_t pgn);
 
 int init_pte(addr_t *pte,
              int pre,    // present
@@ -204,11 +233,20 @@ int init_pte(addr_t *pte,
              int swptyp, // swap type
              addr_t swpoff); //swap offset
 int __alloc(struct pcb_t *caller, int vmaid, int rgid, addr_t size, addr_t *alloc_addr);
-int __free(struct pcb_t *caller, int vmaid, int rgid);
+int __free(struct pcb_t *caller, int rgid);
+int __mmap(struct pcb_t *caller, addr_t size, int *vmaid);
+int __munmap(struct pcb_t *caller, int vmaid);
 int __read(struct pcb_t *caller, int vmaid, int rgid, addr_t offset, BYTE *data);
 int __write(struct pcb_t *caller, int vmaid, int rgid, addr_t offset, BYTE value);
+int pg_getpage(struct mm_struct *mm, addr_t pgn, addr_t *fpn, struct pcb_t *caller);
 int init_mm(struct mm_struct *mm, struct pcb_t *caller);
 int free_mm(struct mm_struct *mm);
+int free_pcb_memph(struct pcb_t *caller);
+int pgtbl_for_each(struct mm_struct *mm, int (*fn)(addr_t pgn, pte_t pte, void *arg), void *arg);
+int pgtbl_report(void);
+unsigned long pgtbl_bytes(struct mm_struct *mm);
+int mm_kswapd_start(struct krnl_t *krnl);
+int mm_kswapd_stop(struct krnl_t *krnl);
 
 /* VM prototypes */
 int pgalloc(struct pcb_t *proc, uint32_t size, uint32_t reg_index);
@@ -224,15 +262,75 @@ int pgwrite(
 		uint32_t destination, // Index of destination register
 		addr_t offset);
 /* Local VM prototypes */
-struct vm_rg_struct * get_symrg_byid(struct mm_struct* mm, int rgid);
+struct symrg_struct * get_symrg_byid(struct mm_struct* mm, int rgid);
 int validate_overlap_vm_area(struct pcb_t *caller, int vmaid, addr_t vmastart, addr_t vmaend);
 int get_free_vmrg_area(struct pcb_t *caller, int vmaid, int size, struct vm_rg_struct *newrg);
 int inc_vma_limit(struct pcb_t *caller, int vmaid, addr_t inc_sz);
 int find_victim_page(struct mm_struct* mm, addr_t *pgn);
+
+/* Page replacement policies */
+#define PGREPL_FIFO  0   /* first in first out */
+#define PGREPL_CLOCK 1   /* second chance on the reference bit */
+#define PGREPL_LRU   2   /* LRU approximation by reference bit aging */
+#define PGREPL_LFU   3   /* least frequently used */
+#define PGREPL_ARC   4   /* adaptive replacement cache */
+#define PGREPL_NR    5
+
+/* Victim scope: own resident pages, or the pages of every process */
+#define PGSCOPE_LOCAL  0
+#define PGSCOPE_GLOBAL 1
+
+/* Swap device selection: lowest id with room first, or round robin */
+#define SWPSEL_PRIO   0
+#define SWPSEL_STRIPE 1
+
+/* Page table structure of 64-bit mode: 5-level tree or hash of PTEs */
+#define PGTBL_RADIX 0
+#define PGTBL_HASH  1
+
+int pgrepl_init(struct mm_struct *mm, int policy, struct pgrepl_struct **shared);
+int pgrepl_release(struct mm_struct *mm);
+int pgrepl_insert(struct mm_struct *mm, addr_t pgn);
+int pgrepl_access(struct mm_struct *mm, addr_t pgn);
+int pgrepl_remove(struct mm_struct *mm, addr_t pgn);
+int pgrepl_for_each(struct mm_struct *mm, int (*fn)(addr_t pgn, void *arg), void *arg);
+int pgrepl_victim(struct pgrepl_struct *st, struct mm_struct **retmm, addr_t *retpgn);
+int pgrepl_policy_by_name(const char *name);
+const char *pgrepl_policy_name(int policy);
+
+/* Memory statistics */
+int print_mmstat(struct krnl_t *krnl);
+
+/* Object caches for MM metadata nodes */
+#define KMEM_VM_RG 0
+#define KMEM_NR 1
+void *kmem_cache_alloc(int id);
+void kmem_cache_free(int id, void *obj);
+int kmem_cache_report(void);
+
+/* Compressed swap tier */
+int zswap_init(struct krnl_t *krnl, unsigned long max_sz);
+int zswap_store(struct krnl_t *krnl, struct memphy_struct *mp, addr_t fpn, addr_t *idx);
+int zswap_load(struct krnl_t *krnl, addr_t idx, struct memphy_struct *mp, addr_t fpn);
+int zswap_drop(struct krnl_t *krnl, addr_t idx);
 struct vm_area_struct *get_vma_by_num(struct mm_struct *mm, int vmaid);
+struct vm_area_struct *find_vma(struct mm_struct *mm, addr_t addr);
+
+/* Region handle table */
+int symrg_init(struct mm_struct *mm);
+void symrg_release(struct mm_struct *mm);
+struct symrg_struct *symrg_get(struct mm_struct *mm, int rgid);
+int symrg_put(struct mm_struct *mm, int rgid);
 
 /* Multiple VMA management functions */
+void vm_mmap_init(struct mm_struct *mm);
+struct vm_area_struct *vm_mmap(struct mm_struct *mm, addr_t len);
 struct vm_area_struct *create_vm_area(int vmaid, addr_t vm_start, addr_t vm_end);
+void vm_freerg_init(struct vm_area_struct *vma);
+int vm_freerg_insert(struct vm_area_struct *vma, struct vm_rg_struct *rgnode);
+int vm_freerg_take(struct vm_area_struct *vma, addr_t size, struct vm_rg_struct *newrg);
+int vm_range_allocated(struct vm_area_struct *vma, addr_t start, addr_t end);
+void vm_freerg_rebuild(struct vm_area_struct *vma);
 int add_vm_area(struct mm_struct *mm, struct vm_area_struct *new_vma);
 int remove_vm_area(struct mm_struct *mm, int vmaid);
 int merge_vm_areas(struct vm_area_struct *vma1, struct vm_area_struct *vma2);
@@ -240,7 +338,17 @@ int split_vm_area(struct vm_area_struct *vma, addr_t split_addr, struct vm_area_
 
 /* MEM/PHY protypes */
 int MEMPHY_get_freefp(struct memphy_struct *mp, addr_t *fpn);
+int MEMPHY_get_freefp_at(struct memphy_struct *mp, addr_t fpn);
+int MEMPHY_read_page(struct memphy_struct *mp, addr_t fpn, BYTE *buf);
+int MEMPHY_write_page(struct memphy_struct *mp, addr_t fpn, const BYTE *buf);
+int MEMPHY_copy_page(struct memphy_struct *mpsrc, addr_t srcfpn,
+                     struct memphy_struct *mpdst, addr_t dstfpn);
+int MEMPHY_zero_page(struct memphy_struct *mp, addr_t fpn);
 int MEMPHY_put_freefp(struct memphy_struct *mp, addr_t fpn);
+int MEMPHY_alloc_order(struct memphy_struct *mp, int order, addr_t *retfpn);
+int MEMPHY_free_order(struct memphy_struct *mp, addr_t fpn, int order);
+int MEMPHY_get_freefp_range(struct memphy_struct *mp, int maxpg, addr_t *retfpn);
+int MEMPHY_buddy_report(struct memphy_struct *mp, const char *name);
 int MEMPHY_get_usedfp(struct memphy_struct *mp, addr_t fpn, struct mm_struct *owner);
 int MEMPHY_put_usedfp(struct memphy_struct *mp, addr_t fpn, struct mm_struct *owner);
 int MEMPHY_remove_usedfp(struct memphy_struct *mp, addr_t fpn);
@@ -253,9 +361,24 @@ int MEMPHY_get_stats(struct memphy_struct *mp, int *free_frames, int *used_frame
 int MEMPHY_print_stats(struct memphy_struct *mp, const char *name);
 int MEMPHY_find_frame(struct memphy_struct *mp, addr_t fpn, struct mm_struct **owner);
 int MEMPHY_is_frame_free(struct memphy_struct *mp, addr_t fpn);
+int MEMPHY_rmap_set(struct memphy_struct *mp, addr_t fpn, struct mm_struct *owner, addr_t pgn);
+int MEMPHY_rmap_clear(struct memphy_struct *mp, addr_t fpn);
+int MEMPHY_rmap_get(struct memphy_struct *mp, addr_t fpn, struct mm_struct **owner, addr_t *pgn);
+int MEMPHY_rmap_ref(struct memphy_struct *mp, addr_t fpn);
+int MEMPHY_rmap_victim(struct memphy_struct *mp, addr_t *retfpn);
+int MEMPHY_rmap_mark_ra(struct memphy_struct *mp, addr_t fpn);
+int MEMPHY_rmap_take_ra(struct memphy_struct *mp, addr_t fpn);
+int MEMPHY_swpcache_set(struct memphy_struct *mp, addr_t fpn, int swptyp, addr_t swpoff);
+int MEMPHY_swpcache_get(struct memphy_struct *mp, addr_t fpn, int *swptyp, addr_t *swpoff);
+int MEMPHY_swpcache_drop(struct memphy_struct *mp, addr_t fpn);
+int MEMPHY_swpcache_steal(struct memphy_struct *mp, int swptyp, addr_t *swpoff);
 int MEMPHY_validate(struct memphy_struct *mp);
 int MEMPHY_cleanup(struct memphy_struct *mp);
-int init_memphy(struct memphy_struct *mp, addr_t max_size, int randomflg);
+int init_memphy(struct memphy_struct *mp, uint64_t max_size, int randomflg);
+unsigned long MEMPHY_touched_kb(struct memphy_struct *mp);
+int MEMPHY_attach_file(struct memphy_struct *mp, const char *path);
+int MEMPHY_set_timing(struct memphy_struct *mp, uint64_t lat_ns, uint64_t bw_mbs);
+uint64_t MEMPHY_io_take(void);
 
 /* print list */
 int print_list_fp(struct framephy_struct *fp);
@@ -20,7 +20,8 @@
 
 #define MM_PAGING
 #define PAGING_MAX_MMSWP 4 /* max number of supported swapped space */
-#define PAGING_MAX_SYMTBL_SZ 30
+#define PAGING_SYMTBL_INIT_SZ 32      /* region IDs before the first growth */
+#define PAGING_SYMTBL_MAX_SZ (1 << 24) /* sanity bound on a region ID */
 
 /* 
  * @bksysnet: in long address mode of 64bit or original 32bit
@@ -58,6 +59,18 @@ struct pgn_t{
    struct pgn_t *pg_next; 
 };
 
+/* Page replacement state, private to mm-repl.c */
+struct pgrepl_struct;
+struct zswap_struct;
+
+/* AVL tree link embedded in a vm area or a free region */
+struct vm_avl {
+   struct vm_avl *left;
+   struct vm_avl *right;
+   int height;
+   addr_t gap;     /* area address tree: largest vm_gap in the subtree */
+};
+
 /*
  *  Memory region struct
  */
@@ -66,8 +79,24 @@ struct vm_rg_struct {
    addr_t rg_end;
 
    struct vm_rg_struct *rg_next;
+
+   /* Free regions only: address order back link and the tree links of
+    * the vm area, by address and by size */
+   struct vm_rg_struct *rg_prev;
+   struct vm_avl rg_addr_node;
+   struct vm_avl rg_size_node;
 };
 
+/* Region handle table entry, an unused ID has 0..0 */
+struct symrg_struct {
+   addr_t rg_start;
+   addr_t rg_end;
+   int vmaid;       /* vm area the region was allocated in */
+};
+
+/* Largest contiguous frame block handed out by a memphy device */
+#define MEMPHY_MAX_ORDER 10
+
 /*
  *  Memory area struct
  */
@@ -82,10 +111,31 @@ struct vm_area_struct {
  * unsigned long vm_limit = vm_end - vm_start
  */
    struct mm_struct *vm_mm;
-   struct vm_rg_struct *vm_freerg_list;
-   struct vm_area_struct *vm_next;
+   struct vm_rg_struct *vm_freerg_list;  /* free regions in address order */
+   struct vm_avl *vm_freerg_addr;       /* free regions by rg_start */
+   struct vm_avl *vm_freerg_size;       /* free regions by size, then rg_start */
+   struct vm_area_struct *vm_next;      /* next area in address order */
+   addr_t vm_gap;                       /* hole below, down to the previous area */
+   struct vm_avl vm_addr_node;          /* mm->vma_addr tree, by vm_start */
+   struct vm_avl vm_id_node;            /* mm->vma_id tree, by vm_id */
 };
 
+#ifdef MM64
+#define PGTBL_PWC_SZ 16
+
+/* Page-walk cache entry: the tables down to the PT of one 512 page span */
+struct pgtbl_pwc {
+   addr_t tag;               /* page number >> 9, plus one; 0 is empty */
+   uint64_t *path[5];        /* PGD, P4D, PUD, PMD and PT */
+};
+
+/* Slot of the hashed page table, a zero PTE is an empty slot */
+struct pgtbl_hent {
+   addr_t pgn;
+   uint64_t pte;
+};
+#endif
+
 /* 
  * Memory management struct
  */
@@ -96,17 +146,34 @@ struct mm_struct {
    uint64_t *pud;
    uint64_t *pmd;
    uint64_t *pt;
+   unsigned long pt_pages;  /* page-table pages in use, PGD included */
+   int pwc_on;
+   struct pgtbl_pwc pwc[PGTBL_PWC_SZ];
+   struct pgtbl_hent *pth;  /* hashed page table, replaces pgd when set */
+   addr_t pth_size;         /* slots, a power of two */
+   addr_t pth_used;
 #else
-   uint32_t *pgd;
+   uint32_t **pgd;          /* directory of leaf tables */
+   uint16_t *pt_nr;         /* non-zero PTEs per leaf table */
+   unsigned long pt_pages;  /* leaf tables allocated */
 #endif
 
-   struct vm_area_struct *mmap;
+   struct vm_area_struct *mmap;  /* areas in address order */
+   struct vm_avl *vma_addr;      /* area index by address */
+   struct vm_avl *vma_id;        /* area index by vm_id */
+   int map_count;
+   unsigned long vma_next_id;
+
+   /* Region handle table indexed by region ID, grown on demand */
+   struct symrg_struct *symrgtbl;
+   int symrg_sz;
 
-   /* Currently we support a fixed number of symbol */
-   struct vm_rg_struct symrgtbl[PAGING_MAX_SYMTBL_SZ];
+   /* Resident page tracking of the page replacement policy */
+   struct pgrepl_struct *pgrepl;
 
-   /* list of free page */
-   struct pgn_t *fifo_pgn;
+   /* Swap readahead window, grown by sequential swap-in faults */
+   int ra_win;
+   addr_t ra_next; /* page expected to fault next on a sequential scan */
 };
 
 /*
@@ -118,20 +185,136 @@ struct framephy_struct {
 
    /* Resereed for tracking allocated framed */
    struct mm_struct* owner;
+   addr_t pgn;    /* page held by the frame, valid when owner is set */
+   int ref;       /* referenced since the last global CLOCK sweep */
+   int swptyp;    /* swap cache: device of a still-valid copy, -1 if none */
+   addr_t swpoff; /* swap cache: frame of that copy in the swap device */
+   int sc_next;   /* swap cache list of that device, valid when swptyp is set */
+   int sc_prev;
+   int ra;        /* brought in by readahead, not referenced yet */
+   int fstk;      /* 1 + slot on the device free stack, 0 if not there */
+   int used;      /* on the device used set (MEMPHY_put_usedfp) */
+   int buddy;     /* 1 + order of the free buddy block starting here, or 0 */
+   int bd_next;   /* free buddy list links, valid when buddy is set */
+   int bd_prev;
 };
 
 struct memphy_struct {
-   /* Basic field of data and size */
-   BYTE *storage;
-   int maxsz;
+   /* Basic field of data and size, storage chunks are allocated on
+    * first write and a missing one reads as zeroes */
+   BYTE **chunk;
+   int nchunk;
+   unsigned long nchunk_live;
+   uint64_t maxsz;
+
+   /* Host file backing (MEMPHY_attach_file), fd is -1 without one */
+   int fd;
+   BYTE *map;      /* shared mapping of a random access device */
+   BYTE *bounce;   /* aligned page buffer of a streamed device */
+   int direct;     /* streamed with O_DIRECT */
+
+   /* Timing model, an access costs lat_ns (a sequential device only pays
+    * it when the cursor has to move) plus its bytes at bw_mbs */
+   uint64_t lat_ns;
+   uint64_t bw_mbs;   /* MB/s, 0 is unlimited */
+   uint64_t busy_ns;  /* device time charged so far */
+   uint64_t io_next;  /* byte after the last access */
    
    /* Sequential device fields */ 
    int rdmflg;
-   int cursor;
+   uint64_t cursor;
+
+   /* Management structure: frames below free_next were handed out at
+    * least once and are free only if on free_stk or in a buddy block,
+    * frames from free_next up are free and their descriptors not set up */
+   addr_t *free_stk;
+   int free_top;
+   int free_next;
+   int free_cnt;   /* free frames, stacked or above free_next */
+   int used_cnt;   /* frames on the used set */
+
+   /* Buddy free lists of aligned 2^order frame blocks, heads are fpn */
+   int bd_head[MEMPHY_MAX_ORDER + 1];
+   int bd_cnt[MEMPHY_MAX_ORDER + 1];
+   int bd_free;    /* frames on the buddy lists */
+
+   /* Frame table indexed by fpn, also the reverse map fpn -> (owner, pgn) */
+   struct framephy_struct *rmap;
+   int rmap_sz;
+   int rmap_hand;  /* global CLOCK hand */
 
-   /* Management structure */
-   struct framephy_struct *free_fp_list;
-   struct framephy_struct *used_fp_list;
+   /* Frames with a swap cache copy, one list per swap device, heads are fpn */
+   int swpc_head[PAGING_MAX_MMSWP];
+};
+
+/*
+ * Page geometry. Shift and masks are precomputed from the page size so
+ * that the address macros stay a shift and an AND.
+ */
+struct paging_geom_struct {
+   addr_t pagesz;
+   int shift;
+   addr_t offst_mask;   /* offset bits of an address */
+   addr_t pgn_mask;     /* page number bits of an address */
+   addr_t max_pgn;      /* page number limit (flat 32-bit page table) */
+};
+
+/*
+ * Kernel memory parameters, given on the command line at boot
+ */
+struct mmparam_struct {
+   int pgrepl;    /* page replacement policy (PGREPL_*) */
+   int pgscope;   /* victim scope, PGSCOPE_LOCAL or PGSCOPE_GLOBAL */
+   int swpsel;    /* swap device selection, SWPSEL_PRIO or SWPSEL_STRIPE */
+   int swapra;    /* max swap readahead window in pages, 1 disables it */
+   unsigned long zswap; /* compressed swap pool budget in bytes, 0 is off */
+   int kswapd;    /* run the background page-out daemon */
+   int wmark_low; /* MEMRAM free frames that wake the daemon */
+   int wmark_high;/* MEMRAM free frames the daemon reclaims up to */
+   int stat;      /* print memory statistics at shutdown */
+   const char *swpfile; /* host file prefix of the swap devices, or NULL */
+   int swpstream; /* swap devices are sequential and streamed */
+   int pwc;       /* cache the upper page-table levels (MM64) */
+   int pgtbl;     /* page table structure, PGTBL_RADIX or PGTBL_HASH (MM64) */
+   int thp;       /* map 2 MiB spans with one PMD entry at fault (MM64) */
+   unsigned long pagesz;  /* page size in bytes */
+   unsigned long slotus;  /* length of a timer slot in microseconds */
+   unsigned long ramlat;  /* MEMRAM access latency in ns */
+   unsigned long rambw;   /* MEMRAM bandwidth in MB/s, 0 is unlimited */
+   unsigned long swplat[PAGING_MAX_MMSWP]; /* swap seek latency in ns */
+   unsigned long swpbw[PAGING_MAX_MMSWP];  /* swap bandwidth in MB/s */
+};
+
+/*
+ * Memory subsystem event counters
+ */
+struct mmstat_struct {
+   unsigned long access;   /* page references through pg_getpage */
+   unsigned long pgfault;  /* references to a page not in MEMRAM */
+   unsigned long evict;    /* victim pages pushed out of MEMRAM */
+   unsigned long steal;    /* victims owned by another process */
+   unsigned long swapin;   /* pages brought back from MEMSWP */
+   unsigned long swpout;   /* victim pages copied to MEMSWP */
+   unsigned long swpsaved; /* bytes not written thanks to the swap cache */
+   unsigned long swpdev[PAGING_MAX_MMSWP]; /* swap frames handed out per device */
+   unsigned long ra;       /* pages brought in by swap readahead */
+   unsigned long ra_hit;   /* readahead pages referenced afterwards */
+   unsigned long ra_waste; /* readahead pages evicted unreferenced */
+   unsigned long swpcontig;/* swap frames placed after their neighbour */
+   unsigned long zswap_store;  /* pages kept in the compressed pool */
+   unsigned long zswap_same;   /* ... of which same-filled */
+   unsigned long zswap_reject; /* pages that did not compress or fit */
+   unsigned long zswap_load;   /* pages read back from the pool */
+   unsigned long zswap_saved;  /* bytes saved by compression */
+   unsigned long kswapd_wake;  /* page-out daemon wakeups */
+   unsigned long kswapd_evict; /* evictions done by the daemon */
+   unsigned long io_stall;     /* CPU slots spent waiting on devices */
+   unsigned long thp_map;      /* faults mapped with a 2 MiB entry */
+   unsigned long thp_fallback; /* eligible faults mapped with a 4 KiB page */
+   unsigned long thp_split;    /* 2 MiB entries split for an eviction */
+   unsigned long pt_procs;     /* processes exited */
+   unsigned long pt_bytes;     /* ... page-table bytes they held at exit */
+   unsigned long pt_bytes_max;
 };
 
 #endif
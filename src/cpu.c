@@ -5,6 +5,8 @@
 #include "syscall.h"
 #include "libmem.h"
 
+__thread struct pcb_t *current_proc;
+
 int calc(struct pcb_t *proc)
 {
 	return ((unsigned long)proc & 0UL);
@@ -58,6 +60,23 @@ int write(
 	return write_mem(proc->regs[destination] + offset, proc, data);
 }
 
+int expect(
+	struct pcb_t *proc,	// Process executing the instruction
+	uint32_t source,	// Index of source register
+	uint32_t offset,	// Source address = [source] + [offset]
+	BYTE value)
+{ // Byte the source address must hold
+	BYTE data;
+	if (read_mem(proc->regs[source] + offset, proc, &data) == 0 &&
+	    data == value)
+	{
+		return 0;
+	}
+	printf("expect: PID=%d address %lu expected %u\n",
+		proc->pid, (unsigned long)(proc->regs[source] + offset), value);
+	return 1;
+}
+
 int run(struct pcb_t *proc)
 {
 	/* Check if Program Counter point to the proper instruction */
@@ -69,6 +88,7 @@ int run(struct pcb_t *proc)
 	struct inst_t ins = proc->code->text[proc->pc];
 	proc->pc++;
 	int stat = 1;
+	current_proc = proc;
 switch (ins.opcode)
 	{
 	case CALC:
@@ -105,8 +125,30 @@ switch (ins.opcode)
 	case SYSCALL:
 		stat = libsyscall(proc, ins.arg_0, ins.arg_1, ins.arg_2, ins.arg_3);
 		break;
+	case EXPECT:
+#ifdef MM_PAGING
+		stat = libexpect(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+#else
+		stat = expect(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+#endif
+		break;
+	case MMAP:
+#ifdef MM_PAGING
+		stat = libmmap(proc, ins.arg_0, ins.arg_1);
+#else
+		stat = alloc(proc, ins.arg_0, ins.arg_1);
+#endif
+		break;
+	case MUNMAP:
+#ifdef MM_PAGING
+		stat = libmunmap(proc, ins.arg_0);
+#else
+		stat = free_data(proc, ins.arg_0);
+#endif
+		break;
 	default:
 		stat = 1;
 	}
+	current_proc = NULL;
 	return stat;
 }
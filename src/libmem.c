@@ -25,6 +25,12 @@
 
 static pthread_mutex_t mmvm_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* Background page-out daemon, sleeps on kswapd_cond under mmvm_lock */
+static pthread_t kswapd_thread;
+static pthread_cond_t kswapd_cond = PTHREAD_COND_INITIALIZER;
+static int kswapd_running;
+static int kswapd_stopping;
+
 /*enlist_vm_freerg_list - add new rg to freerg_list
  *@mm: memory region
  *@rg_elmt: new region
@@ -32,18 +38,8 @@ static pthread_mutex_t mmvm_lock = PTHREAD_MUTEX_INITIALIZER;
  */
 int enlist_vm_freerg_list(struct mm_struct *mm, struct vm_rg_struct *rg_elmt)
 {
-  struct vm_rg_struct *rg_node = mm->mmap->vm_freerg_list;
-
-  if (rg_elmt->rg_start >= rg_elmt->rg_end)
-    return -1;
-
-  if (rg_node != NULL)
-    rg_elmt->rg_next = rg_node;
-
-  /* Enlist the new region */
-  mm->mmap->vm_freerg_list = rg_elmt;
-
-  return 0;
+  /* Address ordered, merged with the free neighbours */
+  return vm_freerg_insert(mm->mmap, rg_elmt);
 }
 
 /*get_symrg_byid - get mem region by region ID
@@ -51,9 +47,9 @@ int enlist_vm_freerg_list(struct mm_struct *mm, struct vm_rg_struct *rg_elmt)
  *@rgid: region ID act as symbol index of variable
  *
  */
-struct vm_rg_struct *get_symrg_byid(struct mm_struct *mm, int rgid)
+struct symrg_struct *get_symrg_byid(struct mm_struct *mm, int rgid)
 {
-  if (rgid < 0 || rgid > PAGING_MAX_SYMTBL_SZ)
+  if (rgid < 0 || rgid >= mm->symrg_sz)
     return NULL;
 
   return &mm->symrgtbl[rgid];
@@ -75,10 +71,19 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, addr_t size, addr_t *allo
   struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
   int inc_sz=0;
 
+  /* Make room for the ID first, the table may grow */
+  struct symrg_struct *symrg = symrg_get(caller->mm, rgid);
+  if (symrg == NULL)
+  {
+    pthread_mutex_unlock(&mmvm_lock);
+    return -1;
+  }
+
   if (get_free_vmrg_area(caller, vmaid, size, &rgnode) == 0)
   {
-    caller->mm->symrgtbl[rgid].rg_start = rgnode.rg_start;
-    caller->mm->symrgtbl[rgid].rg_end = rgnode.rg_end;
+    symrg->rg_start = rgnode.rg_start;
+    symrg->rg_end = rgnode.rg_end;
+    symrg->vmaid = vmaid;
  
     *alloc_addr = rgnode.rg_start;
 
@@ -98,8 +103,9 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, addr_t size, addr_t *allo
   int old_sbrk;
   inc_sz = inc_sz + 1;
 
-  /* cur_vma should never be NULL here, but be defensive */
-  if (cur_vma == NULL)
+  /* cur_vma should never be NULL here, but be defensive. Only the heap
+   * area grows, an mmap area keeps the size it was created with */
+  if (cur_vma == NULL || vmaid != 0)
   {
     pthread_mutex_unlock(&mmvm_lock);
     return -1;
@@ -118,11 +124,16 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, addr_t size, addr_t *allo
 #else
   regs.a3 = PAGING_PAGE_ALIGNSZ(size);
 #endif  
-  syscall(caller->krnl, caller->pid, 17, &regs); /* SYSCALL 17 sys_memmap */
+  if (syscall(caller->krnl, caller->pid, 17, &regs) < 0) /* SYSCALL 17 sys_memmap */
+  {
+    pthread_mutex_unlock(&mmvm_lock);
+    return -1;
+  }
 
   /*Successful increase limit */
-  caller->mm->symrgtbl[rgid].rg_start = old_sbrk;
-  caller->mm->symrgtbl[rgid].rg_end = old_sbrk + size;
+  symrg->rg_start = old_sbrk;
+  symrg->rg_end = old_sbrk + size;
+  symrg->vmaid = vmaid;
 
   *alloc_addr = old_sbrk;
 
@@ -133,39 +144,36 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, addr_t size, addr_t *allo
 
 /*__free - remove a region memory
  *@caller: caller
- *@vmaid: ID vm area to alloc memory region
  *@rgid: memory region ID (used to identify variable in symbole table)
- *@size: allocated size
  *
+ * The region goes back to the vm area it was allocated in.
  */
-int __free(struct pcb_t *caller, int vmaid, int rgid)
+int __free(struct pcb_t *caller, int rgid)
 {
   pthread_mutex_lock(&mmvm_lock);
 
-  if (rgid < 0 || rgid > PAGING_MAX_SYMTBL_SZ)
-  {
-    pthread_mutex_unlock(&mmvm_lock);
-    return -1;
-  }
-
   /* TODO: Manage the collect freed region to freerg_list */
-  struct vm_rg_struct *rgnode = get_symrg_byid(caller->mm, rgid);
+  struct symrg_struct *rgnode = get_symrg_byid(caller->mm, rgid);
 
-  if (rgnode->rg_start == 0 && rgnode->rg_end == 0)
+  if (rgnode == NULL || (rgnode->rg_start == 0 && rgnode->rg_end == 0))
   {
     pthread_mutex_unlock(&mmvm_lock);
     return -1;
   }
-  struct vm_rg_struct *freerg_node = malloc(sizeof(struct vm_rg_struct));
+  struct vm_rg_struct *freerg_node = kmem_cache_alloc(KMEM_VM_RG);
+  int vmaid = rgnode->vmaid;
   freerg_node->rg_start = rgnode->rg_start;
   freerg_node->rg_end = rgnode->rg_end;
   freerg_node->rg_next = NULL;
 
-  rgnode->rg_start = rgnode->rg_end = 0;
-  rgnode->rg_next = NULL;
+  /* The ID can be handed out again */
+  symrg_put(caller->mm, rgid);
 
-  /*enlist the obsoleted memory region */
-  enlist_vm_freerg_list(caller->mm, freerg_node);
+  /*enlist the obsoleted memory region in the area it came from */
+  struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
+
+  if (cur_vma == NULL || vm_freerg_insert(cur_vma, freerg_node) < 0)
+    kmem_cache_free(KMEM_VM_RG, freerg_node);
 
   pthread_mutex_unlock(&mmvm_lock);
   return 0;
@@ -207,7 +215,7 @@ int liballoc(struct pcb_t *proc, addr_t size, uint32_t reg_index)
 
 int libfree(struct pcb_t *proc, uint32_t reg_index)
 {
-  int val = __free(proc, 0, reg_index);
+  int val = __free(proc, reg_index);
   if (val == -1)
   {
     return -1;
@@ -224,108 +232,457 @@ int libfree(struct pcb_t *proc, uint32_t reg_index)
   return 0;//val;
 }
 
-/*pg_getpage - get the page in ram
- *@mm: memory region
- *@pagenum: PGN
- *@framenum: return FPN
- *@caller: caller
+/*pg_swap_hint - suggest a swap frame for a page about to be swapped out
+ *@owner: process owning the page
+ *@pgn: page number
+ *@swptyp: return the swap device of the previous page
+ *@swpfpn: return the swap frame following the one of the previous page
  *
  */
-int pg_getpage(struct mm_struct *mm, addr_t pgn, addr_t *fpn, struct pcb_t *caller)
+static int pg_swap_hint(struct pcb_t *owner, addr_t pgn, int *swptyp, addr_t *swpfpn)
 {
-  pte_t pte = pte_get_entry(caller, pgn);
+  pte_t pte;
 
-  if (!PAGING_PAGE_PRESENT(pte))
-  { /* Page is not online, make it actively living */
-    addr_t vicpgn, swpfpn;
-    addr_t vicfpn;
-    pte_t vicpte;
-    addr_t tgtfpn; // Target frame for the requested page
+  if (pgn == 0)
+    return -1;
 
-    /* Get the swap offset where our page is stored */
-    if (pte & PAGING_PTE_SWAPPED_MASK)
-    {
-      swpfpn = PAGING_SWP(pte);
-    }
-    else
+  pte = pte_get_entry(owner, pgn - 1);
+
+  if (PAGING_PAGE_ONLINE(pte))
+  {
+    /* Resident neighbour, use its swap cache copy if any */
+    if (MEMPHY_swpcache_get(owner->krnl->mram, PAGING_FPN(pte), swptyp, swpfpn) < 0)
+      return -1;
+  }
+  else if (pte & PAGING_PTE_SWAPPED_MASK)
+  {
+    *swptyp = PAGING_SWPTYP(pte);
+    *swpfpn = PAGING_SWP(pte);
+  }
+  else
+    return -1;
+
+  *swpfpn += 1;
+  return 0;
+}
+
+/*pg_evict - push one page out of MEMRAM to free its frame
+ *@caller: faulting process, or a PCB shell without mm for the daemon
+ *@retfpn: return the freed FPN
+ *
+ * The victim comes from the caller replacement policy in local scope,
+ * and from the policy state shared by every process in global scope.
+ * When the caller has nothing resident (or is the daemon in local
+ * scope), the MEMRAM reverse map picks a frame of any process. A clean
+ * victim that still has its copy in MEMSWP (swap cache) is dropped with
+ * a PTE update only.
+ */
+static int pg_evict(struct pcb_t *caller, addr_t *retfpn)
+{
+  struct krnl_t *krnl = caller->krnl;
+  struct pcb_t owner; /* PCB shell reaching the page table of the victim */
+  addr_t vicpgn, vicfpn, swpfpn, zidx;
+  pte_t vicpte;
+  int swptyp = -1;
+
+  memset(&owner, 0, sizeof(struct pcb_t));
+  owner.krnl = krnl;
+  owner.pid = caller->pid;
+  owner.mm = caller->mm;
+
+  if (krnl->mmparam.pgscope == PGSCOPE_GLOBAL &&
+      pgrepl_victim(krnl->pgrepl, &owner.mm, &vicpgn) == 0)
+  {
+    vicfpn = PAGING_FPN(pte_get_entry(&owner, vicpgn));
+  }
+  else if (krnl->mmparam.pgscope == PGSCOPE_LOCAL && caller->mm != NULL &&
+           find_victim_page(caller->mm, &vicpgn) == 0)
+  {
+    vicfpn = PAGING_FPN(pte_get_entry(&owner, vicpgn));
+  }
+  else if (MEMPHY_rmap_victim(krnl->mram, &vicfpn) == 0)
+  {
+    MEMPHY_rmap_get(krnl->mram, vicfpn, &owner.mm, &vicpgn);
+    pgrepl_remove(owner.mm, vicpgn);
+  }
+  else
+    return -1; /* No victim page found */
+
+  vicpte = pte_get_entry(&owner, vicpgn);
+  if (vicpte & PAGING_PTE_HUGE_MASK)
+  {
+    /* Only the victim leaves, the rest of the span stays resident as
+     * single pages */
+    addr_t head = vicpgn & ~(addr_t)(PAGING_HUGE_NRPG - 1), i;
+
+    if (pte_split_huge(&owner, vicpgn) < 0)
     {
-      /* Page has never been loaded, it's a new page */
-      swpfpn = 0; // Will be handled as zero-filled
+      /* The span stays mapped, keep it a victim candidate */
+      pgrepl_insert(owner.mm, head);
+      return -1;
     }
+    pgrepl_remove(owner.mm, head);
+    for (i = head; i < head + PAGING_HUGE_NRPG; i++)
+      if (i != vicpgn)
+        pgrepl_insert(owner.mm, i);
+    krnl->mmstat.thp_split++;
+    vicpte = pte_get_entry(&owner, vicpgn);
+  }
 
-    /* Try to get a free frame in RAM */
-    if (MEMPHY_get_freefp(caller->krnl->mram, &tgtfpn) == -1)
+  if (MEMPHY_swpcache_get(krnl->mram, vicfpn, &swptyp, &swpfpn) == 0 &&
+      !(vicpte & PAGING_PTE_DIRTY_MASK))
+  {
+    /* Clean page, the copy in MEMSWP is still valid */
+    krnl->mmstat.swpsaved += PAGING_PAGESZ;
+  }
+  else if (krnl->zswap != NULL &&
+           zswap_store(krnl, krnl->mram, vicfpn, &zidx) == 0)
+  {
+    /* Kept compressed in memory, a stale copy on a device is released */
+    if (swptyp >= 0)
+      MEMPHY_put_freefp(krnl->mswp[swptyp], swpfpn);
+    swptyp = PAGING_SWPTYP_ZSWAP;
+    swpfpn = zidx;
+  }
+  else
+  {
+    if (swptyp < 0)
     {
-      /* RAM is full, need to swap out a victim page */
-      
-      /* Find victim page using FIFO */
-      if (find_victim_page(caller->mm, &vicpgn) == -1)
+      /* Get free frame in MEMSWP for victim, next to its neighbour */
+      pg_swap_hint(&owner, vicpgn, &swptyp, &swpfpn);
+      if (mm_swap_alloc(krnl, &swptyp, &swpfpn) == -1)
       {
-        return -1; /* No victim page found */
+        /* SWAP is full, keep the victim resident */
+        pgrepl_insert(owner.mm, vicpgn);
+        return -1;
       }
+    }
+
+    /* Swap victim page from RAM to SWAP using syscall */
+    struct sc_regs regs;
+    regs.a1 = SYSMEM_SWP_OP;
+    regs.a2 = vicfpn; // Source FPN in RAM
+    regs.a3 = swpfpn; // Destination FPN in SWAP
+    regs.a4 = swptyp; // Destination swap device
+    syscall(krnl, caller->pid, 17, &regs); /* SYSCALL 17 sys_memmap */
+    krnl->mmstat.swpout++;
+  }
+
+  /* Update victim page table entry to mark as swapped */
+  pte_set_swap(&owner, vicpgn, swptyp, swpfpn);
+  if (MEMPHY_rmap_take_ra(krnl->mram, vicfpn))
+  {
+    /* Read ahead for nothing, narrow the window of the owner */
+    krnl->mmstat.ra_waste++;
+    owner.mm->ra_win = (owner.mm->ra_win > 1) ? owner.mm->ra_win / 2 : 1;
+  }
+  MEMPHY_rmap_clear(krnl->mram, vicfpn);
+  if (caller->mm != NULL && owner.mm != caller->mm)
+    krnl->mmstat.steal++;
+  krnl->mmstat.evict++;
+
+  *retfpn = vicfpn;
+  return 0;
+}
+
+/*pg_swapin - copy a swapped page back to MEMRAM and map it
+ *@caller: caller
+ *@pgn: page number
+ *@pte: swapped PTE of the page
+ *@tgtfpn: free frame in MEMRAM
+ *
+ */
+static void pg_swapin(struct pcb_t *caller, addr_t pgn, pte_t pte, addr_t tgtfpn)
+{
+  struct krnl_t *krnl = caller->krnl;
+  struct sc_regs regs;
+
+  /* Swap page from SWAP to RAM */
+  regs.a1 = SYSMEM_SWPIN_OP;
+  regs.a2 = PAGING_SWP(pte);    // Source FPN in SWAP
+  regs.a3 = tgtfpn;             // Destination FPN in RAM
+  regs.a4 = PAGING_SWPTYP(pte); // Source swap device
+  syscall(krnl, caller->pid, 17, &regs);
+
+  /* Update page table entry to mark page as present in RAM */
+  pte_set_fpn(caller, pgn, tgtfpn);
+  pte_range_protect(caller, pgn, 1, PAGING_PTE_DIRTY_MASK, 0);
+  MEMPHY_rmap_set(krnl->mram, tgtfpn, caller->mm, pgn);
+
+  /* The swap frame is kept as swap cache until the page gets dirty,
+   * a compressed entry is released by the load */
+  if (PAGING_SWPTYP(pte) != PAGING_SWPTYP_ZSWAP)
+    MEMPHY_swpcache_set(krnl->mram, tgtfpn, PAGING_SWPTYP(pte), PAGING_SWP(pte));
+
+  /* Track the page for future replacement */
+  pgrepl_insert(caller->mm, pgn);
+}
+
+/*pg_readahead - swap in the pages following a swap-in fault
+ *@caller: caller
+ *@pgn: faulting page number
+ *
+ * A fault on the page right after the last one read ahead doubles the
+ * window up to the swapra parameter, any other fault resets it, and
+ * an unused readahead page halves it when evicted.
+ *
+ * Runs before pgn is mapped, so the evictions making room for the
+ * window cannot take the faulting page. The window stays below half
+ * of MEMRAM, a page read ahead is not evicted by the next one.
+ */
+static void pg_readahead(struct pcb_t *caller, addr_t pgn)
+{
+  struct krnl_t *krnl = caller->krnl;
+  struct mm_struct *mm = caller->mm;
+  addr_t rapgn, tgtfpn;
+  int ramax = krnl->mmparam.swapra;
+  pte_t pte;
+
+  if (ramax > krnl->mram->rmap_sz / 2)
+    ramax = krnl->mram->rmap_sz / 2;
+  if (ramax <= 1)
+    return;
+
+  if (pgn == mm->ra_next)
+    mm->ra_win = (mm->ra_win * 2 < ramax) ? mm->ra_win * 2 : ramax;
+  else
+    mm->ra_win = 1;
+
+  for (rapgn = pgn + 1; rapgn < pgn + mm->ra_win; rapgn++)
+  {
+    pte = pte_get_entry(caller, rapgn);
+    if (PAGING_PAGE_ONLINE(pte) || !(pte & PAGING_PTE_SWAPPED_MASK))
+      break;
+
+    if (MEMPHY_get_freefp(krnl->mram, &tgtfpn) == -1 &&
+        pg_evict(caller, &tgtfpn) == -1)
+      break;
 
-      /* Get the victim page's PTE */
-      vicpte = pte_get_entry(caller, vicpgn);
-      vicfpn = PAGING_FPN(vicpte);
+    pg_swapin(caller, rapgn, pte, tgtfpn);
+    MEMPHY_rmap_mark_ra(krnl->mram, tgtfpn);
+    krnl->mmstat.ra++;
+  }
+
+  mm->ra_next = rapgn;
+}
+
+/*kswapd_routine - page-out daemon body
+ *@arg: kernel
+ *
+ * Wakes up when MEMRAM free frames fall below wmark_low and evicts
+ * cold pages until wmark_high frames are free. The lock is dropped
+ * between two evictions so faulting CPUs are not held off.
+ */
+static void *kswapd_routine(void *arg)
+{
+  struct krnl_t *krnl = (struct krnl_t *)arg;
+  struct pcb_t shell; /* no mm, victims come from the reverse map */
+  addr_t fpn;
 
-      /* Get free frame in MEMSWP for victim */
-      addr_t victim_swpfpn;
-      if (MEMPHY_get_freefp(caller->krnl->active_mswp, &victim_swpfpn) == -1)
+  memset(&shell, 0, sizeof(struct pcb_t));
+  shell.krnl = krnl;
+
+  pthread_mutex_lock(&mmvm_lock);
+  while (!kswapd_stopping)
+  {
+    if (krnl->mram->free_cnt < krnl->mmparam.wmark_low)
+    {
+      krnl->mmstat.kswapd_wake++;
+      while (!kswapd_stopping &&
+             krnl->mram->free_cnt < krnl->mmparam.wmark_high &&
+             pg_evict(&shell, &fpn) == 0)
       {
-        return -1; /* SWAP is full */
+        MEMPHY_put_freefp(krnl->mram, fpn);
+        krnl->mmstat.kswapd_evict++;
+
+        pthread_mutex_unlock(&mmvm_lock);
+        pthread_mutex_lock(&mmvm_lock);
       }
+    }
+
+    if (!kswapd_stopping)
+      pthread_cond_wait(&kswapd_cond, &mmvm_lock);
+  }
+  pthread_mutex_unlock(&mmvm_lock);
+
+  return NULL;
+}
+
+/*mm_kswapd_start - launch the page-out daemon
+ *@krnl: kernel, mram must be set
+ *
+ */
+int mm_kswapd_start(struct krnl_t *krnl)
+{
+  int nframes = krnl->mram->maxsz / PAGING_PAGESZ;
+
+  /* Default watermarks: wake at 1/16 of MEMRAM free, refill to 1/8 */
+  if (krnl->mmparam.wmark_low <= 0)
+    krnl->mmparam.wmark_low = (nframes / 16 > 0) ? nframes / 16 : 1;
+  if (krnl->mmparam.wmark_high <= krnl->mmparam.wmark_low)
+    krnl->mmparam.wmark_high = krnl->mmparam.wmark_low * 2;
+  if (krnl->mmparam.wmark_high > nframes)
+    krnl->mmparam.wmark_high = nframes;
+
+  kswapd_stopping = 0;
+  if (pthread_create(&kswapd_thread, NULL, kswapd_routine, krnl) != 0)
+    return -1;
+  kswapd_running = 1;
+
+  return 0;
+}
+
+/*mm_kswapd_stop - stop the page-out daemon and wait for it
+ *@krnl: kernel
+ *
+ */
+int mm_kswapd_stop(struct krnl_t *krnl)
+{
+  if (!kswapd_running)
+    return -1;
+
+  pthread_mutex_lock(&mmvm_lock);
+  kswapd_stopping = 1;
+  pthread_cond_signal(&kswapd_cond);
+  pthread_mutex_unlock(&mmvm_lock);
+
+  pthread_join(kswapd_thread, NULL);
+  kswapd_running = 0;
+
+  return 0;
+}
+
+/*pg_thp_fault - map the 2 MiB span of a faulting page at once
+ *@caller: caller
+ *@pgn: faulting page number, not mapped yet
+ *
+ * The aligned span must lie in allocated regions of one vm area with
+ * nothing mapped in it, and MEMRAM must keep its low watermark after the 512 frames
+ * are taken. Return -1 when the fault falls back to a single page.
+ */
+static int pg_thp_fault(struct pcb_t *caller, addr_t pgn)
+{
+  struct krnl_t *krnl = caller->krnl;
+  struct vm_area_struct *vma;
+  addr_t head = pgn & ~(addr_t)(PAGING_HUGE_NRPG - 1);
+  addr_t start = head * PAGING_PAGESZ;
+  addr_t end = start + (addr_t)PAGING_HUGE_NRPG * PAGING_PAGESZ;
+  addr_t fpn, i;
+
+  if (PAGING_PTE_HUGE_MASK == 0)
+    return -1; /* 32-bit mode, no PMD level */
+
+  /* Allocated regions only, found through the area and its free regions */
+  vma = find_vma(caller->mm, start);
+  if (vma == NULL || !vm_range_allocated(vma, start, end))
+    return -1;
+
+  if (krnl->mram->free_cnt < PAGING_HUGE_NRPG + krnl->mmparam.wmark_low ||
+      MEMPHY_alloc_order(krnl->mram, PAGING_HUGE_ORDER, &fpn) < 0)
+  {
+    krnl->mmstat.thp_fallback++;
+    return -1;
+  }
+  if (pte_set_huge(caller, head, fpn) < 0)
+  {
+    /* Part of the span is already mapped */
+    MEMPHY_free_order(krnl->mram, fpn, PAGING_HUGE_ORDER);
+    return -1;
+  }
+
+  for (i = 0; i < PAGING_HUGE_NRPG; i++)
+  {
+    MEMPHY_zero_page(krnl->mram, fpn + i);
+    MEMPHY_rmap_set(krnl->mram, fpn + i, caller->mm, head + i);
+  }
 
-      /* Swap victim page from RAM to SWAP using syscall */
-      struct sc_regs regs;
-      regs.a1 = SYSMEM_SWP_OP;
-      regs.a2 = vicfpn;     // Source FPN in RAM
-      regs.a3 = victim_swpfpn;  // Destination FPN in SWAP
-      syscall(caller->krnl, caller->pid, 17, &regs); /* SYSCALL 17 sys_memmap */
+  /* The span is one replacement unit until it gets split */
+  pgrepl_insert(caller->mm, head);
+  krnl->mmstat.thp_map++;
 
-      /* Update victim page table entry to mark as swapped */
-      pte_set_swap(caller, vicpgn, caller->krnl->active_mswp_id, victim_swpfpn);
+  return 0;
+}
 
-      /* Now we have vicfpn free in RAM to use */
-      tgtfpn = vicfpn;
+/*pg_getpage - get the page in ram
+ *@mm: memory region
+ *@pagenum: PGN
+ *@framenum: return FPN
+ *@caller: caller
+ *
+ */
+int pg_getpage(struct mm_struct *mm, addr_t pgn, addr_t *fpn, struct pcb_t *caller)
+{
+  pte_t pte = pte_get_entry(caller, pgn);
+
+  caller->krnl->mmstat.access++;
+
+  if (!PAGING_PAGE_ONLINE(pte))
+  { /* Page is not online, make it actively living */
+    addr_t tgtfpn; // Target frame for the requested page
+
+    caller->krnl->mmstat.pgfault++;
+
+    if (pte == 0 && caller->krnl->mmparam.thp && pg_thp_fault(caller, pgn) == 0)
+    {
+      *fpn = PAGING_FPN(pte_get_entry(caller, pgn));
+      return 0;
+    }
+
+    /* Try to get a free frame in RAM, else swap out a victim page */
+    if (MEMPHY_get_freefp(caller->krnl->mram, &tgtfpn) == -1 &&
+        pg_evict(caller, &tgtfpn) == -1)
+    {
+      return -1;
     }
 
+    /* Running low, let the daemon refill MEMRAM in the background */
+    if (kswapd_running &&
+        caller->krnl->mram->free_cnt < caller->krnl->mmparam.wmark_low)
+      pthread_cond_signal(&kswapd_cond);
+
     /* At this point, tgtfpn is a free frame in RAM */
     
     /* If the page was previously swapped, copy it back from SWAP to RAM */
     if (pte & PAGING_PTE_SWAPPED_MASK)
     {
-      /* Swap page from SWAP to RAM */
-      struct sc_regs regs;
-      regs.a1 = SYSMEM_SWP_OP;
-      regs.a2 = tgtfpn;   // Destination FPN in RAM
-      regs.a3 = swpfpn;   // Source FPN in SWAP
-      syscall(caller->krnl, caller->pid, 17, &regs);
-
-      /* Free the swap frame */
-      MEMPHY_put_freefp(caller->krnl->active_mswp, swpfpn);
+      /* Bring the following swapped pages in first, tgtfpn is already
+       * held and pgn is not a victim candidate until it is mapped */
+      pg_readahead(caller, pgn);
+
+      pg_swapin(caller, pgn, pte, tgtfpn);
+      caller->krnl->mmstat.swapin++;
     }
     else
     {
       /* New page, zero-fill it */
-      for (int i = 0; i < PAGING_PAGESZ; i++)
-      {
-        struct sc_regs regs;
-        regs.a1 = SYSMEM_IO_WRITE;
-        regs.a2 = tgtfpn * PAGING_PAGESZ + i;
-        regs.a3 = 0; // Write zero
-        syscall(caller->krnl, caller->pid, 17, &regs);
-      }
-    }
+      MEMPHY_zero_page(caller->krnl->mram, tgtfpn);
 
-    /* Update page table entry to mark page as present in RAM */
-    pte_set_fpn(caller, pgn, tgtfpn);
+      /* Update page table entry to mark page as present in RAM */
+      pte_set_fpn(caller, pgn, tgtfpn);
+      pte_range_protect(caller, pgn, 1, PAGING_PTE_DIRTY_MASK, 0);
+      MEMPHY_rmap_set(caller->krnl->mram, tgtfpn, caller->mm, pgn);
 
-    /* Add page to FIFO list for future replacement */
-    enlist_pgn_node(&caller->mm->fifo_pgn, pgn);
+      /* Track the page for future replacement */
+      pgrepl_insert(caller->mm, pgn);
+    }
+  }
+  else
+  {
+    /* Reference to a resident page, let the policies age it */
+    if (pte & PAGING_PTE_HUGE_MASK)
+      pgrepl_access(caller->mm, pgn & ~(addr_t)(PAGING_HUGE_NRPG - 1));
+    else
+      pgrepl_access(caller->mm, pgn);
+    MEMPHY_rmap_ref(caller->krnl->mram, PAGING_FPN(pte));
+    if (MEMPHY_rmap_take_ra(caller->krnl->mram, PAGING_FPN(pte)))
+      caller->krnl->mmstat.ra_hit++;
   }
 
-  /* Get the frame number from updated PTE */
-  *fpn = PAGING_FPN(pte_get_entry(caller, pgn));
+  /* Get the frame number from updated PTE, it must be resident now */
+  pte = pte_get_entry(caller, pgn);
+  if (!PAGING_PAGE_ONLINE(pte))
+    return -1;
+  *fpn = PAGING_FPN(pte);
 
   return 0;
 }
@@ -389,9 +746,7 @@ int pg_setval(struct mm_struct *mm, addr_t addr, BYTE value, struct pcb_t *calle
   syscall(caller->krnl, caller->pid, 17, &regs); /* SYSCALL 17 sys_memmap */
 
   /* Mark page as dirty (modified) */
-  pte_t pte = pte_get_entry(caller, pgn);
-  pte |= PAGING_PTE_DIRTY_MASK;
-  pte_set_entry(caller, pgn, pte);
+  pte_range_protect(caller, pgn, 1, 0, PAGING_PTE_DIRTY_MASK);
 
   return 0;
 }
@@ -406,14 +761,23 @@ int pg_setval(struct mm_struct *mm, addr_t addr, BYTE value, struct pcb_t *calle
  */
 int __read(struct pcb_t *caller, int vmaid, int rgid, addr_t offset, BYTE *data)
 {
-  struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
-
 //  struct vm_area_struct *cur_vma = get_vma_by_num(caller->krnl->mm, vmaid);
 
-  /* TODO Invalid memory identify */
-
+  /* Looked up under the lock, the table may grow meanwhile */
   pthread_mutex_lock(&mmvm_lock);
-  pg_getval(caller->mm, currg->rg_start + offset, data, caller);
+  struct symrg_struct *currg = get_symrg_byid(caller->mm, rgid);
+
+  if (currg == NULL) /* Invalid memory identify */
+  {
+    pthread_mutex_unlock(&mmvm_lock);
+    return -1;
+  }
+
+  if (pg_getval(caller->mm, currg->rg_start + offset, data, caller) != 0)
+  {
+    pthread_mutex_unlock(&mmvm_lock);
+    return -1;
+  }
   pthread_mutex_unlock(&mmvm_lock);
 
   return 0;
@@ -443,6 +807,31 @@ int libread(
   return val;
 }
 
+/*libexpect - PAGING-based check of a byte in a region memory
+ *@proc: process executing the instruction
+ *@source: index of source register
+ *@offset: source address = [source] + [offset]
+ *@value: byte the address must hold
+ *
+ * Prints a line only on a mismatch, a run with none kept every value.
+ */
+int libexpect(struct pcb_t *proc, uint32_t source, addr_t offset, BYTE value)
+{
+  BYTE data = 0;
+  int val = __read(proc, 0, source, offset, &data);
+
+  if (val == 0 && data == value)
+    return 0;
+
+  flockfile(stdout);
+  printf("libexpect: PID=%d region=%u offset=%lu read %u expected %u%s\n",
+         proc->pid, source, (unsigned long)offset, data, value,
+         val ? " (read failed)" : "");
+  funlockfile(stdout);
+
+  return -1;
+}
+
 /*__write - write a region memory
  *@caller: caller
  *@vmaid: ID vm area to alloc memory region
@@ -454,7 +843,7 @@ int libread(
 int __write(struct pcb_t *caller, int vmaid, int rgid, addr_t offset, BYTE value)
 {
   pthread_mutex_lock(&mmvm_lock);
-  struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
+  struct symrg_struct *currg = get_symrg_byid(caller->mm, rgid);
 
   struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
 
@@ -495,6 +884,29 @@ int libwrite(
   return val;
 }
 
+/*free_pcb_memph_page - return the MEMRAM or MEMSWP frame of one page */
+static int free_pcb_memph_page(addr_t pgn, pte_t pte, void *arg)
+{
+  struct pcb_t *caller = (struct pcb_t *)arg;
+
+  if (PAGING_PAGE_ONLINE(pte))
+  {
+    int swptyp;
+    addr_t swpfpn;
+
+    if (MEMPHY_swpcache_get(caller->krnl->mram, PAGING_FPN(pte), &swptyp, &swpfpn) == 0)
+      MEMPHY_put_freefp(caller->krnl->mswp[swptyp], swpfpn);
+    MEMPHY_rmap_clear(caller->krnl->mram, PAGING_FPN(pte));
+    MEMPHY_put_freefp(caller->krnl->mram, PAGING_FPN(pte));
+  }
+  else if ((pte & PAGING_PTE_SWAPPED_MASK) && PAGING_SWPTYP(pte) == PAGING_SWPTYP_ZSWAP)
+    zswap_drop(caller->krnl, PAGING_SWP(pte));
+  else if (pte & PAGING_PTE_SWAPPED_MASK)
+    MEMPHY_put_freefp(caller->krnl->mswp[PAGING_SWPTYP(pte)], PAGING_SWP(pte));
+
+  return 0;
+}
+
 /*free_pcb_memphy - collect all memphy of pcb
  *@caller: caller
  *@vmaid: ID vm area to alloc memory region
@@ -503,62 +915,169 @@ int libwrite(
 int free_pcb_memph(struct pcb_t *caller)
 {
   pthread_mutex_lock(&mmvm_lock);
-  addr_t fpn;
-  uint32_t pte;
-  struct mm_struct *mm = caller->mm;
-  struct pgn_t *pg = mm->fifo_pgn;
 
-  while (pg != NULL)
-  {
-    addr_t pgn = pg->pgn;
-    pte = pte_get_entry(caller, pgn);
+  /* Swapped pages too, the replacement state only knows resident ones */
+  pgtbl_for_each(caller->mm, free_pcb_memph_page, caller);
 
-    if (PAGING_PAGE_PRESENT(pte))
-    {
-      fpn = PAGING_FPN(pte);
-      MEMPHY_put_freefp(caller->krnl->mram, fpn);
-    }
-    else if (pte & PAGING_PTE_SWAPPED_MASK)
-    {
-      if (pte & PAGING_PTE_SWAPPED_MASK)
-      {
-        fpn = PAGING_SWP(pte);
-        MEMPHY_put_freefp(caller->krnl->active_mswp, fpn);
-      }
-    }
-    
-    pg = pg->pg_next;
-  }
+  /* A state shared in global scope is left under the lock */
+  pgrepl_release(caller->mm);
 
   pthread_mutex_unlock(&mmvm_lock);
   return 0;
 }
 
+/*__mmap - create an anonymous vm area
+ *@caller: caller
+ *@size: area size, rounded up to pages
+ *@vmaid: return the ID of the new vm area
+ *
+ * __alloc with @vmaid carves regions out of the area, its pages come
+ * zero-filled on first touch.
+ */
+int __mmap(struct pcb_t *caller, addr_t size, int *vmaid)
+{
+  struct vm_area_struct *vma;
+
+  pthread_mutex_lock(&mmvm_lock);
+  vma = vm_mmap(caller->mm, size);
+  pthread_mutex_unlock(&mmvm_lock);
 
-/*find_victim_page - find victim page
+  if (vma == NULL)
+    return -1;
+
+  *vmaid = vma->vm_id;
+  return 0;
+}
+
+/*munmap_page - release the frame of one page of an unmapped area */
+static int munmap_page(addr_t pgn, pte_t pte, void *arg)
+{
+  struct pcb_t *caller = (struct pcb_t *)arg;
+
+  if (PAGING_PAGE_ONLINE(pte))
+    pgrepl_remove(caller->mm, pgn);
+
+  return free_pcb_memph_page(pgn, pte, arg);
+}
+
+/*__munmap - remove a vm area created by __mmap
  *@caller: caller
- *@pgn: return page number
+ *@vmaid: ID of the vm area
  *
+ * The frames of the area go back to MEMRAM and MEMSWP, and the regions
+ * allocated in it are dropped from the symbol table.
  */
-int find_victim_page(struct mm_struct *mm, addr_t *retpgn)
+int __munmap(struct pcb_t *caller, int vmaid)
 {
-  struct pgn_t *pg = mm->fifo_pgn;
+  struct vm_area_struct *vma;
+  addr_t first, last, head, i;
+  int b;
+
+  pthread_mutex_lock(&mmvm_lock);
 
-  /* TODO: Implement the theorical mechanism to find the victim page */
-  if (!pg)
+  vma = get_vma_by_num(caller->mm, vmaid);
+  if (vmaid == 0 || vma == NULL)
   {
+    pthread_mutex_unlock(&mmvm_lock);
     return -1;
   }
-  struct pgn_t *prev = NULL;
-  while (pg->pg_next)
+
+  first = PAGING_PGN(vma->vm_start);
+  last = first + (vma->vm_end - vma->vm_start) / PAGING_PAGESZ - 1;
+
+  /* A huge page crossing either end is split, the part outside stays */
+  for (b = 0; b < 2; b++)
+  {
+    addr_t pgn = b ? last : first;
+
+    if (!(pte_get_entry(caller, pgn) & PAGING_PTE_HUGE_MASK))
+      continue;
+    head = pgn & ~(addr_t)(PAGING_HUGE_NRPG - 1);
+    if (head >= first && head + PAGING_HUGE_NRPG - 1 <= last)
+      continue;
+
+    if (pte_split_huge(caller, pgn) < 0)
+      continue;
+    pgrepl_remove(caller->mm, head);
+    for (i = head; i < head + PAGING_HUGE_NRPG; i++)
+      if (i < first || i > last)
+        pgrepl_insert(caller->mm, i);
+    caller->krnl->mmstat.thp_split++;
+  }
+
+  pte_range_for_each(caller, first, last - first + 1, munmap_page, caller);
+  pte_range_clear(caller, first, last - first + 1);
+
+  for (i = 0; i < (addr_t)caller->mm->symrg_sz; i++)
   {
-    prev = pg;
-    pg = pg->pg_next;
+    struct symrg_struct *rg = &caller->mm->symrgtbl[i];
+
+    if (rg->vmaid == vmaid && rg->rg_end > rg->rg_start)
+      symrg_put(caller->mm, i);
   }
-  *retpgn = pg->pgn;
-  prev->pg_next = NULL;
 
-  free(pg);
+  remove_vm_area(caller->mm, vmaid);
+
+  pthread_mutex_unlock(&mmvm_lock);
+  return 0;
+}
+
+/*libmmap - PAGING-based allocate a region memory in a new vm area
+ *@proc: Process executing the instruction
+ *@size: allocated size
+ *@reg_index: memory region ID (used to identify variable in symbole table)
+ */
+int libmmap(struct pcb_t *proc, addr_t size, uint32_t reg_index)
+{
+  addr_t addr;
+  int vmaid;
+
+  if (__mmap(proc, size, &vmaid) == -1)
+    return -1;
+
+  if (__alloc(proc, vmaid, reg_index, size, &addr) == -1)
+  {
+    __munmap(proc, vmaid);
+    return -1;
+  }
+  flockfile(stdout);
+  printf("libmmap: PID=%d region=%u vma=%d\n", proc->pid, reg_index, vmaid);
+#ifdef IODUMP
+#ifdef PAGETBL_DUMP
+  print_pgtbl(proc, 0, -1); // print max TBL
+#endif
+#endif
+  funlockfile(stdout);
+
+  return 0;
+}
+
+/*libmunmap - PAGING-based remove the vm area of a region memory
+ *@proc: Process executing the instruction
+ *@reg_index: memory region ID of a region allocated by libmmap
+ */
+int libmunmap(struct pcb_t *proc, uint32_t reg_index)
+{
+  struct symrg_struct *rg;
+  int vmaid;
+
+  pthread_mutex_lock(&mmvm_lock);
+  rg = get_symrg_byid(proc->mm, reg_index);
+  vmaid = (rg != NULL && rg->rg_end > rg->rg_start) ? rg->vmaid : 0;
+  pthread_mutex_unlock(&mmvm_lock);
+
+  /* The heap is never unmapped */
+  if (vmaid == 0 || __munmap(proc, vmaid) == -1)
+    return -1;
+
+  flockfile(stdout);
+  printf("libmunmap: PID=%d region=%u vma=%d\n", proc->pid, reg_index, vmaid);
+#ifdef IODUMP
+#ifdef PAGETBL_DUMP
+  print_pgtbl(proc, 0, -1); // print max TBL
+#endif
+#endif
+  funlockfile(stdout);
 
   return 0;
 }
@@ -589,60 +1108,11 @@ int get_free_vmrg_area(struct pcb_t *caller, int vmaid, int size, struct vm_rg_s
     return -1;
   }
 
-  struct vm_rg_struct *rgit = cur_vma->vm_freerg_list;
-
-  if (rgit == NULL)
+  if (size <= 0)
     return -1;
 
-  /* Probe unintialized newrg */
-  newrg->rg_start = newrg->rg_end = -1;
-
-  /* Traverse on list of free vm region to find a fit space */
-  while (rgit != NULL)
-  {
-    if (rgit->rg_start + size <= rgit->rg_end)
-    { /* Current region has enough space */
-      newrg->rg_start = rgit->rg_start;
-      newrg->rg_end = rgit->rg_start + size;
-
-      /* Update left space in chosen region */
-      if (rgit->rg_start + size < rgit->rg_end)
-      {
-        rgit->rg_start = rgit->rg_start + size;
-      }
-      else
-      { /*Use up all space, remove current node */
-        /*Clone next rg node */
-        struct vm_rg_struct *nextrg = rgit->rg_next;
-
-        /*Cloning */
-        if (nextrg != NULL)
-        {
-          rgit->rg_start = nextrg->rg_start;
-          rgit->rg_end = nextrg->rg_end;
-
-          rgit->rg_next = nextrg->rg_next;
-
-          free(nextrg);
-        }
-        else
-        {                                /*End of free list */
-          rgit->rg_start = rgit->rg_end; // dummy, size 0 region
-          rgit->rg_next = NULL;
-        }
-      }
-      break;
-    }
-    else
-    {
-      rgit = rgit->rg_next; // Traverse next rg
-    }
-  }
-
-  if (newrg->rg_start == -1) // new region not found
-    return -1;
-
-  return 0;
+  /* Best fit among the free regions of the area */
+  return vm_freerg_take(cur_vma, size, newrg);
 }
 
 // #endif
@@ -12,6 +12,9 @@ static uint32_t avail_pid = 1;
 #define OPT_READ	"read"
 #define OPT_WRITE	"write"
 #define OPT_SYSCALL	"syscall"
+#define OPT_EXPECT	"expect"
+#define OPT_MMAP	"mmap"
+#define OPT_MUNMAP	"munmap"
 
 static enum ins_opcode_t get_opcode(char * opt) {
 	if (!strcmp(opt, OPT_CALC)) {
@@ -26,6 +29,12 @@ static enum ins_opcode_t get_opcode(char * opt) {
 		return WRITE;
 	}else if (!strcmp(opt, OPT_SYSCALL)) {
 		return SYSCALL;
+	}else if (!strcmp(opt, OPT_EXPECT)) {
+		return EXPECT;
+	}else if (!strcmp(opt, OPT_MMAP)) {
+		return MMAP;
+	}else if (!strcmp(opt, OPT_MUNMAP)) {
+		return MUNMAP;
 	}else{
 		printf("get_opcode return Opcode: %s\n", opt);
 		exit(1);
@@ -41,6 +50,10 @@ struct pcb_t * load(const char * path) {
 		(struct page_table_t*)malloc(sizeof(struct page_table_t));
 	proc->bp = PAGE_SIZE;
 	proc->pc = 0;
+#ifdef MM_PAGING
+	proc->io_ns = 0;
+	proc->io_stall = 0;
+#endif
 
 	/* Read process code from file */
 	FILE * file;
@@ -64,6 +77,7 @@ struct pcb_t * load(const char * path) {
 		case CALC:
 			break;
 		case ALLOC:
+		case MMAP:
 			fscanf(
 				file,
 				"" FORMAT_ARG " " FORMAT_ARG "\n",
@@ -72,10 +86,12 @@ struct pcb_t * load(const char * path) {
 			);
 			break;
 		case FREE:
+		case MUNMAP:
 			fscanf(file, "" FORMAT_ARG "\n", &proc->code->text[i].arg_0);
 			break;
 		case READ:
 		case WRITE:
+		case EXPECT:
 			fscanf(
 				file,
 				"" FORMAT_ARG " " FORMAT_ARG " " FORMAT_ARG "\n",
@@ -0,0 +1,808 @@
+/*
+ * Copyright (C) 2026 pdnguyen of HCMC University of Technology VNU-HCM
+ */
+
+/* LamiaAtrium release
+ * Source Code License Grant: The authors hereby grant to Licensee
+ * personal permission to use and modify the Licensed Source Code
+ * for the sole purpose of studying while attending the course CO2018.
+ */
+
+/*
+ * PAGING based Memory Management
+ * Microbenchmarks mm/mm-bench.c
+ *
+ * Usage: ./bench [case ...], every case runs when none is given.
+ *
+ * The cases time the code of this tree only; an older version is
+ * measured by building the bench of its commit.
+ */
+
+#include "mm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+struct bench_case {
+  const char *name;
+  void (*run)(void);
+};
+
+static double bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Nanoseconds per operation of @nops operations started at @t0 */
+static double bench_ns(double t0, long nops)
+{
+  return (bench_now() - t0) / nops * 1e9;
+}
+
+/* A process with a kernel of its own, enough for the MM calls; the
+ * case creates and destroys the address space with init_mm/free_mm */
+struct bench_env {
+  struct krnl_t krnl;
+  struct pcb_t proc;
+  struct mm_struct mm;
+};
+
+static void bench_env_init(struct bench_env *env, int pwc, int pgtbl)
+{
+  memset(env, 0, sizeof(*env));
+  env->krnl.mmparam.pwc = pwc;
+  env->krnl.mmparam.pgtbl = pgtbl;
+  env->proc.krnl = &env->krnl;
+  env->proc.mm = &env->mm;
+}
+
+/*
+ * bench_pagecopy - MEMRAM <-> MEMSWP page copy throughput
+ */
+static void bench_pagecopy(void)
+{
+  struct memphy_struct mram, mswp;
+  int ramfp, swpfp, npages = 200000;
+  double t0;
+  int i;
+
+  init_memphy(&mram, 1 << 20, 1);
+  init_memphy(&mswp, 1 << 24, 1);
+  ramfp = mram.maxsz / PAGING_PAGESZ;
+  swpfp = mswp.maxsz / PAGING_PAGESZ;
+
+  t0 = bench_now();
+  for (i = 0; i < npages; i++)
+    MEMPHY_copy_page(&mram, i % ramfp, &mswp, (i * 7) % swpfp);
+
+  printf("pagecopy: %d pages of %d bytes, %12.0f pages/sec\n", npages,
+         (int)PAGING_PAGESZ, 1e9 / bench_ns(t0, npages));
+
+  MEMPHY_cleanup(&mram);
+  MEMPHY_cleanup(&mswp);
+}
+
+/* Region alloc/free churn on one vm area, through the free region
+ * calls of __alloc/__free: a live slot is freed, an empty slot takes a
+ * free region or grows the area like inc_vma_limit */
+#define BENCH_RG_NSLOT 1024
+
+struct bench_rgchurn {
+  struct vm_area_struct *vma;
+  struct vm_rg_struct live[BENCH_RG_NSLOT];
+  int nslot;
+  addr_t maxsz;        /* region sizes from 16 to 15 + maxsz */
+  addr_t sbrk;
+  unsigned int seed;
+  int timed;           /* time every alloc and free */
+  int nalloc, nrel;
+  double talloc, tfree;
+};
+
+static void bench_rgchurn_init(struct bench_rgchurn *rc, int nslot, addr_t maxsz,
+                               unsigned int seed, int timed)
+{
+  memset(rc, 0, sizeof(*rc));
+  rc->vma = create_vm_area(0, 0, 0);
+  rc->nslot = nslot;
+  rc->maxsz = maxsz;
+  rc->seed = seed;
+  rc->timed = timed;
+}
+
+static void bench_rgchurn_run(struct bench_rgchurn *rc, int nops)
+{
+  double t0 = 0;
+  int i;
+
+  for (i = 0; i < nops; i++)
+  {
+    struct vm_rg_struct *live = &rc->live[rand_r(&rc->seed) % rc->nslot];
+
+    if (live->rg_end > live->rg_start)
+    {
+      struct vm_rg_struct *rg = kmem_cache_alloc(KMEM_VM_RG);
+
+      rg->rg_start = live->rg_start;
+      rg->rg_end = live->rg_end;
+      if (rc->timed)
+        t0 = bench_now();
+      if (vm_freerg_insert(rc->vma, rg) < 0)
+        kmem_cache_free(KMEM_VM_RG, rg);
+      if (rc->timed)
+        rc->tfree += bench_now() - t0;
+      rc->nrel++;
+      live->rg_start = live->rg_end = 0;
+    }
+    else
+    {
+      addr_t size = 16 + rand_r(&rc->seed) % rc->maxsz;
+
+      if (rc->timed)
+        t0 = bench_now();
+      if (vm_freerg_take(rc->vma, size, live) < 0)
+      {
+        live->rg_start = rc->sbrk;
+        live->rg_end = rc->sbrk + size;
+        rc->sbrk += size;
+        rc->vma->vm_end = rc->sbrk;
+      }
+      if (rc->timed)
+        rc->talloc += bench_now() - t0;
+      rc->nalloc++;
+    }
+  }
+}
+
+static void bench_rgchurn_free(struct bench_rgchurn *rc)
+{
+  struct vm_rg_struct *rg;
+
+  while ((rg = rc->vma->vm_freerg_list) != NULL)
+  {
+    rc->vma->vm_freerg_list = rg->rg_next;
+    kmem_cache_free(KMEM_VM_RG, rg);
+  }
+  free(rc->vma);
+}
+
+/*
+ * bench_freerg - VM heap free regions, alloc/free churn on one vm area:
+ * fragmentation and latency
+ */
+static void bench_freerg(void)
+{
+  static struct bench_rgchurn rc;
+  struct vm_rg_struct *rg;
+  addr_t freesz = 0, maxfree = 0;
+  int nfree = 0;
+
+  bench_rgchurn_init(&rc, BENCH_RG_NSLOT, 2048, 26, 1);
+  bench_rgchurn_run(&rc, 200000);
+
+  for (rg = rc.vma->vm_freerg_list; rg != NULL; rg = rg->rg_next)
+  {
+    addr_t sz = rg->rg_end - rg->rg_start;
+
+    nfree++;
+    freesz += sz;
+    if (sz > maxfree)
+      maxfree = sz;
+  }
+
+  printf("freerg: alloc/free churn, fragmentation = 1 - largest free / total free\n");
+  printf("  heap %8lu B, %5d free regions, %8lu B free, "
+         "fragmentation %5.1f%%, %6.0f ns/alloc, %6.0f ns/free\n",
+         (unsigned long)rc.sbrk, nfree, (unsigned long)freesz,
+         freesz ? 100.0 * (1.0 - (double)maxfree / freesz) : 0.0,
+         rc.talloc / rc.nalloc * 1e9, rc.tfree / rc.nrel * 1e9);
+
+  bench_rgchurn_free(&rc);
+}
+
+/*
+ * bench_memphy - device format time and frame get/put/lookup cost
+ */
+static void bench_memphy(void)
+{
+  addr_t sizes[] = { 1 << 24, 1 << 28, 1 << 30 };
+  int nops = 1000000, n, i;
+
+  printf("memphy: format time by device size, then frame ops\n");
+  for (n = 0; n < 3; n++)
+  {
+    struct memphy_struct mp;
+    int numfp = sizes[n] / PAGING_PAGESZ;
+    double t0 = bench_now();
+
+    init_memphy(&mp, sizes[n], 1);
+    printf("  %5lu MiB %8d frames  format %8.3f ms\n",
+           (unsigned long)(sizes[n] >> 20), numfp, (bench_now() - t0) * 1e3);
+
+    if (n == 2)
+    {
+      addr_t fpn[64];
+      unsigned int seed = 36;
+      int hit = 0;
+
+      t0 = bench_now();
+      for (i = 0; i < nops; i++)
+      {
+        int k = i % 64;
+        if (i >= 64)
+          MEMPHY_put_freefp(&mp, fpn[k]);
+        MEMPHY_get_freefp(&mp, &fpn[k]);
+      }
+      printf("  get+put    %6.1f ns/op\n", bench_ns(t0, nops));
+
+      t0 = bench_now();
+      for (i = 0; i < nops; i++)
+        hit += MEMPHY_is_frame_free(&mp, rand_r(&seed) % numfp);
+      printf("  is_free    %6.1f ns/op (%d free)\n", bench_ns(t0, nops), hit);
+    }
+    MEMPHY_cleanup(&mp);
+  }
+}
+
+/*
+ * bench_buddy - order 0..4 block churn on the buddy allocator
+ */
+static void bench_buddy(void)
+{
+  enum { NLIVE = 4096, NOPS = 1000000 };
+  static addr_t live[NLIVE];
+  static int live_order[NLIVE];
+  struct memphy_struct mp;
+  unsigned int seed = 37;
+  int i, slot, nalloc = 0, nfail = 0;
+  double t0, talloc = 0;
+
+  init_memphy(&mp, 1 << 24, 1);
+  for (i = 0; i < NLIVE; i++)
+    live_order[i] = -1;
+
+  for (i = 0; i < NOPS; i++)
+  {
+    slot = rand_r(&seed) % NLIVE;
+    if (live_order[slot] >= 0)
+    {
+      if (live_order[slot] == 0)
+        MEMPHY_put_freefp(&mp, live[slot]);
+      else
+        MEMPHY_free_order(&mp, live[slot], live_order[slot]);
+      live_order[slot] = -1;
+      continue;
+    }
+
+    int order = rand_r(&seed) % 5;
+    t0 = bench_now();
+    if (MEMPHY_alloc_order(&mp, order, &live[slot]) == 0)
+      live_order[slot] = order;
+    else
+      nfail++;
+    talloc += bench_now() - t0;
+    nalloc++;
+  }
+
+  printf("buddy: order 0-4 churn on %d frames, %.0f ns/alloc, %d failed, %s\n",
+         (int)(mp.maxsz / PAGING_PAGESZ), talloc / nalloc * 1e9, nfail,
+         MEMPHY_validate(&mp) == 0 ? "consistent" : "INCONSISTENT");
+  MEMPHY_buddy_report(&mp, " ");
+  MEMPHY_cleanup(&mp);
+}
+
+/* Region node churn: a live node per slot is replaced, and a short
+ * lived one comes and goes as a coalesced free region does */
+struct bench_slab_arg {
+  int use_cache;
+  int nops;
+  double elapsed;
+};
+
+static void *bench_slab_churn(void *data)
+{
+  enum { NLIVE = 256 };
+  struct bench_slab_arg *arg = data;
+  void *live[NLIVE];
+  unsigned int seed = 35;
+  double t0;
+  int i, slot;
+
+  memset(live, 0, sizeof(live));
+  t0 = bench_now();
+  for (i = 0; i < arg->nops; i++)
+  {
+    void *rg;
+
+    slot = rand_r(&seed) % NLIVE;
+    if (arg->use_cache)
+    {
+      kmem_cache_free(KMEM_VM_RG, live[slot]);
+      live[slot] = kmem_cache_alloc(KMEM_VM_RG);
+      rg = kmem_cache_alloc(KMEM_VM_RG);
+      kmem_cache_free(KMEM_VM_RG, rg);
+    }
+    else
+    {
+      free(live[slot]);
+      live[slot] = malloc(sizeof(struct vm_rg_struct));
+      rg = malloc(sizeof(struct vm_rg_struct));
+      free(rg);
+    }
+  }
+  for (slot = 0; slot < NLIVE; slot++)
+  {
+    if (arg->use_cache)
+      kmem_cache_free(KMEM_VM_RG, live[slot]);
+    else
+      free(live[slot]);
+  }
+  arg->elapsed = bench_now() - t0;
+
+  return NULL;
+}
+
+/* The region path of __alloc/__free on a vm area of the thread: every
+ * free hands a node to the free region trees, which merge it away or
+ * give it back when it is taken again */
+static void *bench_slab_region(void *data)
+{
+  struct bench_slab_arg *arg = data;
+  struct bench_rgchurn *rc = malloc(sizeof(*rc));
+  double t0;
+
+  bench_rgchurn_init(rc, 256, 256, 35, 0);
+  t0 = bench_now();
+  bench_rgchurn_run(rc, arg->nops);
+  arg->elapsed = bench_now() - t0;
+  bench_rgchurn_free(rc);
+  free(rc);
+
+  return NULL;
+}
+
+static double bench_slab_run(void *(*fn)(void *), int use_cache, int nthread, int nops)
+{
+  struct bench_slab_arg arg[8];
+  pthread_t tid[8];
+  double t0 = bench_now();
+  int i;
+
+  for (i = 0; i < nthread; i++)
+  {
+    arg[i].use_cache = use_cache;
+    arg[i].nops = nops;
+    pthread_create(&tid[i], NULL, fn, &arg[i]);
+  }
+  for (i = 0; i < nthread; i++)
+    pthread_join(tid[i], NULL);
+
+  return bench_now() - t0;
+}
+
+/*
+ * bench_slab_fault - fault @npg fresh pages of a new address space in
+ * through pg_getpage, return the nanoseconds per fault
+ */
+static double bench_slab_fault(int npg, int reps)
+{
+  static struct bench_env env;
+  static struct memphy_struct mram;
+  addr_t pgn, fpn;
+  double t0, tfault = 0;
+  int r;
+
+  bench_env_init(&env, 1, PGTBL_RADIX);
+  init_memphy(&mram, PAGING_MEMRAMSZ, 1);
+  env.krnl.mram = &mram;
+
+  for (r = 0; r < reps; r++)
+  {
+    init_mm(&env.mm, &env.proc);
+
+    t0 = bench_now();
+    for (pgn = 0; pgn < (addr_t)npg; pgn++)
+      pg_getpage(&env.mm, pgn, &fpn, &env.proc);
+    tfault += bench_now() - t0;
+
+    free_pcb_memph(&env.proc);
+    free_mm(&env.mm);
+  }
+  MEMPHY_cleanup(&mram);
+
+  return tfault / npg / reps * 1e9;
+}
+
+/*
+ * bench_slab - region node allocation, malloc/free vs the object cache,
+ * then the region alloc/free path that uses it and the page fault path
+ */
+static void bench_slab(void)
+{
+  int nops = 2000000, nthread;
+  int nfault = PAGING_MEMRAMSZ / PAGING_PAGESZ / 2;
+
+  printf("slab: region node churn and region alloc/free path, %d ops per CPU thread\n", nops);
+  for (nthread = 1; nthread <= 4; nthread *= 2)
+  {
+    double tmalloc = bench_slab_run(bench_slab_churn, 0, nthread, nops);
+    double tcache = bench_slab_run(bench_slab_churn, 1, nthread, nops);
+    double tpath = bench_slab_run(bench_slab_region, 1, nthread, nops);
+
+    printf("  %d cpu  malloc %6.1f ns/op, cache %6.1f ns/op (x%.1f), region path %6.1f ns/op\n",
+           nthread, tmalloc / nops / nthread * 1e9, tcache / nops / nthread * 1e9,
+           tmalloc / tcache, tpath / nops / nthread * 1e9);
+  }
+  printf("  fault    %d fresh pages through pg_getpage, %6.1f ns/fault\n",
+         nfault, bench_slab_fault(nfault, 100));
+  kmem_cache_report();
+}
+
+/*
+ * bench_vmap - heap grow mapping through the PTE range operations
+ *
+ * inc_vma_limit on a fresh address space with MEMRAM to spare, so the
+ * grow maps its pages through vm_map_ram, then free_pcb_memph gives the
+ * frames back. In 32-bit mode MEMRAM holds 2 MiB, the larger grows are
+ * skipped. Build with "make bench64" to see the 5-level walks.
+ */
+static void bench_vmap(void)
+{
+  static struct bench_env env;
+  static struct memphy_struct mram;
+  addr_t sizes[] = { 1 << 20, 1 << 22, 1 << 26 };
+#ifdef MM64
+  addr_t ramsz = sizes[2];
+#else
+  addr_t ramsz = PAGING_MEMRAMSZ;
+#endif
+  int n;
+
+  bench_env_init(&env, 1, PGTBL_RADIX);
+  init_memphy(&mram, ramsz, 1);
+  env.krnl.mram = &mram;
+
+  printf("vmap: grow the heap then release it, MiB of address space per second\n");
+  for (n = 0; n < 3; n++)
+  {
+    int npg = sizes[n] / PAGING_PAGESZ, reps = 1 + (1 << 22) / npg, r, lazy = 0;
+    double t0, tgrow = 0, tfree = 0;
+
+    if (sizes[n] > ramsz)
+      continue;
+    for (r = 0; r < reps; r++)
+    {
+      init_mm(&env.mm, &env.proc);
+
+      t0 = bench_now();
+      inc_vma_limit(&env.proc, 0, sizes[n]);
+      tgrow += bench_now() - t0;
+      if (!PAGING_PAGE_ONLINE(pte_get_entry(&env.proc, npg - 1)))
+        lazy++;
+
+      t0 = bench_now();
+      free_pcb_memph(&env.proc);
+      tfree += bench_now() - t0;
+
+      free_mm(&env.mm);
+    }
+
+    printf("  %4lu MiB  grow %8.0f  release %8.0f%s\n", (unsigned long)(sizes[n] >> 20),
+           reps * (sizes[n] >> 20) / tgrow, reps * (sizes[n] >> 20) / tfree,
+           lazy ? "  (not mapped, MEMRAM short)" : "");
+  }
+  MEMPHY_cleanup(&mram);
+}
+
+#ifdef MM64
+/* Page numbers of @n clusters of @len pages scattered over the 57-bit
+ * space */
+static void bench_clusters(addr_t *base, int n, int len, unsigned int seed)
+{
+  int c;
+
+  for (c = 0; c < n; c++)
+    base[c] = ((((addr_t)rand_r(&seed) << 24) ^ rand_r(&seed)) & (BIT_ULL(45) - 1)) &
+              ~(addr_t)(len - 1);
+}
+#endif
+
+/*
+ * bench_pwc - translations on a sparse address space, with and without
+ * the page-walk cache (64-bit mode only)
+ */
+static void bench_pwc(void)
+{
+#ifdef MM64
+  enum { NCLUSTER = 64, CLUSTER_PG = 64, NOPS = 2000000 };
+  static struct bench_env env;
+  addr_t base[NCLUSTER];
+  int on, c, i;
+
+  bench_env_init(&env, 0, PGTBL_RADIX);
+  init_mm(&env.mm, &env.proc);
+
+  bench_clusters(base, NCLUSTER, CLUSTER_PG, 44);
+  for (c = 0; c < NCLUSTER; c++)
+    for (i = 0; i < CLUSTER_PG; i++)
+      pte_set_fpn(&env.proc, base[c] + i, c * CLUSTER_PG + i + 1);
+
+  printf("pwc: %d random translations over %d clusters of %d pages\n",
+         NOPS, NCLUSTER, CLUSTER_PG);
+  for (on = 0; on <= 1; on++)
+  {
+    double t0;
+    addr_t sum = 0;
+    unsigned int pick = 45;
+
+    env.mm.pwc_on = on;
+    memset(env.mm.pwc, 0, sizeof(env.mm.pwc));
+    t0 = bench_now();
+    for (i = 0; i < NOPS; i++)
+    {
+      /* Stay in a cluster for a while, like a process touching its heap */
+      c = (i / 256 * 7) % NCLUSTER;
+      sum += PAGING_FPN(pte_get_entry(&env.proc, base[c] + rand_r(&pick) % CLUSTER_PG));
+    }
+    printf("  cache %-3s %6.1f ns/translation (checksum %lu)\n", on ? "on" : "off",
+           bench_ns(t0, NOPS), (unsigned long)sum);
+  }
+  pgtbl_report();
+  free_mm(&env.mm);
+#else
+  printf("pwc: 64-bit mode only, build with make bench64\n");
+#endif
+}
+
+/*
+ * bench_pgtbl - lookup latency and metadata of the radix tree (with its
+ * page-walk cache) against the hashed page table (64-bit mode only)
+ *
+ * The same pages are mapped in both: clusters scattered over the 57-bit
+ * space, then one dense run.
+ */
+static void bench_pgtbl(void)
+{
+#ifdef MM64
+  enum { NCLUSTER = 256, CLUSTER_PG = 16, DENSE_PG = 1 << 16, NOPS = 2000000 };
+  static struct bench_env env;
+  static addr_t base[NCLUSTER];
+  const char *shape[] = { "sparse", "dense" };
+  int sp, t, c, i;
+
+  printf("pgtbl: %d random translations, %d clusters of %d pages or %d dense pages\n",
+         NOPS, NCLUSTER, CLUSTER_PG, DENSE_PG);
+  bench_clusters(base, NCLUSTER, CLUSTER_PG, 48);
+  for (sp = 0; sp < 2; sp++)
+  {
+    for (t = PGTBL_RADIX; t <= PGTBL_HASH; t++)
+    {
+      unsigned int pick = 49;
+      addr_t sum = 0;
+      double t0;
+
+      bench_env_init(&env, 1, t);
+      init_mm(&env.mm, &env.proc);
+
+      if (sp == 0)
+        for (c = 0; c < NCLUSTER; c++)
+          for (i = 0; i < CLUSTER_PG; i++)
+            pte_set_fpn(&env.proc, base[c] + i, c * CLUSTER_PG + i + 1);
+      else
+        for (i = 0; i < DENSE_PG; i++)
+          pte_set_fpn(&env.proc, i, i + 1);
+
+      t0 = bench_now();
+      for (i = 0; i < NOPS; i++)
+      {
+        addr_t pgn = (sp == 0) ?
+                     base[rand_r(&pick) % NCLUSTER] + rand_r(&pick) % CLUSTER_PG :
+                     (addr_t)(rand_r(&pick) % DENSE_PG);
+        sum += PAGING_FPN(pte_get_entry(&env.proc, pgn));
+      }
+      printf("  %-6s %-5s %6.1f ns/translation, %8lu metadata bytes (checksum %lu)\n",
+             shape[sp], t == PGTBL_HASH ? "hash" : "radix", bench_ns(t0, NOPS),
+             pgtbl_bytes(&env.mm), (unsigned long)sum);
+      free_mm(&env.mm);
+    }
+  }
+#else
+  printf("pgtbl: 64-bit mode only, build with make bench64\n");
+#endif
+}
+
+/*
+ * bench_mmcreate - create, lightly touch and destroy process address
+ * spaces, the loader and exit cost of the page table
+ */
+static void bench_mmcreate(void)
+{
+  enum { NPROC = 20000, NTOUCH = 8 };
+  static struct bench_env env;
+  unsigned long bytes = 0;
+  double t0;
+  int n, i;
+
+  bench_env_init(&env, 1, PGTBL_RADIX);
+
+  t0 = bench_now();
+  for (n = 0; n < NPROC; n++)
+  {
+    init_mm(&env.mm, &env.proc);
+    for (i = 0; i < NTOUCH; i++)
+      pte_set_fpn(&env.proc, i * 3, i + 1);
+    bytes = pgtbl_bytes(&env.mm);
+    free_mm(&env.mm);
+  }
+  printf("mmcreate: %d address spaces, %d pages touched in each, "
+         "%8.0f ns/process, %6lu page-table bytes\n",
+         NPROC, NTOUCH, bench_ns(t0, NPROC), bytes);
+}
+
+/*
+ * bench_vma - thousands of mmap areas in one address space: area lookup
+ * by address and by ID through the VMA trees, then unmap/map churn
+ */
+static void bench_vma(void)
+{
+  enum { MAXAREA = 8000, NOPS = 1000000, NCHURN = 200000 };
+  static const int nareas[] = { 1000, MAXAREA };
+  static struct bench_env env;
+  static int ids[MAXAREA];
+  static addr_t starts[MAXAREA];
+  unsigned int seed = 49;
+  unsigned long sum = 0;
+  double t0, tcreate, taddr, tid;
+  int k, n, i;
+
+  bench_env_init(&env, 0, PGTBL_RADIX);
+
+  printf("vma: areas of 1-2 pages, %d lookups, %d unmap+map\n", NOPS, NCHURN);
+  for (k = 0; k < (int)(sizeof(nareas) / sizeof(nareas[0])); k++)
+  {
+    n = nareas[k];
+    init_mm(&env.mm, &env.proc);
+
+    t0 = bench_now();
+    for (i = 0; i < n; i++)
+    {
+      struct vm_area_struct *vma = vm_mmap(&env.mm, PAGING_PAGESZ * (1 + i % 2));
+
+      ids[i] = vma->vm_id;
+      starts[i] = vma->vm_start;
+    }
+    tcreate = bench_ns(t0, n);
+
+    t0 = bench_now();
+    for (i = 0; i < NOPS; i++)
+      sum += find_vma(&env.mm, starts[rand_r(&seed) % n] + 1)->vm_id;
+    taddr = bench_ns(t0, NOPS);
+
+    t0 = bench_now();
+    for (i = 0; i < NOPS; i++)
+      sum += get_vma_by_num(&env.mm, ids[rand_r(&seed) % n])->vm_end;
+    tid = bench_ns(t0, NOPS);
+
+    t0 = bench_now();
+    for (i = 0; i < NCHURN; i++)
+    {
+      int r = rand_r(&seed) % n;
+      addr_t len = PAGING_PAGESZ * (1 + r % 2);
+      struct vm_area_struct *vma;
+
+      remove_vm_area(&env.mm, ids[r]);
+      vma = vm_mmap(&env.mm, len);
+      ids[r] = vma->vm_id;
+      starts[r] = vma->vm_start;
+    }
+
+    printf("  %5d areas: create %5.0f ns, by address %5.1f ns, by ID %5.1f ns, "
+           "unmap+map %5.0f ns\n", n, tcreate, taddr, tid, bench_ns(t0, NCHURN));
+    free_mm(&env.mm);
+  }
+  printf("  (checksum %lu)\n", sum);
+}
+
+/*
+ * bench_symrg - region handle table holding tens of thousands of live
+ * regions: taking IDs as the table grows, lookup, and release with reuse
+ */
+static void bench_symrg(void)
+{
+  enum { NLIVE = 50000, NOPS = 1000000 };
+  static struct bench_env env;
+  unsigned int seed = 50;
+  unsigned long sum = 0;
+  double t0, tget, tlookup;
+  int i;
+
+  bench_env_init(&env, 0, PGTBL_RADIX);
+  init_mm(&env.mm, &env.proc);
+
+  printf("symrg: %d live regions, %d lookups and release+reuse\n", NLIVE, NOPS);
+
+  t0 = bench_now();
+  for (i = 0; i < NLIVE; i++)
+  {
+    struct symrg_struct *rg = symrg_get(&env.mm, i);
+
+    rg->rg_start = (addr_t)(i + 1) * 16;
+    rg->rg_end = rg->rg_start + 16;
+  }
+  tget = bench_ns(t0, NLIVE);
+
+  t0 = bench_now();
+  for (i = 0; i < NOPS; i++)
+    sum += get_symrg_byid(&env.mm, rand_r(&seed) % NLIVE)->rg_start;
+  tlookup = bench_ns(t0, NOPS);
+
+  t0 = bench_now();
+  for (i = 0; i < NOPS; i++)
+  {
+    int rgid = rand_r(&seed) % NLIVE;
+    struct symrg_struct *rg = get_symrg_byid(&env.mm, rgid);
+    addr_t start = rg->rg_start;
+
+    symrg_put(&env.mm, rgid);
+    rg = symrg_get(&env.mm, rgid);
+    rg->rg_start = start;
+    rg->rg_end = start + 16;
+  }
+
+  printf("  get ID %5.1f ns, lookup %5.1f ns, release+reuse %5.1f ns\n",
+         tget, tlookup, bench_ns(t0, NOPS));
+  printf("  %d IDs in the table, %lu bytes (checksum %lu)\n", env.mm.symrg_sz,
+         (unsigned long)env.mm.symrg_sz * sizeof(struct symrg_struct), sum);
+  free_mm(&env.mm);
+}
+
+static struct bench_case bench_cases[] = {
+  { "pagecopy", bench_pagecopy },
+  { "freerg", bench_freerg },
+  { "slab", bench_slab },
+  { "memphy", bench_memphy },
+  { "buddy", bench_buddy },
+  { "vmap", bench_vmap },
+  { "pwc", bench_pwc },
+  { "mmcreate", bench_mmcreate },
+  { "pgtbl", bench_pgtbl },
+  { "vma", bench_vma },
+  { "symrg", bench_symrg },
+};
+
+int main(int argc, char *argv[])
+{
+  int ncase = sizeof(bench_cases) / sizeof(bench_cases[0]);
+  int i, j, found;
+
+  for (j = 1; j < argc; j++)
+  {
+    for (i = 0, found = 0; i < ncase; i++)
+      if (!strcmp(argv[j], bench_cases[i].name))
+        found = 1;
+    if (!found)
+    {
+      printf("Unknown benchmark '%s'\n", argv[j]);
+      return 1;
+    }
+  }
+
+  for (i = 0; i < ncase; i++)
+  {
+    if (argc > 1)
+    {
+      for (j = 1; j < argc && strcmp(argv[j], bench_cases[i].name); j++)
+        ;
+      if (j == argc)
+        continue;
+    }
+    bench_cases[i].run();
+  }
+
+  return 0;
+}
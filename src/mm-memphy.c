@@ -14,28 +14,150 @@
  * Memory physical module mm/mm-memphy.c
  */
 
+#define _GNU_SOURCE /* O_DIRECT */
 #include "mm.h"
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Freed single frames kept hot on the free stack before merging */
+#define MEMPHY_FREE_STK_HIGH 64
+
+/* Offset, length and buffer alignment O_DIRECT asks for */
+#define MEMPHY_DIO_ALIGN 512
+
+/* Storage is materialized in chunks holding whole pages */
+#define MEMPHY_CHUNK_SHIFT 16
+#define MEMPHY_CHUNK_SZ ((uint64_t)1 << MEMPHY_CHUNK_SHIFT)
 
 /*
- *  MEMPHY_mv_csr - move MEMPHY cursor
+ *  MEMPHY_cell - locate a byte of the device storage
  *  @mp: memphy struct
- *  @offset: offset
+ *  @addr: byte address
+ *  @alloc: materialize its chunk if it was never written
+ *
+ *  Return NULL for a byte of an untouched chunk when !alloc, it reads 0
  */
-int MEMPHY_mv_csr(struct memphy_struct *mp, addr_t offset)
+static BYTE *MEMPHY_cell(struct memphy_struct *mp, uint64_t addr, int alloc)
 {
-   int numstep = 0;
+   if (mp->map != NULL)
+      return mp->map + addr;
+
+   BYTE **chunk = &mp->chunk[addr >> MEMPHY_CHUNK_SHIFT];
 
-   mp->cursor = 0;
-   while (numstep < offset && numstep < mp->maxsz)
+   if (*chunk == NULL)
    {
-      /* Traverse sequentially */
-      mp->cursor = (mp->cursor + 1) % mp->maxsz;
-      numstep++;
+      if (!alloc || (*chunk = calloc(1, MEMPHY_CHUNK_SZ)) == NULL)
+         return NULL;
+      mp->nchunk_live++;
    }
 
+   return *chunk + (addr & (MEMPHY_CHUNK_SZ - 1));
+}
+
+/* A file device without a mapping streams pages through the bounce buffer */
+#define MEMPHY_STREAMED(mp) ((mp)->fd >= 0 && (mp)->map == NULL)
+
+static int MEMPHY_stream_in(struct memphy_struct *mp, addr_t fpn)
+{
+   off_t off = (off_t)fpn * PAGING_PAGESZ;
+
+   if (pread(mp->fd, mp->bounce, PAGING_PAGESZ, off) != PAGING_PAGESZ)
+      return -1;
+
+   return 0;
+}
+
+static int MEMPHY_stream_out(struct memphy_struct *mp, addr_t fpn)
+{
+   off_t off = (off_t)fpn * PAGING_PAGESZ;
+
+   if (pwrite(mp->fd, mp->bounce, PAGING_PAGESZ, off) != PAGING_PAGESZ)
+      return -1;
+
+   /* Without O_DIRECT at least keep the page out of the host cache */
+   if (!mp->direct)
+      posix_fadvise(mp->fd, off, PAGING_PAGESZ, POSIX_FADV_DONTNEED);
+
+   return 0;
+}
+
+/* Device time charged by the accesses of this thread, see MEMPHY_io_take */
+static __thread uint64_t memphy_io_ns;
+
+/*
+ *  MEMPHY_charge - account the device time of an access
+ *  @mp: memphy struct
+ *  @addr: first byte accessed
+ *  @len: bytes moved
+ *
+ *  Call before the cursor moves, a sequential device pays its latency
+ *  only when the access does not start at the cursor. Bytes accessed
+ *  right after the previous access continue that operation and pay
+ *  their transfer only.
+ */
+static void MEMPHY_charge(struct memphy_struct *mp, uint64_t addr, uint64_t len)
+{
+   uint64_t ns = 0;
+   int cont = (len < PAGING_PAGESZ && addr == mp->io_next);
+
+   mp->io_next = addr + len;
+   if (mp->lat_ns == 0 && mp->bw_mbs == 0)
+      return;
+
+   if (!cont && (mp->rdmflg || addr != mp->cursor))
+      ns += mp->lat_ns;
+   if (mp->bw_mbs > 0)
+      ns += len * 1000 / mp->bw_mbs;
+
+   mp->busy_ns += ns;
+   memphy_io_ns += ns;
+}
+
+/*
+ *  MEMPHY_io_take - device time charged by the calling thread since the
+ *                   last call, in ns
+ */
+uint64_t MEMPHY_io_take(void)
+{
+   uint64_t ns = memphy_io_ns;
+
+   memphy_io_ns = 0;
+   return ns;
+}
+
+/*
+ *  MEMPHY_set_timing - set the device timing model
+ *  @mp: memphy struct
+ *  @lat_ns: access (random) or seek (sequential) latency in ns
+ *  @bw_mbs: bandwidth in MB/s, 0 is unlimited
+ */
+int MEMPHY_set_timing(struct memphy_struct *mp, uint64_t lat_ns, uint64_t bw_mbs)
+{
+   if (mp == NULL)
+      return -1;
+
+   mp->lat_ns = lat_ns;
+   mp->bw_mbs = bw_mbs;
+
+   return 0;
+}
+
+/*
+ *  MEMPHY_mv_csr - move MEMPHY cursor
+ *  @mp: memphy struct
+ *  @offset: offset
+ *
+ *  Same place the old byte by byte walk from 0 ended at, in O(1)
+ */
+int MEMPHY_mv_csr(struct memphy_struct *mp, uint64_t offset)
+{
+   mp->cursor = (offset < mp->maxsz) ? offset : 0;
+
    return 0;
 }
 
@@ -47,14 +169,25 @@ int MEMPHY_mv_csr(struct memphy_struct *mp, addr_t offset)
  */
 int MEMPHY_seq_read(struct memphy_struct *mp, addr_t addr, BYTE *value)
 {
-   if (mp == NULL)
+   if (mp == NULL || addr >= mp->maxsz)
       return -1;
 
-   if (!mp->rdmflg)
+   if (mp->rdmflg)
       return -1; /* Not compatible mode for sequential read */
 
+   MEMPHY_charge(mp, addr, 1);
    MEMPHY_mv_csr(mp, addr);
-   *value = (BYTE)mp->storage[addr];
+
+   if (MEMPHY_STREAMED(mp))
+   {
+      if (MEMPHY_stream_in(mp, addr / PAGING_PAGESZ) < 0)
+         return -1;
+      *value = mp->bounce[addr % PAGING_PAGESZ];
+      return 0;
+   }
+
+   BYTE *cell = MEMPHY_cell(mp, addr, 0);
+   *value = (cell != NULL) ? *cell : 0;
 
    return 0;
 }
@@ -74,7 +207,9 @@ int MEMPHY_read(struct memphy_struct *mp, addr_t addr, BYTE *value)
    {
       if (addr >= mp->maxsz)
          return -1; /* Out of bounds */
-      *value = mp->storage[addr];
+      MEMPHY_charge(mp, addr, 1);
+      BYTE *cell = MEMPHY_cell(mp, addr, 0);
+      *value = (cell != NULL) ? *cell : 0;
    }
    else /* Sequential access device */
       return MEMPHY_seq_read(mp, addr, value);
@@ -91,14 +226,28 @@ int MEMPHY_read(struct memphy_struct *mp, addr_t addr, BYTE *value)
 int MEMPHY_seq_write(struct memphy_struct *mp, addr_t addr, BYTE value)
 {
 
-   if (mp == NULL)
+   if (mp == NULL || addr >= mp->maxsz)
       return -1;
 
-   if (!mp->rdmflg)
-      return -1; /* Not compatible mode for sequential read */
+   if (mp->rdmflg)
+      return -1; /* Not compatible mode for sequential write */
 
+   MEMPHY_charge(mp, addr, 1);
    MEMPHY_mv_csr(mp, addr);
-   mp->storage[addr] = value;
+
+   if (MEMPHY_STREAMED(mp))
+   {
+      /* Whole page read-modify-write, the file only sees aligned I/O */
+      if (MEMPHY_stream_in(mp, addr / PAGING_PAGESZ) < 0)
+         return -1;
+      mp->bounce[addr % PAGING_PAGESZ] = value;
+      return MEMPHY_stream_out(mp, addr / PAGING_PAGESZ);
+   }
+
+   BYTE *cell = MEMPHY_cell(mp, addr, 1);
+   if (cell == NULL)
+      return -1;
+   *cell = value;
 
    return 0;
 }
@@ -118,7 +267,11 @@ int MEMPHY_write(struct memphy_struct *mp, addr_t addr, BYTE data)
    {
       if (addr >= mp->maxsz)
          return -1; /* Out of bounds */
-      mp->storage[addr] = data;
+      MEMPHY_charge(mp, addr, 1);
+      BYTE *cell = MEMPHY_cell(mp, addr, 1);
+      if (cell == NULL)
+         return -1;
+      *cell = data;
    }
    else /* Sequential access device */
       return MEMPHY_seq_write(mp, addr, data);
@@ -129,56 +282,531 @@ int MEMPHY_write(struct memphy_struct *mp, addr_t addr, BYTE data)
 /*
  *  MEMPHY_format-format MEMPHY device
  *  @mp: memphy struct
+ *
+ *  The frame table comes zeroed from calloc, a descriptor is set up the
+ *  first time its frame is handed out, so formatting costs the same
+ *  whatever the device size.
  */
 int MEMPHY_format(struct memphy_struct *mp, int pagesz)
 {
    /* This setting come with fixed constant PAGESZ */
    int numfp = mp->maxsz / pagesz;
-   struct framephy_struct *newfst, *fst;
-   int iter = 0;
+
+   mp->rmap_sz = 0;
+   mp->rmap_hand = 0;
+   mp->free_top = 0;
+   mp->free_next = 0;
+   mp->free_cnt = 0;
+   mp->used_cnt = 0;
+   mp->bd_free = 0;
+   for (int k = 0; k <= MEMPHY_MAX_ORDER; k++)
+   {
+      mp->bd_head[k] = -1;
+      mp->bd_cnt[k] = 0;
+   }
+   for (int k = 0; k < PAGING_MAX_MMSWP; k++)
+      mp->swpc_head[k] = -1;
 
    if (numfp <= 0)
       return -1;
 
-   /* Init head of free framephy list */
-   fst = malloc(sizeof(struct framephy_struct));
-   fst->fpn = iter;
-   mp->free_fp_list = fst;
+   mp->rmap = calloc(numfp, sizeof(struct framephy_struct));
+   mp->free_stk = malloc(numfp * sizeof(addr_t));
+   if (mp->rmap == NULL || mp->free_stk == NULL)
+   {
+      free(mp->rmap);
+      free(mp->free_stk);
+      mp->rmap = NULL;
+      mp->free_stk = NULL;
+      return -1;
+   }
+
+   mp->rmap_sz = numfp;
+   mp->free_cnt = numfp;
+
+   return 0;
+}
+
+/* Set up the descriptor of a frame leaving the fresh range */
+static void MEMPHY_frame_init(struct memphy_struct *mp, addr_t fpn)
+{
+   memset(&mp->rmap[fpn], 0, sizeof(struct framephy_struct));
+   mp->rmap[fpn].fpn = fpn;
+   mp->rmap[fpn].swptyp = -1;
+}
+
+static void MEMPHY_free_push(struct memphy_struct *mp, addr_t fpn)
+{
+   mp->free_stk[mp->free_top++] = fpn;
+   mp->rmap[fpn].fstk = mp->free_top;
+}
+
+static void MEMPHY_bd_add(struct memphy_struct *mp, int fpn, int order)
+{
+   struct framephy_struct *fp = &mp->rmap[fpn];
+
+   fp->buddy = order + 1;
+   fp->bd_prev = -1;
+   fp->bd_next = mp->bd_head[order];
+   if (fp->bd_next >= 0)
+      mp->rmap[fp->bd_next].bd_prev = fpn;
+   mp->bd_head[order] = fpn;
+   mp->bd_cnt[order]++;
+   mp->bd_free += 1 << order;
+}
+
+static void MEMPHY_bd_del(struct memphy_struct *mp, int fpn, int order)
+{
+   struct framephy_struct *fp = &mp->rmap[fpn];
+
+   if (fp->bd_prev >= 0)
+      mp->rmap[fp->bd_prev].bd_next = fp->bd_next;
+   else
+      mp->bd_head[order] = fp->bd_next;
+   if (fp->bd_next >= 0)
+      mp->rmap[fp->bd_next].bd_prev = fp->bd_prev;
+   fp->buddy = 0;
+   mp->bd_cnt[order]--;
+   mp->bd_free -= 1 << order;
+}
+
+/* Head and order of the free buddy block holding a frame, -1 if none */
+static int MEMPHY_bd_find(struct memphy_struct *mp, int fpn, int *order)
+{
+   int k, head;
+
+   for (k = 0; k <= MEMPHY_MAX_ORDER; k++)
+   {
+      head = fpn & ~((1 << k) - 1);
+      if (mp->rmap[head].buddy == k + 1)
+      {
+         *order = k;
+         return head;
+      }
+   }
+
+   return -1;
+}
+
+/*
+ * MEMPHY_bd_release - Put a block back, merging it with its free buddies.
+ * A block that ends at free_next is folded back into the fresh range
+ * together with the free blocks right below it.
+ */
+static void MEMPHY_bd_release(struct memphy_struct *mp, int fpn, int order)
+{
+   int k, head;
+
+   while (order < MEMPHY_MAX_ORDER)
+   {
+      int bfpn = fpn ^ (1 << order);
+
+      if (bfpn >= mp->free_next || mp->rmap[bfpn].buddy != order + 1)
+         break;
+      MEMPHY_bd_del(mp, bfpn, order);
+      fpn &= ~(1 << order);
+      order++;
+   }
+
+   if (fpn + (1 << order) != mp->free_next)
+   {
+      MEMPHY_bd_add(mp, fpn, order);
+      return;
+   }
+
+   mp->free_next = fpn;
+   for (k = 0; k <= MEMPHY_MAX_ORDER && mp->free_next > 0; k++)
+   {
+      head = mp->free_next - (1 << k);
+      if (head < 0 || (head & ((1 << k) - 1)) || mp->rmap[head].buddy != k + 1)
+         continue;
+      MEMPHY_bd_del(mp, head, k);
+      mp->free_next = head;
+      k = -1; /* rescan from order 0 below the new edge */
+   }
+}
+
+/* Cut an aligned block off the fresh range, what alignment skips over
+ * goes to the buddy lists */
+static int MEMPHY_bd_carve(struct memphy_struct *mp, int order)
+{
+   int size = 1 << order;
+   int base = (mp->free_next + size - 1) & ~(size - 1);
+   int cur, k, i;
+
+   if (base + size > mp->rmap_sz)
+      return -1;
+
+   cur = mp->free_next;
+   mp->free_next = base + size;
 
-   /* We have list with first element, fill in the rest num-1 element member*/
-   for (iter = 1; iter < numfp; iter++)
+   for (; cur < base; cur += 1 << k)
    {
-      newfst = malloc(sizeof(struct framephy_struct));
-      newfst->fpn = iter;
-      newfst->fp_next = NULL;
-      fst->fp_next = newfst;
-      fst = newfst;
+      for (k = 0; k < order && !(cur & (1 << k)); k++)
+         ;
+      for (i = 0; i < (1 << k); i++)
+         MEMPHY_frame_init(mp, cur + i);
+      MEMPHY_bd_release(mp, cur, k);
    }
 
+   for (i = 0; i < size; i++)
+      MEMPHY_frame_init(mp, base + i);
+
+   return base;
+}
+
+/* Hand the n coldest stacked frames to the buddy lists to merge */
+static void MEMPHY_bd_drain(struct memphy_struct *mp, int n)
+{
+   int i;
+
+   for (i = 0; i < n; i++)
+   {
+      mp->rmap[mp->free_stk[i]].fstk = 0;
+      MEMPHY_bd_release(mp, mp->free_stk[i], 0);
+   }
+
+   mp->free_top -= n;
+   memmove(mp->free_stk, mp->free_stk + n, mp->free_top * sizeof(addr_t));
+   for (i = 0; i < mp->free_top; i++)
+      mp->rmap[mp->free_stk[i]].fstk = i + 1;
+}
+
+/*
+ * MEMPHY_alloc_order - Allocate 2^order physically contiguous frames
+ * @mp: memphy struct
+ * @order: block order, 0..MEMPHY_MAX_ORDER
+ * @retfpn: output - first frame of the block, aligned on its size
+ *
+ * Takes the smallest free buddy block that fits and splits it, then
+ * carves from the fresh range. Freed single frames wait on the free
+ * stack, up to MEMPHY_FREE_STK_HIGH of them, and all are merged when
+ * a bigger block cannot be found.
+ */
+int MEMPHY_alloc_order(struct memphy_struct *mp, int order, addr_t *retfpn)
+{
+   int k, fpn = -1;
+
+   if (mp == NULL || order < 0 || order > MEMPHY_MAX_ORDER)
+      return -1;
+
+   for (;;)
+   {
+      for (k = order; k <= MEMPHY_MAX_ORDER && mp->bd_head[k] < 0; k++)
+         ;
+
+      if (k <= MEMPHY_MAX_ORDER)
+      {
+         fpn = mp->bd_head[k];
+         MEMPHY_bd_del(mp, fpn, k);
+         while (k > order)
+         {
+            k--;
+            MEMPHY_bd_add(mp, fpn + (1 << k), k);
+         }
+         break;
+      }
+
+      fpn = MEMPHY_bd_carve(mp, order);
+      if (fpn >= 0 || order == 0 || mp->free_top == 0)
+         break;
+
+      MEMPHY_bd_drain(mp, mp->free_top);
+   }
+
+   if (fpn < 0)
+      return -1;
+
+   mp->free_cnt -= 1 << order;
+   *retfpn = fpn;
+
+   return 0;
+}
+
+/*
+ * MEMPHY_free_order - Free a block from MEMPHY_alloc_order
+ * @mp: memphy struct
+ * @fpn: first frame of the block
+ * @order: block order
+ */
+int MEMPHY_free_order(struct memphy_struct *mp, addr_t fpn, int order)
+{
+   if (mp == NULL || order < 0 || order > MEMPHY_MAX_ORDER ||
+       (fpn & ((1 << order) - 1)) || fpn + (1 << order) > (addr_t)mp->free_next ||
+       MEMPHY_is_frame_free(mp, fpn))
+      return -1;
+
+   MEMPHY_bd_release(mp, fpn, order);
+   mp->free_cnt += 1 << order;
+
+   return 0;
+}
+
+/*
+ * MEMPHY_get_freefp_range - Take up to maxpg contiguous frames
+ * @mp: memphy struct
+ * @maxpg: frames wanted
+ * @retfpn: output - first frame of the run
+ *
+ * Return the run length, the biggest power of two not above maxpg
+ * that is still available, or -1 when the device is full.
+ */
+int MEMPHY_get_freefp_range(struct memphy_struct *mp, int maxpg, addr_t *retfpn)
+{
+   int order;
+
+   if (maxpg <= 0)
+      return -1;
+
+   for (order = 0; order < MEMPHY_MAX_ORDER && (2 << order) <= maxpg; order++)
+      ;
+
+   for (; order > 0; order--)
+      if (MEMPHY_alloc_order(mp, order, retfpn) == 0)
+         return 1 << order;
+
+   if (MEMPHY_get_freefp(mp, retfpn) < 0)
+      return -1;
+
+   return 1;
+}
+
+/*
+ *  MEMPHY_page_seek - position the device on a whole page
+ *  @mp: memphy struct
+ *  @fpn: frame page number
+ *
+ *  A sequential device seeks once then streams the page, its cursor
+ *  ends right after the page.
+ */
+static int MEMPHY_page_seek(struct memphy_struct *mp, addr_t fpn)
+{
+   uint64_t addr = (uint64_t)fpn * PAGING_PAGESZ;
+
+   if (mp == NULL || addr + PAGING_PAGESZ > mp->maxsz)
+      return -1; /* Out of bounds */
+
+   MEMPHY_charge(mp, addr, PAGING_PAGESZ);
+
+   if (!mp->rdmflg)
+   {
+      MEMPHY_mv_csr(mp, addr);
+      mp->cursor = (mp->cursor + PAGING_PAGESZ) % mp->maxsz;
+   }
+
+   return 0;
+}
+
+/*
+ *  MEMPHY_read_page - read a whole frame
+ *  @mp: memphy struct
+ *  @fpn: frame page number
+ *  @buf: PAGING_PAGESZ bytes buffer
+ */
+int MEMPHY_read_page(struct memphy_struct *mp, addr_t fpn, BYTE *buf)
+{
+   BYTE *src;
+
+   if (MEMPHY_page_seek(mp, fpn) < 0)
+      return -1;
+
+   if (MEMPHY_STREAMED(mp))
+   {
+      if (MEMPHY_stream_in(mp, fpn) < 0)
+         return -1;
+      memcpy(buf, mp->bounce, PAGING_PAGESZ);
+      return 0;
+   }
+
+   src = MEMPHY_cell(mp, (uint64_t)fpn * PAGING_PAGESZ, 0);
+   if (src != NULL)
+      memcpy(buf, src, PAGING_PAGESZ);
+   else
+      memset(buf, 0, PAGING_PAGESZ);
+
+   return 0;
+}
+
+/*
+ *  MEMPHY_write_page - write a whole frame
+ *  @mp: memphy struct
+ *  @fpn: frame page number
+ *  @buf: PAGING_PAGESZ bytes buffer
+ */
+int MEMPHY_write_page(struct memphy_struct *mp, addr_t fpn, const BYTE *buf)
+{
+   BYTE *dst;
+
+   if (MEMPHY_page_seek(mp, fpn) < 0)
+      return -1;
+
+   if (MEMPHY_STREAMED(mp))
+   {
+      memcpy(mp->bounce, buf, PAGING_PAGESZ);
+      return MEMPHY_stream_out(mp, fpn);
+   }
+
+   dst = MEMPHY_cell(mp, (uint64_t)fpn * PAGING_PAGESZ, 1);
+   if (dst == NULL)
+      return -1;
+   memcpy(dst, buf, PAGING_PAGESZ);
+
+   return 0;
+}
+
+/*
+ *  MEMPHY_copy_page - copy a whole frame between two devices
+ *  @mpsrc: source memphy
+ *  @srcfpn: source frame page number
+ *  @mpdst: destination memphy
+ *  @dstfpn: destination frame page number
+ */
+int MEMPHY_copy_page(struct memphy_struct *mpsrc, addr_t srcfpn,
+                     struct memphy_struct *mpdst, addr_t dstfpn)
+{
+   BYTE *src, *dst;
+
+   if (MEMPHY_STREAMED(mpsrc) || MEMPHY_STREAMED(mpdst))
+   {
+      BYTE page[PAGING_PAGESZ_MAX];
+
+      if (MEMPHY_read_page(mpsrc, srcfpn, page) < 0)
+         return -1;
+      return MEMPHY_write_page(mpdst, dstfpn, page);
+   }
+
+   if (MEMPHY_page_seek(mpsrc, srcfpn) < 0 || MEMPHY_page_seek(mpdst, dstfpn) < 0)
+      return -1;
+
+   /* A never written page stays unmaterialized at the destination too */
+   src = MEMPHY_cell(mpsrc, (uint64_t)srcfpn * PAGING_PAGESZ, 0);
+   dst = MEMPHY_cell(mpdst, (uint64_t)dstfpn * PAGING_PAGESZ, src != NULL);
+   if (src != NULL && dst == NULL)
+      return -1;
+
+   if (src != NULL)
+      memmove(dst, src, PAGING_PAGESZ);
+   else if (dst != NULL)
+      memset(dst, 0, PAGING_PAGESZ);
+
+   return 0;
+}
+
+/*
+ *  MEMPHY_zero_page - zero-fill a whole frame
+ *  @mp: memphy struct
+ *  @fpn: frame page number
+ */
+int MEMPHY_zero_page(struct memphy_struct *mp, addr_t fpn)
+{
+   BYTE *dst;
+
+   if (MEMPHY_page_seek(mp, fpn) < 0)
+      return -1;
+
+   if (MEMPHY_STREAMED(mp))
+   {
+      memset(mp->bounce, 0, PAGING_PAGESZ);
+      return MEMPHY_stream_out(mp, fpn);
+   }
+
+   /* A never written page already reads as zero */
+   dst = MEMPHY_cell(mp, (uint64_t)fpn * PAGING_PAGESZ, 0);
+   if (dst != NULL)
+      memset(dst, 0, PAGING_PAGESZ);
+
    return 0;
 }
 
 int MEMPHY_get_freefp(struct memphy_struct *mp, addr_t *retfpn)
 {
-   struct framephy_struct *fp = mp->free_fp_list;
+   addr_t fpn;
 
-   if (fp == NULL)
+   if (mp->free_cnt == 0)
       return -1;
 
-   *retfpn = fp->fpn;
-   mp->free_fp_list = fp->fp_next;
+   /* Recycle the last freed frame first, then buddy and fresh ones */
+   if (mp->free_top == 0)
+      return MEMPHY_alloc_order(mp, 0, retfpn);
 
-   /* MEMPHY is iteratively used up until its exhausted
-    * No garbage collector acting then it not been released
-    */
-   free(fp);
+   fpn = mp->free_stk[--mp->free_top];
+   mp->rmap[fpn].fstk = 0;
+
+   *retfpn = fpn;
+   mp->free_cnt--;
+
+   return 0;
+}
+
+/*
+ * MEMPHY_get_freefp_at - Take a given frame off the free list
+ * @mp: memphy struct
+ * @fpn: wanted frame page number
+ */
+int MEMPHY_get_freefp_at(struct memphy_struct *mp, addr_t fpn)
+{
+   struct framephy_struct *fp;
+   addr_t top;
+   int i, k;
+
+   if (mp == NULL || fpn >= (addr_t)mp->rmap_sz)
+      return -1;
+
+   if (fpn >= (addr_t)mp->free_next)
+   {
+      /* Frames jumped over stay free, the lowest one on top */
+      for (i = (int)fpn - 1; i >= mp->free_next; i--)
+      {
+         MEMPHY_frame_init(mp, i);
+         MEMPHY_free_push(mp, i);
+      }
+      MEMPHY_frame_init(mp, fpn);
+      mp->free_next = fpn + 1;
+      mp->free_cnt--;
+      return 0;
+   }
+
+   fp = &mp->rmap[fpn];
+   if (fp->fstk == 0)
+   {
+      int head = MEMPHY_bd_find(mp, (int)fpn, &k);
+
+      if (head < 0)
+         return -1; /* Frame is in use */
+
+      /* Split the block down to the frame */
+      MEMPHY_bd_del(mp, head, k);
+      while (k > 0)
+      {
+         k--;
+         if ((int)fpn >= head + (1 << k))
+         {
+            MEMPHY_bd_add(mp, head, k);
+            head += 1 << k;
+         }
+         else
+            MEMPHY_bd_add(mp, head + (1 << k), k);
+      }
+      mp->free_cnt--;
+      return 0;
+   }
+
+   /* Fill its slot with the top of the stack */
+   top = mp->free_stk[--mp->free_top];
+   if (top != fpn)
+   {
+      mp->free_stk[fp->fstk - 1] = top;
+      mp->rmap[top].fstk = fp->fstk;
+   }
+   fp->fstk = 0;
+   mp->free_cnt--;
 
    return 0;
 }
 
 int MEMPHY_dump(struct memphy_struct *mp)
 {
-  /* Dump memphy content mp->storage for tracing the memory content */
+  /* Dump memphy content mp->chunk for tracing the memory content */
   if (mp == NULL)
   {
     printf("MEMPHY_dump: NULL memory physical device\n");
@@ -186,11 +814,11 @@ int MEMPHY_dump(struct memphy_struct *mp)
   }
 
   printf("=== MEMPHY DUMP ===\n");
-  printf("Max Size: %d bytes\n", mp->maxsz);
+  printf("Max Size: %llu bytes\n", (unsigned long long)mp->maxsz);
   printf("Access Mode: %s\n", mp->rdmflg ? "Random" : "Sequential");
   
   if (!mp->rdmflg)
-    printf("Cursor Position: %d\n", mp->cursor);
+    printf("Cursor Position: %llu\n", (unsigned long long)mp->cursor);
   
   /* Dump storage content in hexadecimal format */
   printf("\nStorage Content (first 256 bytes):\n");
@@ -201,7 +829,8 @@ int MEMPHY_dump(struct memphy_struct *mp)
     if (i % 16 == 0)
       printf("%04x: ", i);
     
-    printf("%02x ", (unsigned char)mp->storage[i]);
+    BYTE *cell = MEMPHY_cell(mp, i, 0);
+    printf("%02x ", (cell != NULL) ? (unsigned char)*cell : 0);
     
     if ((i + 1) % 16 == 0)
       printf("\n");
@@ -210,37 +839,42 @@ int MEMPHY_dump(struct memphy_struct *mp)
   if (dump_size % 16 != 0)
     printf("\n");
   
-  /* Dump free frame list */
+  /* Dump free frames */
   printf("\nFree Frame List:\n");
-  struct framephy_struct *fp = mp->free_fp_list;
   int free_count = 0;
+  addr_t ffpn;
   
-  while (fp != NULL && free_count < 20) // Limit to first 20 frames
+  for (ffpn = 0; ffpn < (addr_t)mp->rmap_sz && free_count < 20; ffpn++) // Limit to first 20 frames
   {
-    printf("  FPN: " FORMAT_ADDR, fp->fpn);
+    if (!MEMPHY_is_frame_free(mp, ffpn))
+      continue;
+    printf("  FPN: " FORMAT_ADDR, ffpn);
     if (free_count % 5 == 4)
       printf("\n");
     else
       printf(", ");
-    fp = fp->fp_next;
     free_count++;
   }
   
   if (free_count > 0 && free_count % 5 != 0)
     printf("\n");
   
-  if (fp != NULL)
+  if (free_count < mp->free_cnt)
     printf("  ... (more frames)\n");
   
   printf("Total Free Frames Shown: %d\n", free_count);
   
-  /* Dump used frame list */
+  /* Dump used frames */
   printf("\nUsed Frame List:\n");
-  struct framephy_struct *ufp = mp->used_fp_list;
   int used_count = 0;
+  int ufpn;
   
-  while (ufp != NULL && used_count < 20) // Limit to first 20 frames
+  for (ufpn = 0; ufpn < mp->free_next && used_count < 20; ufpn++) // Limit to first 20 frames
   {
+    struct framephy_struct *ufp = &mp->rmap[ufpn];
+
+    if (!ufp->used)
+      continue;
     printf("  FPN: " FORMAT_ADDR, ufp->fpn);
     if (ufp->owner != NULL)
       printf(" (owner: %p)", (void*)ufp->owner);
@@ -248,14 +882,13 @@ int MEMPHY_dump(struct memphy_struct *mp)
       printf("\n");
     else
       printf(", ");
-    ufp = ufp->fp_next;
     used_count++;
   }
   
   if (used_count > 0 && used_count % 5 != 0)
     printf("\n");
   
-  if (ufp != NULL)
+  if (used_count < mp->used_cnt)
     printf("  ... (more frames)\n");
   
   printf("Total Used Frames Shown: %d\n", used_count);
@@ -267,14 +900,14 @@ int MEMPHY_dump(struct memphy_struct *mp)
 
 int MEMPHY_put_freefp(struct memphy_struct *mp, addr_t fpn)
 {
-   struct framephy_struct *fp = mp->free_fp_list;
-   struct framephy_struct *newnode = malloc(sizeof(struct framephy_struct));
+   if (mp == NULL || fpn >= (addr_t)mp->free_next || MEMPHY_is_frame_free(mp, fpn))
+      return -1; /* Never handed out or already free */
+
+   MEMPHY_free_push(mp, fpn);
+   mp->free_cnt++;
 
-   /* Create new node with value fpn */
-   newnode->fpn = fpn;
-   newnode->fp_next = fp;
-   newnode->owner = NULL;
-   mp->free_fp_list = newnode;
+   if (mp->free_top > MEMPHY_FREE_STK_HIGH)
+      MEMPHY_bd_drain(mp, MEMPHY_FREE_STK_HIGH / 2);
 
    return 0;
 }
@@ -292,17 +925,7 @@ int MEMPHY_get_usedfp(struct memphy_struct *mp, addr_t fpn, struct mm_struct *ow
    if (MEMPHY_get_freefp(mp, &allocated_fpn) < 0)
       return -1;
    
-   /* Create node for used list */
-   struct framephy_struct *newnode = malloc(sizeof(struct framephy_struct));
-   if (newnode == NULL)
-      return -1;
-   
-   newnode->fpn = allocated_fpn;
-   newnode->owner = owner;
-   newnode->fp_next = mp->used_fp_list;
-   mp->used_fp_list = newnode;
-   
-   return 0;
+   return MEMPHY_put_usedfp(mp, allocated_fpn, owner);
 }
 
 /*
@@ -313,15 +936,16 @@ int MEMPHY_get_usedfp(struct memphy_struct *mp, addr_t fpn, struct mm_struct *ow
  */
 int MEMPHY_put_usedfp(struct memphy_struct *mp, addr_t fpn, struct mm_struct *owner)
 {
-   struct framephy_struct *newnode = malloc(sizeof(struct framephy_struct));
-   
-   if (newnode == NULL)
+   if (mp == NULL || fpn >= (addr_t)mp->free_next)
       return -1;
    
-   newnode->fpn = fpn;
-   newnode->owner = owner;
-   newnode->fp_next = mp->used_fp_list;
-   mp->used_fp_list = newnode;
+   struct framephy_struct *fp = &mp->rmap[fpn];
+   if (!fp->used)
+   {
+      fp->used = 1;
+      mp->used_cnt++;
+   }
+   fp->owner = owner;
    
    return 0;
 }
@@ -333,28 +957,13 @@ int MEMPHY_put_usedfp(struct memphy_struct *mp, addr_t fpn, struct mm_struct *ow
  */
 int MEMPHY_remove_usedfp(struct memphy_struct *mp, addr_t fpn)
 {
-   struct framephy_struct *prev = NULL;
-   struct framephy_struct *curr = mp->used_fp_list;
+   if (mp == NULL || fpn >= (addr_t)mp->free_next || !mp->rmap[fpn].used)
+      return -1; /* Frame not found */
    
-   /* Search for the frame in used list */
-   while (curr != NULL)
-   {
-      if (curr->fpn == fpn)
-      {
-         /* Found it, remove from list */
-         if (prev == NULL)
-            mp->used_fp_list = curr->fp_next;
-         else
-            prev->fp_next = curr->fp_next;
-         
-         free(curr);
-         return 0;
-      }
-      prev = curr;
-      curr = curr->fp_next;
-   }
+   mp->rmap[fpn].used = 0;
+   mp->used_cnt--;
    
-   return -1; /* Frame not found */
+   return 0;
 }
 
 /*
@@ -372,20 +981,276 @@ int MEMPHY_free_usedfp(struct memphy_struct *mp, addr_t fpn)
    return MEMPHY_put_freefp(mp, fpn);
 }
 
+/* Take a frame off the swap cache list of its device, if it is on one */
+static void MEMPHY_swpc_del(struct memphy_struct *mp, addr_t fpn)
+{
+   struct framephy_struct *fp = &mp->rmap[fpn];
+
+   if (fp->swptyp < 0)
+      return;
+
+   if (fp->sc_prev >= 0)
+      mp->rmap[fp->sc_prev].sc_next = fp->sc_next;
+   else
+      mp->swpc_head[fp->swptyp] = fp->sc_next;
+   if (fp->sc_next >= 0)
+      mp->rmap[fp->sc_next].sc_prev = fp->sc_prev;
+   fp->swptyp = -1;
+}
+
+/*
+ * MEMPHY_rmap_set - Record the page held by a frame
+ * @mp: memphy struct
+ * @fpn: frame page number
+ * @owner: mm owning the page
+ * @pgn: page number in the owner address space
+ */
+int MEMPHY_rmap_set(struct memphy_struct *mp, addr_t fpn, struct mm_struct *owner, addr_t pgn)
+{
+   if (mp == NULL || fpn >= mp->rmap_sz)
+      return -1;
+
+   mp->rmap[fpn].owner = owner;
+   mp->rmap[fpn].pgn = pgn;
+   mp->rmap[fpn].ref = 1;
+   MEMPHY_swpc_del(mp, fpn);
+   mp->rmap[fpn].ra = 0;
+
+   return 0;
+}
+
+/*
+ * MEMPHY_rmap_clear - Forget the page held by a frame
+ * @mp: memphy struct
+ * @fpn: frame page number
+ */
+int MEMPHY_rmap_clear(struct memphy_struct *mp, addr_t fpn)
+{
+   if (mp == NULL || fpn >= mp->rmap_sz)
+      return -1;
+
+   mp->rmap[fpn].owner = NULL;
+   mp->rmap[fpn].ref = 0;
+   MEMPHY_swpc_del(mp, fpn);
+
+   return 0;
+}
+
+/*
+ * MEMPHY_rmap_get - Look up the page held by a frame
+ * @mp: memphy struct
+ * @fpn: frame page number
+ * @owner: output - mm owning the page
+ * @pgn: output - page number in the owner address space
+ */
+int MEMPHY_rmap_get(struct memphy_struct *mp, addr_t fpn, struct mm_struct **owner, addr_t *pgn)
+{
+   if (mp == NULL || fpn >= mp->rmap_sz || mp->rmap[fpn].owner == NULL)
+      return -1;
+
+   if (owner != NULL)
+      *owner = mp->rmap[fpn].owner;
+   if (pgn != NULL)
+      *pgn = mp->rmap[fpn].pgn;
+
+   return 0;
+}
+
+/*
+ * MEMPHY_rmap_ref - Mark a frame as referenced
+ * @mp: memphy struct
+ * @fpn: frame page number
+ */
+int MEMPHY_rmap_ref(struct memphy_struct *mp, addr_t fpn)
+{
+   if (mp == NULL || fpn >= mp->rmap_sz)
+      return -1;
+
+   mp->rmap[fpn].ref = 1;
+
+   return 0;
+}
+
+/*
+ * MEMPHY_rmap_mark_ra - Flag a frame filled by readahead
+ * @mp: memphy struct
+ * @fpn: frame page number
+ */
+int MEMPHY_rmap_mark_ra(struct memphy_struct *mp, addr_t fpn)
+{
+   if (mp == NULL || fpn >= mp->rmap_sz)
+      return -1;
+
+   mp->rmap[fpn].ra = 1;
+   mp->rmap[fpn].ref = 0; /* not referenced yet, first to go */
+
+   return 0;
+}
+
+/*
+ * MEMPHY_rmap_take_ra - Clear the readahead flag of a frame
+ * @mp: memphy struct
+ * @fpn: frame page number
+ *
+ * Return 1 if the frame was still flagged
+ */
+int MEMPHY_rmap_take_ra(struct memphy_struct *mp, addr_t fpn)
+{
+   if (mp == NULL || fpn >= mp->rmap_sz || !mp->rmap[fpn].ra)
+      return 0;
+
+   mp->rmap[fpn].ra = 0;
+
+   return 1;
+}
+
+/*
+ * MEMPHY_rmap_victim - Pick an owned frame with a CLOCK sweep over
+ *                      the whole device, regardless of the owner
+ * @mp: memphy struct
+ * @retfpn: output - victim frame page number
+ */
+int MEMPHY_rmap_victim(struct memphy_struct *mp, addr_t *retfpn)
+{
+   int step;
+
+   if (mp == NULL || mp->rmap_sz <= 0)
+      return -1;
+
+   /* Two rounds are enough, the first one clears every bit */
+   for (step = 0; step < 2 * mp->rmap_sz; step++)
+   {
+      struct framephy_struct *fp = &mp->rmap[mp->rmap_hand];
+      int fpn = mp->rmap_hand;
+
+      mp->rmap_hand = (mp->rmap_hand + 1) % mp->rmap_sz;
+
+      if (fp->owner == NULL)
+         continue;
+
+      if (fp->ref)
+      {
+         fp->ref = 0;
+         continue;
+      }
+
+      *retfpn = fpn;
+      return 0;
+   }
+
+   return -1; /* No owned frame */
+}
+
+/*
+ * MEMPHY_swpcache_set - Remember that a frame still has a valid copy
+ *                       in a swap device
+ * @mp: memphy struct
+ * @fpn: frame page number
+ * @swptyp: swap device id
+ * @swpoff: frame page number in the swap device
+ */
+int MEMPHY_swpcache_set(struct memphy_struct *mp, addr_t fpn, int swptyp, addr_t swpoff)
+{
+   if (mp == NULL || fpn >= mp->rmap_sz)
+      return -1;
+
+   if (swptyp < 0 || swptyp >= PAGING_MAX_MMSWP)
+      return -1;
+
+   MEMPHY_swpc_del(mp, fpn);
+   mp->rmap[fpn].swptyp = swptyp;
+   mp->rmap[fpn].swpoff = swpoff;
+   mp->rmap[fpn].sc_prev = -1;
+   mp->rmap[fpn].sc_next = mp->swpc_head[swptyp];
+   if (mp->swpc_head[swptyp] >= 0)
+      mp->rmap[mp->swpc_head[swptyp]].sc_prev = fpn;
+   mp->swpc_head[swptyp] = fpn;
+
+   return 0;
+}
+
+/*
+ * MEMPHY_swpcache_get - Look up the swap copy of a frame
+ * @mp: memphy struct
+ * @fpn: frame page number
+ * @swptyp: output - swap device id
+ * @swpoff: output - frame page number in the swap device
+ */
+int MEMPHY_swpcache_get(struct memphy_struct *mp, addr_t fpn, int *swptyp, addr_t *swpoff)
+{
+   if (mp == NULL || fpn >= (addr_t)mp->free_next || mp->rmap[fpn].swptyp < 0)
+      return -1;
+
+   if (swptyp != NULL)
+      *swptyp = mp->rmap[fpn].swptyp;
+   if (swpoff != NULL)
+      *swpoff = mp->rmap[fpn].swpoff;
+
+   return 0;
+}
+
+/*
+ * MEMPHY_swpcache_drop - Forget the swap copy of a frame, the caller
+ *                        owns the swap frame afterwards
+ * @mp: memphy struct
+ * @fpn: frame page number
+ */
+int MEMPHY_swpcache_drop(struct memphy_struct *mp, addr_t fpn)
+{
+   if (mp == NULL || fpn >= mp->rmap_sz)
+      return -1;
+
+   MEMPHY_swpc_del(mp, fpn);
+
+   return 0;
+}
+
+/*
+ * MEMPHY_swpcache_steal - Take back a swap frame held by the swap cache
+ *                         when the swap device has no free frame left
+ * @mp: memphy struct
+ * @swptyp: swap device id
+ * @swpoff: output - reclaimed frame page number in the swap device
+ */
+int MEMPHY_swpcache_steal(struct memphy_struct *mp, int swptyp, addr_t *swpoff)
+{
+   int fpn;
+
+   if (mp == NULL || swptyp < 0 || swptyp >= PAGING_MAX_MMSWP)
+      return -1;
+
+   fpn = mp->swpc_head[swptyp];
+   if (fpn < 0)
+      return -1; /* No cached swap frame on this device */
+
+   *swpoff = mp->rmap[fpn].swpoff;
+   MEMPHY_swpc_del(mp, fpn);
+
+   return 0;
+}
+
 /*
  *  Init MEMPHY struct
  */
-int init_memphy(struct memphy_struct *mp, addr_t max_size, int randomflg)
+int init_memphy(struct memphy_struct *mp, uint64_t max_size, int randomflg)
 {
-   mp->storage = (BYTE *)malloc(max_size * sizeof(BYTE));
+   /* Only the chunk directory up front, chunks come with the first write */
    mp->maxsz = max_size;
-   memset(mp->storage, 0, max_size * sizeof(BYTE));
+   mp->nchunk = (max_size + MEMPHY_CHUNK_SZ - 1) >> MEMPHY_CHUNK_SHIFT;
+   mp->nchunk_live = 0;
+   mp->chunk = calloc(mp->nchunk > 0 ? mp->nchunk : 1, sizeof(BYTE *));
+   mp->fd = -1;
+   mp->map = NULL;
+   mp->bounce = NULL;
+   mp->direct = 0;
+   mp->lat_ns = 0;
+   mp->bw_mbs = 0;
+   mp->busy_ns = 0;
+   mp->io_next = UINT64_MAX;
 
-   /* Initialize used frame list to NULL */
-   mp->used_fp_list = NULL;
-
-   if (MEMPHY_format(mp, PAGING_PAGESZ) < 0)
-     mp->free_fp_list = NULL;
+   mp->rmap = NULL;
+   mp->free_stk = NULL;
+   MEMPHY_format(mp, PAGING_PAGESZ);
 
    mp->rdmflg = (randomflg != 0) ? 1 : 0;
 
@@ -395,6 +1260,80 @@ int init_memphy(struct memphy_struct *mp, addr_t max_size, int randomflg)
    return 0;
 }
 
+/*
+ * MEMPHY_attach_file - Keep the device storage in a host file
+ * @mp: memphy struct, fresh from init_memphy
+ * @path: host file, created if missing and grown (sparse) to the
+ *        device size, existing content is kept
+ *
+ * A random access device maps the file shared. A sequential device
+ * streams whole pages with pread/pwrite, with O_DIRECT when the page
+ * size fits its alignment, so swap traffic bypasses the host cache.
+ */
+int MEMPHY_attach_file(struct memphy_struct *mp, const char *path)
+{
+   struct stat st;
+   int fd = -1;
+
+   if (mp == NULL || mp->maxsz == 0 || mp->fd >= 0)
+      return -1;
+
+   if (!mp->rdmflg && PAGING_PAGESZ % MEMPHY_DIO_ALIGN == 0)
+   {
+      fd = open(path, O_RDWR | O_CREAT | O_DIRECT, 0600);
+      mp->direct = (fd >= 0);
+   }
+   if (fd < 0)
+      fd = open(path, O_RDWR | O_CREAT, 0600);
+   if (fd < 0)
+      return -1;
+
+   if (fstat(fd, &st) < 0 ||
+       ((uint64_t)st.st_size < mp->maxsz && ftruncate(fd, mp->maxsz) < 0))
+   {
+      close(fd);
+      return -1;
+   }
+
+   if (mp->rdmflg)
+   {
+      void *map = mmap(NULL, mp->maxsz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+      if (map == MAP_FAILED)
+      {
+         close(fd);
+         return -1;
+      }
+      mp->map = map;
+   }
+   else if (posix_memalign((void **)&mp->bounce, MEMPHY_DIO_ALIGN, PAGING_PAGESZ) != 0)
+   {
+      close(fd);
+      return -1;
+   }
+
+   /* The file replaces the in-memory chunks */
+   for (int i = 0; i < mp->nchunk; i++)
+      free(mp->chunk[i]);
+   memset(mp->chunk, 0, mp->nchunk * sizeof(BYTE *));
+   mp->nchunk_live = 0;
+   mp->fd = fd;
+
+   return 0;
+}
+
+/*
+ * MEMPHY_touched_kb - Host memory held by the device storage in KB
+ * @mp: memphy struct
+ */
+unsigned long MEMPHY_touched_kb(struct memphy_struct *mp)
+{
+   if (mp == NULL)
+      return 0;
+
+   return mp->nchunk_live * (MEMPHY_CHUNK_SZ / 1024);
+}
+
 /*
  * MEMPHY_get_frame_count - Count number of frames in a list
  * @fp_list: frame list to count
@@ -425,8 +1364,8 @@ int MEMPHY_get_stats(struct memphy_struct *mp, int *free_frames, int *used_frame
    if (mp == NULL)
       return -1;
    
-   *free_frames = MEMPHY_get_frame_count(mp->free_fp_list);
-   *used_frames = MEMPHY_get_frame_count(mp->used_fp_list);
+   *free_frames = mp->free_cnt;
+   *used_frames = mp->used_cnt;
    *total_frames = mp->maxsz / PAGING_PAGESZ;
    
    return 0;
@@ -446,7 +1385,9 @@ int MEMPHY_print_stats(struct memphy_struct *mp, const char *name)
    MEMPHY_get_stats(mp, &free_frames, &used_frames, &total_frames);
    
    printf("=== %s Statistics ===\n", name);
-   printf("Total Size: %d bytes (%d KB)\n", mp->maxsz, mp->maxsz / 1024);
+   printf("Total Size: %llu bytes (%llu KB, %llu KB materialized)\n",
+          (unsigned long long)mp->maxsz, (unsigned long long)mp->maxsz / 1024,
+          (unsigned long long)MEMPHY_touched_kb(mp));
    printf("Total Frames: %d\n", total_frames);
    printf("Free Frames: %d (%.1f%%)\n", free_frames, 
           (float)free_frames * 100.0 / total_frames);
@@ -458,6 +1399,49 @@ int MEMPHY_print_stats(struct memphy_struct *mp, const char *name)
    return 0;
 }
 
+/*
+ * MEMPHY_buddy_report - Print free blocks and fragmentation per order
+ * @mp: memphy struct
+ * @name: name of the memory device
+ *
+ * The fresh range counts as the aligned blocks it splits into, stacked
+ * frames as order 0 blocks. The fragmentation of an order is the share
+ * of free frames that cannot serve a request of that order.
+ */
+int MEMPHY_buddy_report(struct memphy_struct *mp, const char *name)
+{
+   int nblk[MEMPHY_MAX_ORDER + 1];
+   int k, cur, usable;
+
+   if (mp == NULL)
+      return -1;
+
+   for (k = 0; k <= MEMPHY_MAX_ORDER; k++)
+      nblk[k] = mp->bd_cnt[k];
+   nblk[0] += mp->free_top;
+
+   for (cur = mp->free_next; cur < mp->rmap_sz; cur += 1 << k)
+   {
+      for (k = MEMPHY_MAX_ORDER; k > 0; k--)
+         if (!(cur & ((1 << k) - 1)) && cur + (1 << k) <= mp->rmap_sz)
+            break;
+      nblk[k]++;
+   }
+
+   printf("%s Free Blocks per Order:", name);
+   for (k = 0; k <= MEMPHY_MAX_ORDER; k++)
+      printf(" %d", nblk[k]);
+   printf("\n%s Fragmentation per Order:", name);
+   for (k = 0, usable = mp->free_cnt; k <= MEMPHY_MAX_ORDER; k++)
+   {
+      printf(" %.0f%%", mp->free_cnt ? 100.0 * (mp->free_cnt - usable) / mp->free_cnt : 0.0);
+      usable -= nblk[k] << k;
+   }
+   printf("\n");
+
+   return 0;
+}
+
 /*
  * MEMPHY_find_frame - Find a frame in used list by FPN
  * @mp: memphy struct
@@ -466,20 +1450,13 @@ int MEMPHY_print_stats(struct memphy_struct *mp, const char *name)
  */
 int MEMPHY_find_frame(struct memphy_struct *mp, addr_t fpn, struct mm_struct **owner)
 {
-   struct framephy_struct *fp = mp->used_fp_list;
+   if (mp == NULL || fpn >= (addr_t)mp->free_next || !mp->rmap[fpn].used)
+      return -1; /* Not found */
    
-   while (fp != NULL)
-   {
-      if (fp->fpn == fpn)
-      {
-         if (owner != NULL)
-            *owner = fp->owner;
-         return 0; /* Found */
-      }
-      fp = fp->fp_next;
-   }
+   if (owner != NULL)
+      *owner = mp->rmap[fpn].owner;
    
-   return -1; /* Not found */
+   return 0; /* Found */
 }
 
 /*
@@ -489,16 +1466,16 @@ int MEMPHY_find_frame(struct memphy_struct *mp, addr_t fpn, struct mm_struct **o
  */
 int MEMPHY_is_frame_free(struct memphy_struct *mp, addr_t fpn)
 {
-   struct framephy_struct *fp = mp->free_fp_list;
+   if (mp == NULL || fpn >= (addr_t)mp->rmap_sz)
+      return 0;
    
-   while (fp != NULL)
-   {
-      if (fp->fpn == fpn)
-         return 1; /* Frame is free */
-      fp = fp->fp_next;
-   }
-   
-   return 0; /* Frame is not free */
+   if (fpn >= (addr_t)mp->free_next || mp->rmap[fpn].fstk != 0)
+      return 1;
+   if (mp->bd_free == 0)
+      return 0;
+
+   int order;
+   return MEMPHY_bd_find(mp, (int)fpn, &order) >= 0;
 }
 
 /*
@@ -513,23 +1490,30 @@ int MEMPHY_validate(struct memphy_struct *mp)
       return -1;
    }
    
-   if (mp->storage == NULL)
+   if (mp->chunk == NULL)
    {
       printf("MEMPHY_validate: NULL storage\n");
       return -1;
    }
    
-   if (mp->maxsz <= 0)
+   if (mp->maxsz == 0)
    {
-      printf("MEMPHY_validate: Invalid max size: %d\n", mp->maxsz);
+      printf("MEMPHY_validate: Invalid max size: %llu\n", (unsigned long long)mp->maxsz);
       return -1;
    }
    
-   /* Count frames and check for duplicates */
-   int free_count = MEMPHY_get_frame_count(mp->free_fp_list);
-   int used_count = MEMPHY_get_frame_count(mp->used_fp_list);
+   /* Count frames and check the free stack */
+   int free_count = mp->free_top + mp->bd_free + (mp->rmap_sz - mp->free_next);
+   int used_count = mp->used_cnt;
    int total_frames = mp->maxsz / PAGING_PAGESZ;
    
+   if (free_count != mp->free_cnt)
+   {
+      printf("MEMPHY_validate: Free count mismatch (stacked: %d, buddy: %d, fresh: %d, count: %d)\n",
+             mp->free_top, mp->bd_free, mp->rmap_sz - mp->free_next, mp->free_cnt);
+      return -1;
+   }
+   
    if (free_count + used_count > total_frames)
    {
       printf("MEMPHY_validate: Frame count mismatch (free: %d, used: %d, total: %d)\n",
@@ -549,32 +1533,43 @@ int MEMPHY_cleanup(struct memphy_struct *mp)
    if (mp == NULL)
       return -1;
    
-   /* Free storage */
-   if (mp->storage != NULL)
+   /* Detach the host file */
+   if (mp->map != NULL)
    {
-      free(mp->storage);
-      mp->storage = NULL;
+      munmap(mp->map, mp->maxsz);
+      mp->map = NULL;
    }
-   
-   /* Free all nodes in free list */
-   struct framephy_struct *fp = mp->free_fp_list;
-   while (fp != NULL)
+   if (mp->fd >= 0)
    {
-      struct framephy_struct *next = fp->fp_next;
-      free(fp);
-      fp = next;
+      close(mp->fd);
+      mp->fd = -1;
    }
-   mp->free_fp_list = NULL;
-   
-   /* Free all nodes in used list */
-   fp = mp->used_fp_list;
-   while (fp != NULL)
+   free(mp->bounce);
+   mp->bounce = NULL;
+
+   /* Free storage */
+   if (mp->chunk != NULL)
    {
-      struct framephy_struct *next = fp->fp_next;
-      free(fp);
-      fp = next;
+      for (int i = 0; i < mp->nchunk; i++)
+         free(mp->chunk[i]);
+      free(mp->chunk);
+      mp->chunk = NULL;
+      mp->nchunk = 0;
+      mp->nchunk_live = 0;
    }
-   mp->used_fp_list = NULL;
+   
+   /* Free the free stack */
+   free(mp->free_stk);
+   mp->free_stk = NULL;
+   mp->free_top = 0;
+   mp->free_next = 0;
+   mp->free_cnt = 0;
+   mp->used_cnt = 0;
+
+   /* Free frame table */
+   free(mp->rmap);
+   mp->rmap = NULL;
+   mp->rmap_sz = 0;
    
    return 0;
 }
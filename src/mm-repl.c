@@ -0,0 +1,844 @@
+/*
+ * Copyright (C) 2026 pdnguyen of HCMC University of Technology VNU-HCM
+ */
+
+/* LamiaAtrium release
+ * Source Code License Grant: The authors hereby grant to Licensee
+ * personal permission to use and modify the Licensed Source Code
+ * for the sole purpose of studying while attending the course CO2018.
+ */
+
+/*
+ * PAGING based Memory Management
+ * Page replacement module mm/mm-repl.c
+ *
+ * Every mm_struct tracks its resident pages in a pgrepl_struct. The
+ * policy is picked once per mm (kernel parameter pgrepl=) and plugged
+ * in as a table of operations:
+ *
+ *   FIFO  - queue with head/tail, O(1) insert and victim
+ *   CLOCK - circular list with a hand, second chance on the ref bit
+ *   LRU   - aging registers (ref bit shifted in at each victim scan)
+ *   LFU   - min heap ordered by (reference count, load order)
+ *   ARC   - T1/T2 resident lists with B1/B2 ghost lists
+ *
+ * A (mm, pgn) -> node hash gives the O(1) lookup used on every
+ * reference. In global scope all the mm share one state, so the policy
+ * orders the resident pages of every process together.
+ */
+
+#include "mm.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* ARC list identifiers, other policies only use list 0 */
+#define ARC_T1 0
+#define ARC_T2 1
+#define ARC_B1 2
+#define ARC_B2 3
+#define PGREPL_NRLIST 4
+
+#define PGREPL_HASH_INITSZ 64
+
+struct pgrepl_node {
+  struct mm_struct *mm;       /* owner of the page */
+  addr_t pgn;
+  struct pgrepl_node *prev;   /* policy list links */
+  struct pgrepl_node *next;
+  struct pgrepl_node *hnext;  /* pgn hash chain */
+
+  int list;                   /* list the node sits on */
+  int ref;                    /* reference bit */
+  uint8_t age;                /* LRU aging register */
+  unsigned long freq;         /* LFU reference count */
+  unsigned long seq;          /* load order, LFU tie break */
+  int heapidx;                /* LFU heap slot */
+};
+
+struct pgrepl_list {
+  struct pgrepl_node *head;   /* oldest */
+  struct pgrepl_node *tail;   /* newest */
+  int len;
+};
+
+struct pgrepl_ops {
+  const char *name;
+  int (*insert)(struct pgrepl_struct *st, struct pgrepl_node *node);
+  int (*access)(struct pgrepl_struct *st, struct pgrepl_node *node);
+  struct pgrepl_node *(*victim)(struct pgrepl_struct *st);
+  int (*remove)(struct pgrepl_struct *st, struct pgrepl_node *node);
+};
+
+struct pgrepl_struct {
+  const struct pgrepl_ops *ops;
+
+  /* pgn -> node, holds resident nodes and ARC ghosts */
+  struct pgrepl_node **htbl;
+  int hsize;
+  int hcount;
+
+  struct pgrepl_list lst[PGREPL_NRLIST];
+  struct pgrepl_node *hand;   /* CLOCK hand */
+
+  struct pgrepl_node **heap;  /* LFU heap */
+  int heapsz;
+  int heapcap;
+
+  int arc_p;                  /* ARC target size of T1 */
+  unsigned long seq;
+  int shared;                 /* global scope, kept when a mm leaves */
+};
+
+/*
+ * Hash table of tracked pages
+ */
+static unsigned int pgrepl_hash(struct pgrepl_struct *st, struct mm_struct *mm, addr_t pgn)
+{
+  unsigned long key = (unsigned long)pgn ^ ((unsigned long)mm >> 4);
+
+  return (unsigned int)((key * 2654435761UL) & (st->hsize - 1));
+}
+
+static struct pgrepl_node *pgrepl_lookup(struct pgrepl_struct *st, struct mm_struct *mm, addr_t pgn)
+{
+  struct pgrepl_node *node = st->htbl[pgrepl_hash(st, mm, pgn)];
+
+  while (node != NULL && (node->pgn != pgn || node->mm != mm))
+    node = node->hnext;
+
+  return node;
+}
+
+static int pgrepl_hash_grow(struct pgrepl_struct *st)
+{
+  int oldsz = st->hsize;
+  struct pgrepl_node **oldtbl = st->htbl;
+  struct pgrepl_node **newtbl = calloc(oldsz * 2, sizeof(struct pgrepl_node *));
+  int i;
+
+  if (newtbl == NULL)
+    return -1;
+
+  st->htbl = newtbl;
+  st->hsize = oldsz * 2;
+  for (i = 0; i < oldsz; i++)
+  {
+    struct pgrepl_node *node = oldtbl[i];
+    while (node != NULL)
+    {
+      struct pgrepl_node *next = node->hnext;
+      unsigned int h = pgrepl_hash(st, node->mm, node->pgn);
+      node->hnext = st->htbl[h];
+      st->htbl[h] = node;
+      node = next;
+    }
+  }
+  free(oldtbl);
+
+  return 0;
+}
+
+static int pgrepl_hash_add(struct pgrepl_struct *st, struct pgrepl_node *node)
+{
+  unsigned int h;
+
+  if (st->hcount >= st->hsize)
+    pgrepl_hash_grow(st);
+
+  h = pgrepl_hash(st, node->mm, node->pgn);
+  node->hnext = st->htbl[h];
+  st->htbl[h] = node;
+  st->hcount++;
+
+  return 0;
+}
+
+static int pgrepl_hash_del(struct pgrepl_struct *st, struct pgrepl_node *node)
+{
+  struct pgrepl_node **pp = &st->htbl[pgrepl_hash(st, node->mm, node->pgn)];
+
+  while (*pp != NULL && *pp != node)
+    pp = &(*pp)->hnext;
+
+  if (*pp == NULL)
+    return -1;
+
+  *pp = node->hnext;
+  st->hcount--;
+
+  return 0;
+}
+
+/*
+ * Doubly linked policy lists
+ */
+static void list_add_tail(struct pgrepl_struct *st, int lid, struct pgrepl_node *node)
+{
+  struct pgrepl_list *l = &st->lst[lid];
+
+  node->list = lid;
+  node->next = NULL;
+  node->prev = l->tail;
+  if (l->tail != NULL)
+    l->tail->next = node;
+  else
+    l->head = node;
+  l->tail = node;
+  l->len++;
+}
+
+static void list_del(struct pgrepl_struct *st, struct pgrepl_node *node)
+{
+  struct pgrepl_list *l = &st->lst[node->list];
+
+  if (node->prev != NULL)
+    node->prev->next = node->next;
+  else
+    l->head = node->next;
+
+  if (node->next != NULL)
+    node->next->prev = node->prev;
+  else
+    l->tail = node->prev;
+
+  node->prev = node->next = NULL;
+  l->len--;
+}
+
+/* Drop a node from the hash and release it */
+static void pgrepl_drop(struct pgrepl_struct *st, struct pgrepl_node *node)
+{
+  pgrepl_hash_del(st, node);
+  free(node);
+}
+
+/*
+ * FIFO - oldest loaded page goes first
+ */
+static int fifo_insert(struct pgrepl_struct *st, struct pgrepl_node *node)
+{
+  list_add_tail(st, 0, node);
+  return 0;
+}
+
+static int fifo_access(struct pgrepl_struct *st, struct pgrepl_node *node)
+{
+  return 0;
+}
+
+static struct pgrepl_node *fifo_victim(struct pgrepl_struct *st)
+{
+  struct pgrepl_node *node = st->lst[0].head;
+
+  if (node != NULL)
+    list_del(st, node);
+
+  return node;
+}
+
+static int fifo_remove(struct pgrepl_struct *st, struct pgrepl_node *node)
+{
+  list_del(st, node);
+  pgrepl_drop(st, node);
+  return 0;
+}
+
+/*
+ * CLOCK - the list is a ring walked by the hand, new pages enter just
+ *         behind the hand so they are examined last
+ */
+static int clock_insert(struct pgrepl_struct *st, struct pgrepl_node *node)
+{
+  struct pgrepl_list *l = &st->lst[0];
+
+  node->ref = 1;
+  if (st->hand == NULL || st->hand == l->head)
+  {
+    list_add_tail(st, 0, node);
+    return 0;
+  }
+
+  /* Link before the hand */
+  node->list = 0;
+  node->next = st->hand;
+  node->prev = st->hand->prev;
+  st->hand->prev->next = node;
+  st->hand->prev = node;
+  l->len++;
+
+  return 0;
+}
+
+static int clock_access(struct pgrepl_struct *st, struct pgrepl_node *node)
+{
+  node->ref = 1;
+  return 0;
+}
+
+static struct pgrepl_node *clock_advance(struct pgrepl_struct *st, struct pgrepl_node *node)
+{
+  return (node->next != NULL) ? node->next : st->lst[0].head;
+}
+
+static struct pgrepl_node *clock_victim(struct pgrepl_struct *st)
+{
+  struct pgrepl_node *node;
+
+  if (st->lst[0].head == NULL)
+    return NULL;
+
+  if (st->hand == NULL)
+    st->hand = st->lst[0].head;
+
+  /* Terminates within two rounds since every pass clears a bit */
+  while (st->hand->ref)
+  {
+    st->hand->ref = 0;
+    st->hand = clock_advance(st, st->hand);
+  }
+
+  node = st->hand;
+  st->hand = (st->lst[0].len > 1) ? clock_advance(st, node) : NULL;
+  list_del(st, node);
+
+  return node;
+}
+
+static int clock_remove(struct pgrepl_struct *st, struct pgrepl_node *node)
+{
+  if (st->hand == node)
+    st->hand = (st->lst[0].len > 1) ? clock_advance(st, node) : NULL;
+
+  list_del(st, node);
+  pgrepl_drop(st, node);
+  return 0;
+}
+
+/*
+ * LRU approximation - each victim scan shifts the reference bit into
+ *                     an 8 bit age register and takes the lowest one,
+ *                     the older page wins ties
+ */
+static int lru_insert(struct pgrepl_struct *st, struct pgrepl_node *node)
+{
+  node->ref = 1;
+  node->age = 0;
+  list_add_tail(st, 0, node);
+  return 0;
+}
+
+static struct pgrepl_node *lru_victim(struct pgrepl_struct *st)
+{
+  struct pgrepl_node *node = st->lst[0].head;
+  struct pgrepl_node *vic = NULL;
+
+  if (node == NULL)
+    return NULL;
+
+  for (; node != NULL; node = node->next)
+  {
+    node->age = (node->age >> 1) | (node->ref ? 0x80 : 0);
+    node->ref = 0;
+    if (vic == NULL || node->age < vic->age)
+      vic = node;
+  }
+
+  list_del(st, vic);
+
+  return vic;
+}
+
+/*
+ * LFU - binary min heap on (freq, seq)
+ */
+static int lfu_less(struct pgrepl_node *a, struct pgrepl_node *b)
+{
+  if (a->freq != b->freq)
+    return a->freq < b->freq;
+  return a->seq < b->seq;
+}
+
+static void lfu_swap(struct pgrepl_struct *st, int i, int j)
+{
+  struct pgrepl_node *tmp = st->heap[i];
+
+  st->heap[i] = st->heap[j];
+  st->heap[j] = tmp;
+  st->heap[i]->heapidx = i;
+  st->heap[j]->heapidx = j;
+}
+
+static void lfu_sift_up(struct pgrepl_struct *st, int i)
+{
+  while (i > 0 && lfu_less(st->heap[i], st->heap[(i - 1) / 2]))
+  {
+    lfu_swap(st, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static void lfu_sift_down(struct pgrepl_struct *st, int i)
+{
+  for (;;)
+  {
+    int l = 2 * i + 1, r = l + 1, min = i;
+
+    if (l < st->heapsz && lfu_less(st->heap[l], st->heap[min]))
+      min = l;
+    if (r < st->heapsz && lfu_less(st->heap[r], st->heap[min]))
+      min = r;
+    if (min == i)
+      break;
+    lfu_swap(st, i, min);
+    i = min;
+  }
+}
+
+static void lfu_heap_del(struct pgrepl_struct *st, int i)
+{
+  st->heapsz--;
+  if (i == st->heapsz)
+    return;
+
+  st->heap[i] = st->heap[st->heapsz];
+  st->heap[i]->heapidx = i;
+  lfu_sift_down(st, i);
+  lfu_sift_up(st, i);
+}
+
+static int lfu_insert(struct pgrepl_struct *st, struct pgrepl_node *node)
+{
+  if (st->heapsz == st->heapcap)
+  {
+    int newcap = (st->heapcap > 0) ? st->heapcap * 2 : PGREPL_HASH_INITSZ;
+    struct pgrepl_node **newheap = realloc(st->heap, newcap * sizeof(struct pgrepl_node *));
+    if (newheap == NULL)
+      return -1;
+    st->heap = newheap;
+    st->heapcap = newcap;
+  }
+
+  node->freq = 1;
+  node->heapidx = st->heapsz;
+  st->heap[st->heapsz++] = node;
+  lfu_sift_up(st, node->heapidx);
+
+  return 0;
+}
+
+static int lfu_access(struct pgrepl_struct *st, struct pgrepl_node *node)
+{
+  node->freq++;
+  lfu_sift_down(st, node->heapidx);
+  return 0;
+}
+
+static struct pgrepl_node *lfu_victim(struct pgrepl_struct *st)
+{
+  struct pgrepl_node *node;
+
+  if (st->heapsz == 0)
+    return NULL;
+
+  node = st->heap[0];
+  lfu_heap_del(st, 0);
+
+  return node;
+}
+
+static int lfu_remove(struct pgrepl_struct *st, struct pgrepl_node *node)
+{
+  lfu_heap_del(st, node->heapidx);
+  pgrepl_drop(st, node);
+  return 0;
+}
+
+/*
+ * ARC - T1 holds pages seen once, T2 pages seen again, B1/B2 remember
+ *       the pgn of pages recently evicted from T1/T2. A hit on a ghost
+ *       moves the target size p of T1 toward the list that would have
+ *       kept the page. The cache size c is the resident set of the mm.
+ *       p is adapted when the missed page is inserted, after the victim
+ *       has already been chosen.
+ */
+static int arc_resident(struct pgrepl_struct *st)
+{
+  return st->lst[ARC_T1].len + st->lst[ARC_T2].len;
+}
+
+static void arc_trim_ghosts(struct pgrepl_struct *st)
+{
+  int c = arc_resident(st);
+
+  while (st->lst[ARC_B1].len > 0 && st->lst[ARC_T1].len + st->lst[ARC_B1].len > c)
+  {
+    struct pgrepl_node *ghost = st->lst[ARC_B1].head;
+    list_del(st, ghost);
+    pgrepl_drop(st, ghost);
+  }
+
+  while (st->lst[ARC_B2].len > 0 && c + st->lst[ARC_B1].len + st->lst[ARC_B2].len > 2 * c)
+  {
+    struct pgrepl_node *ghost = st->lst[ARC_B2].head;
+    list_del(st, ghost);
+    pgrepl_drop(st, ghost);
+  }
+}
+
+static int arc_insert(struct pgrepl_struct *st, struct pgrepl_node *node)
+{
+  list_add_tail(st, ARC_T1, node);
+  arc_trim_ghosts(st);
+  return 0;
+}
+
+static int arc_access(struct pgrepl_struct *st, struct pgrepl_node *node)
+{
+  list_del(st, node);
+  list_add_tail(st, ARC_T2, node);
+  return 0;
+}
+
+/* The victim stays in the hash as a ghost, it is not released */
+static struct pgrepl_node *arc_victim(struct pgrepl_struct *st)
+{
+  struct pgrepl_node *node;
+  int ghost;
+
+  if (arc_resident(st) == 0)
+    return NULL;
+
+  if (st->lst[ARC_T1].len > 0 &&
+      (st->lst[ARC_T1].len > st->arc_p || st->lst[ARC_T2].len == 0))
+  {
+    node = st->lst[ARC_T1].head;
+    ghost = ARC_B1;
+  }
+  else
+  {
+    node = st->lst[ARC_T2].head;
+    ghost = ARC_B2;
+  }
+
+  list_del(st, node);
+  list_add_tail(st, ghost, node);
+
+  return node;
+}
+
+static int arc_remove(struct pgrepl_struct *st, struct pgrepl_node *node)
+{
+  list_del(st, node);
+  pgrepl_drop(st, node);
+  return 0;
+}
+
+/* Handle a miss on a page remembered in a ghost list */
+static int arc_ghost_hit(struct pgrepl_struct *st, struct pgrepl_node *node)
+{
+  int b1 = st->lst[ARC_B1].len;
+  int b2 = st->lst[ARC_B2].len;
+  int c = arc_resident(st) + 1;
+
+  if (node->list == ARC_B1)
+  {
+    int delta = (b2 > b1) ? b2 / b1 : 1;
+    st->arc_p = (st->arc_p + delta < c) ? st->arc_p + delta : c;
+  }
+  else
+  {
+    int delta = (b1 > b2) ? b1 / b2 : 1;
+    st->arc_p = (st->arc_p > delta) ? st->arc_p - delta : 0;
+  }
+
+  list_del(st, node);
+  list_add_tail(st, ARC_T2, node);
+  arc_trim_ghosts(st);
+
+  return 0;
+}
+
+static const struct pgrepl_ops pgrepl_ops_tbl[PGREPL_NR] = {
+  [PGREPL_FIFO]  = { "fifo",  fifo_insert,  fifo_access,  fifo_victim,  fifo_remove },
+  [PGREPL_CLOCK] = { "clock", clock_insert, clock_access, clock_victim, clock_remove },
+  [PGREPL_LRU]   = { "lru",   lru_insert,   clock_access, lru_victim,   fifo_remove },
+  [PGREPL_LFU]   = { "lfu",   lfu_insert,   lfu_access,   lfu_victim,   lfu_remove },
+  [PGREPL_ARC]   = { "arc",   arc_insert,   arc_access,   arc_victim,   arc_remove },
+};
+
+static int pgrepl_is_resident(struct pgrepl_struct *st, struct pgrepl_node *node)
+{
+  return st->ops != &pgrepl_ops_tbl[PGREPL_ARC] ||
+         node->list == ARC_T1 || node->list == ARC_T2;
+}
+
+/*
+ * pgrepl_policy_by_name - parse a policy name
+ * @name: policy name (fifo, clock, lru, lfu, arc)
+ */
+int pgrepl_policy_by_name(const char *name)
+{
+  int i;
+
+  for (i = 0; i < PGREPL_NR; i++)
+    if (strcmp(pgrepl_ops_tbl[i].name, name) == 0)
+      return i;
+
+  return -1;
+}
+
+const char *pgrepl_policy_name(int policy)
+{
+  if (policy < 0 || policy >= PGREPL_NR)
+    return "unknown";
+  return pgrepl_ops_tbl[policy].name;
+}
+
+/*
+ * pgrepl_init - attach a replacement state to a mm
+ * @mm: memory management struct
+ * @policy: PGREPL_* policy
+ * @shared: state of global scope, created on first use, or NULL for an
+ *          empty state of the mm alone
+ */
+int pgrepl_init(struct mm_struct *mm, int policy, struct pgrepl_struct **shared)
+{
+  struct pgrepl_struct *st;
+
+  if (policy < 0 || policy >= PGREPL_NR)
+    return -1;
+
+  if (shared != NULL && *shared != NULL)
+  {
+    mm->pgrepl = *shared;
+    return 0;
+  }
+
+  st = calloc(1, sizeof(struct pgrepl_struct));
+  if (st == NULL)
+    return -1;
+
+  st->htbl = calloc(PGREPL_HASH_INITSZ, sizeof(struct pgrepl_node *));
+  if (st->htbl == NULL)
+  {
+    free(st);
+    return -1;
+  }
+  st->hsize = PGREPL_HASH_INITSZ;
+  st->ops = &pgrepl_ops_tbl[policy];
+  mm->pgrepl = st;
+
+  if (shared != NULL)
+  {
+    st->shared = 1;
+    *shared = st;
+  }
+
+  return 0;
+}
+
+/*
+ * pgrepl_release - free the replacement state of a mm
+ * @mm: memory management struct
+ *
+ * A shared state only loses the pages of mm, the other processes keep
+ * using it.
+ */
+int pgrepl_release(struct mm_struct *mm)
+{
+  struct pgrepl_struct *st = mm->pgrepl;
+  int i;
+
+  if (st == NULL)
+    return -1;
+
+  if (st->shared)
+  {
+    for (i = 0; i < st->hsize; i++)
+    {
+      struct pgrepl_node *node = st->htbl[i];
+      while (node != NULL)
+      {
+        struct pgrepl_node *next = node->hnext;
+        if (node->mm == mm)
+        {
+          if (pgrepl_is_resident(st, node))
+            st->ops->remove(st, node);
+          else
+          {
+            list_del(st, node);
+            pgrepl_drop(st, node);
+          }
+        }
+        node = next;
+      }
+    }
+    mm->pgrepl = NULL;
+    return 0;
+  }
+
+  for (i = 0; i < st->hsize; i++)
+  {
+    struct pgrepl_node *node = st->htbl[i];
+    while (node != NULL)
+    {
+      struct pgrepl_node *next = node->hnext;
+      free(node);
+      node = next;
+    }
+  }
+
+  free(st->htbl);
+  free(st->heap);
+  free(st);
+  mm->pgrepl = NULL;
+
+  return 0;
+}
+
+/*
+ * pgrepl_insert - a page has been loaded in MEMRAM
+ * @mm: memory management struct
+ * @pgn: page number
+ */
+int pgrepl_insert(struct mm_struct *mm, addr_t pgn)
+{
+  struct pgrepl_struct *st = mm->pgrepl;
+  struct pgrepl_node *node;
+
+  if (st == NULL)
+    return -1;
+
+  node = pgrepl_lookup(st, mm, pgn);
+  if (node != NULL)
+  {
+    if (pgrepl_is_resident(st, node))
+      return 0; /* Already tracked */
+    return arc_ghost_hit(st, node);
+  }
+
+  node = calloc(1, sizeof(struct pgrepl_node));
+  if (node == NULL)
+    return -1;
+
+  node->mm = mm;
+  node->pgn = pgn;
+  node->seq = st->seq++;
+  pgrepl_hash_add(st, node);
+
+  if (st->ops->insert(st, node) < 0)
+  {
+    pgrepl_drop(st, node);
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * pgrepl_access - a resident page has been referenced
+ * @mm: memory management struct
+ * @pgn: page number
+ */
+int pgrepl_access(struct mm_struct *mm, addr_t pgn)
+{
+  struct pgrepl_struct *st = mm->pgrepl;
+  struct pgrepl_node *node;
+
+  if (st == NULL)
+    return -1;
+
+  node = pgrepl_lookup(st, mm, pgn);
+  if (node == NULL || !pgrepl_is_resident(st, node))
+    return -1;
+
+  return st->ops->access(st, node);
+}
+
+/*
+ * pgrepl_remove - stop tracking a page that left MEMRAM without being
+ *                 chosen as victim (unmap, release)
+ * @mm: memory management struct
+ * @pgn: page number
+ */
+int pgrepl_remove(struct mm_struct *mm, addr_t pgn)
+{
+  struct pgrepl_struct *st = mm->pgrepl;
+  struct pgrepl_node *node;
+
+  if (st == NULL)
+    return -1;
+
+  node = pgrepl_lookup(st, mm, pgn);
+  if (node == NULL)
+    return -1;
+
+  return st->ops->remove(st, node);
+}
+
+/*
+ * pgrepl_for_each - call fn on every resident page of a mm
+ * @mm: memory management struct
+ * @fn: callback, a non zero return stops the walk
+ * @arg: callback argument
+ */
+int pgrepl_for_each(struct mm_struct *mm, int (*fn)(addr_t pgn, void *arg), void *arg)
+{
+  struct pgrepl_struct *st = mm->pgrepl;
+  int i, ret;
+
+  if (st == NULL)
+    return -1;
+
+  for (i = 0; i < st->hsize; i++)
+  {
+    struct pgrepl_node *node;
+    for (node = st->htbl[i]; node != NULL; node = node->hnext)
+    {
+      if (node->mm != mm || !pgrepl_is_resident(st, node))
+        continue;
+      if ((ret = fn(node->pgn, arg)) != 0)
+        return ret;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * pgrepl_victim - pick a victim page and stop tracking it
+ * @st: replacement state
+ * @retmm: return the owner of the page
+ * @retpgn: return page number
+ */
+int pgrepl_victim(struct pgrepl_struct *st, struct mm_struct **retmm, addr_t *retpgn)
+{
+  struct pgrepl_node *node;
+
+  if (st == NULL || (node = st->ops->victim(st)) == NULL)
+    return -1;
+
+  *retmm = node->mm;
+  *retpgn = node->pgn;
+
+  /* An ARC victim is kept as a ghost */
+  if (pgrepl_is_resident(st, node))
+    pgrepl_drop(st, node);
+
+  return 0;
+}
+
+/*find_victim_page - find victim page
+ *@mm: memory region
+ *@retpgn: return page number
+ *
+ */
+int find_victim_page(struct mm_struct *mm, addr_t *retpgn)
+{
+  struct mm_struct *owner;
+
+  if (mm == NULL || mm->pgrepl == NULL || mm->pgrepl->shared)
+    return -1;
+
+  return pgrepl_victim(mm->pgrepl, &owner, retpgn);
+}
@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2026 pdnguyen of HCMC University of Technology VNU-HCM
+ */
+
+/* LamiaAtrium release
+ * Source Code License Grant: The authors hereby grant to Licensee
+ * personal permission to use and modify the Licensed Source Code
+ * for the sole purpose of studying while attending the course CO2018.
+ */
+
+/*
+ * PAGING based Memory Management
+ * Object caches for MM metadata mm/mm-slab.c
+ *
+ * vm_rg_struct nodes, churned by every region alloc and free, come from
+ * typed caches instead of malloc/free. Each cache carves slabs of KMEM_SLAB_OBJS
+ * objects and keeps free objects in a shared depot. Every CPU thread
+ * holds a magazine of free objects per cache, so the common alloc and
+ * free touch no lock; a magazine is refilled from or flushed to the
+ * depot half a magazine at a time. Slabs are never given back.
+ */
+
+#include "mm.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define KMEM_MAG_SZ 32
+#define KMEM_SLAB_OBJS 64
+
+struct kmem_obj {
+  struct kmem_obj *next;
+};
+
+struct kmem_cache {
+  const char *name;
+  size_t objsz;
+  pthread_mutex_t lock;
+  struct kmem_obj *depot;   /* free objects shared by all CPUs */
+  unsigned long nslab;
+  unsigned long alloc;
+  unsigned long free;
+};
+
+struct kmem_magazine {
+  int n;
+  unsigned long alloc;  /* not yet folded into the cache counters */
+  unsigned long free;
+  void *obj[KMEM_MAG_SZ];
+};
+
+#define KMEM_CACHE(nm, type) \
+  { nm, (sizeof(type) + 15) & ~(size_t)15, PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0 }
+
+static struct kmem_cache kmem_caches[KMEM_NR] = {
+  [KMEM_VM_RG] = KMEM_CACHE("vm_rg", struct vm_rg_struct),
+};
+
+static __thread struct kmem_magazine kmem_mag[KMEM_NR];
+static __thread int kmem_mag_live;
+
+static pthread_once_t kmem_once = PTHREAD_ONCE_INIT;
+static pthread_key_t kmem_key;
+
+/* Fold the magazine counters, with the depot lock held */
+static void kmem_mag_fold(struct kmem_cache *c, struct kmem_magazine *mag)
+{
+  c->alloc += mag->alloc;
+  c->free += mag->free;
+  mag->alloc = mag->free = 0;
+}
+
+/* Give the magazines of an exiting CPU thread back to the depots */
+static void kmem_mag_release(void *arg)
+{
+  int id;
+
+  (void)arg;
+  for (id = 0; id < KMEM_NR; id++)
+  {
+    struct kmem_cache *c = &kmem_caches[id];
+    struct kmem_magazine *mag = &kmem_mag[id];
+
+    pthread_mutex_lock(&c->lock);
+    kmem_mag_fold(c, mag);
+    while (mag->n > 0)
+    {
+      struct kmem_obj *o = mag->obj[--mag->n];
+      o->next = c->depot;
+      c->depot = o;
+    }
+    pthread_mutex_unlock(&c->lock);
+  }
+}
+
+static void kmem_key_init(void)
+{
+  pthread_key_create(&kmem_key, kmem_mag_release);
+}
+
+static void kmem_mag_attach(void)
+{
+  pthread_once(&kmem_once, kmem_key_init);
+  pthread_setspecific(kmem_key, (void *)1);
+  kmem_mag_live = 1;
+}
+
+/* Move up to half a magazine from the depot, carving a slab if needed */
+static void kmem_mag_refill(struct kmem_cache *c, struct kmem_magazine *mag)
+{
+  pthread_mutex_lock(&c->lock);
+  kmem_mag_fold(c, mag);
+
+  if (c->depot == NULL)
+  {
+    char *slab = malloc(c->objsz * KMEM_SLAB_OBJS);
+    int i;
+
+    if (slab != NULL)
+    {
+      for (i = KMEM_SLAB_OBJS - 1; i >= 0; i--)
+      {
+        struct kmem_obj *o = (struct kmem_obj *)(slab + i * c->objsz);
+        o->next = c->depot;
+        c->depot = o;
+      }
+      c->nslab++;
+    }
+  }
+
+  while (mag->n < KMEM_MAG_SZ / 2 && c->depot != NULL)
+  {
+    mag->obj[mag->n++] = c->depot;
+    c->depot = c->depot->next;
+  }
+
+  pthread_mutex_unlock(&c->lock);
+}
+
+static void kmem_mag_flush(struct kmem_cache *c, struct kmem_magazine *mag)
+{
+  pthread_mutex_lock(&c->lock);
+  kmem_mag_fold(c, mag);
+  while (mag->n > KMEM_MAG_SZ / 2)
+  {
+    struct kmem_obj *o = mag->obj[--mag->n];
+    o->next = c->depot;
+    c->depot = o;
+  }
+  pthread_mutex_unlock(&c->lock);
+}
+
+/*
+ * kmem_cache_alloc - Get an object from a cache
+ * @id: cache id (KMEM_VM_RG)
+ *
+ * The object content is undefined, like malloc.
+ */
+void *kmem_cache_alloc(int id)
+{
+  struct kmem_cache *c = &kmem_caches[id];
+  struct kmem_magazine *mag = &kmem_mag[id];
+
+  if (!kmem_mag_live)
+    kmem_mag_attach();
+
+  if (mag->n == 0)
+  {
+    kmem_mag_refill(c, mag);
+    if (mag->n == 0)
+      return NULL;
+  }
+
+  mag->alloc++;
+  return mag->obj[--mag->n];
+}
+
+/*
+ * kmem_cache_free - Return an object to a cache
+ * @id: cache id
+ * @obj: object from kmem_cache_alloc(id), NULL is ignored
+ */
+void kmem_cache_free(int id, void *obj)
+{
+  struct kmem_cache *c = &kmem_caches[id];
+  struct kmem_magazine *mag = &kmem_mag[id];
+
+  if (obj == NULL)
+    return;
+
+  if (!kmem_mag_live)
+    kmem_mag_attach();
+
+  if (mag->n == KMEM_MAG_SZ)
+    kmem_mag_flush(c, mag);
+
+  mag->obj[mag->n++] = obj;
+  mag->free++;
+}
+
+/*
+ * kmem_cache_report - Print per cache object and slab counts
+ *
+ * Without the caches every alloc and free was a malloc/free call,
+ * now only a slab carve is. Counts still held in the magazines of
+ * other running CPU threads are not included.
+ */
+int kmem_cache_report(void)
+{
+  int id;
+
+  for (id = 0; id < KMEM_NR; id++)
+  {
+    struct kmem_cache *c = &kmem_caches[id];
+    unsigned long calls;
+
+    pthread_mutex_lock(&c->lock);
+    kmem_mag_fold(c, &kmem_mag[id]);
+    pthread_mutex_unlock(&c->lock);
+    calls = c->alloc + c->free;
+
+    printf("Slab %-8s: %lu allocs, %lu frees, %lu slabs (%lu allocator calls instead of %lu)\n",
+           c->name, c->alloc, c->free, c->nslab, c->nslab, calls);
+  }
+
+  return 0;
+}
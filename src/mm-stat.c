@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2026 pdnguyen of HCMC University of Technology VNU-HCM
+ */
+
+/* LamiaAtrium release
+ * Source Code License Grant: The authors hereby grant to Licensee
+ * personal permission to use and modify the Licensed Source Code
+ * for the sole purpose of studying while attending the course CO2018.
+ */
+
+/*
+ * PAGING based Memory Management
+ * Memory statistics module mm/mm-stat.c
+ */
+
+#include "mm.h"
+#include <stdio.h>
+
+static double mmstat_pct(unsigned long part, unsigned long total)
+{
+  return (total > 0) ? (double)part * 100.0 / total : 0.0;
+}
+
+/*
+ * print_mmstat - print the memory subsystem counters
+ * @krnl: kernel
+ */
+int print_mmstat(struct krnl_t *krnl)
+{
+  struct mmstat_struct *st;
+  int i;
+
+  if (krnl == NULL)
+    return -1;
+
+  st = &krnl->mmstat;
+
+  printf("=== MM Statistics ===\n");
+  printf("Replacement Policy: %s (%s)\n", pgrepl_policy_name(krnl->mmparam.pgrepl),
+         krnl->mmparam.pgscope == PGSCOPE_GLOBAL ? "global" : "local");
+  printf("References: %lu\n", st->access);
+  printf("Page Faults: %lu (%.2f%%)\n", st->pgfault, mmstat_pct(st->pgfault, st->access));
+  printf("Evictions: %lu (%lu from other processes)\n", st->evict, st->steal);
+  printf("Swap-ins: %lu\n", st->swapin);
+  printf("Swap-outs: %lu (%lu bytes saved by swap cache)\n", st->swpout, st->swpsaved);
+  printf("Contiguous Swap Placements: %lu\n", st->swpcontig);
+  if (krnl->mmparam.swapra > 1)
+    printf("Readahead: %lu pages (%lu useful, %lu wasted)\n",
+           st->ra, st->ra_hit, st->ra_waste);
+  if (krnl->mmparam.zswap > 0)
+    printf("Compressed Swap: %lu stored (%lu same-filled), %lu rejected, %lu loaded, %lu bytes saved\n",
+           st->zswap_store, st->zswap_same, st->zswap_reject, st->zswap_load, st->zswap_saved);
+  if (krnl->mmparam.kswapd)
+    printf("Background Evictions: %lu (%lu daemon wakeups, %lu in the fault path)\n",
+           st->kswapd_evict, st->kswapd_wake, st->evict - st->kswapd_evict);
+  printf("Swap Frames per Device:");
+  for (i = 0; i < PAGING_MAX_MMSWP; i++)
+    printf(" %lu", st->swpdev[i]);
+  printf("\n");
+  printf("Backing Storage Touched (KB): %lu RAM,", MEMPHY_touched_kb(krnl->mram));
+  for (i = 0; i < PAGING_MAX_MMSWP; i++)
+    printf(" %lu", krnl->mswp ? MEMPHY_touched_kb(krnl->mswp[i]) : 0);
+  printf(" swap\n");
+  if (krnl->mram->busy_ns > 0 || st->io_stall > 0)
+  {
+    printf("Device Time (us): %llu RAM,", (unsigned long long)krnl->mram->busy_ns / 1000);
+    for (i = 0; i < PAGING_MAX_MMSWP; i++)
+      printf(" %llu", krnl->mswp ? (unsigned long long)krnl->mswp[i]->busy_ns / 1000 : 0ULL);
+    printf(" swap, %lu CPU slots stalled\n", st->io_stall);
+  }
+  if (krnl->mmparam.thp)
+    printf("Huge Pages: %lu mapped, %lu fallbacks, %lu split\n",
+           st->thp_map, st->thp_fallback, st->thp_split);
+  MEMPHY_buddy_report(krnl->mram, "MEMRAM");
+  if (st->pt_procs > 0)
+    printf("Page Table Bytes per Process: %lu mean, %lu max\n",
+           st->pt_bytes / st->pt_procs, st->pt_bytes_max);
+  pgtbl_report();
+  kmem_cache_report();
+  printf("=====================\n");
+
+  return 0;
+}
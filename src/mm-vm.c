@@ -19,6 +19,364 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <pthread.h>
+#include <stddef.h>
+
+#ifdef MM64
+#define PAGING_MAX_VA BIT_ULL(21) /* keeps PAGING_MAX_PGN low */
+#define VM_MMAP_TOP BIT_ULL(47)   /* mmap areas go down from here */
+#else
+#define PAGING_MAX_VA BIT(PAGING_CPU_BUS_WIDTH)
+#define VM_MMAP_TOP ((addr_t)PAGING_MAX_PGN * PAGING_PAGESZ)
+#endif
+
+struct paging_geom_struct paging_geom = {
+  PAGING_PAGESZ_DEFAULT,
+  PAGING_PAGE_SHIFT_DEFAULT,
+  GENMASK(PAGING_PAGE_SHIFT_DEFAULT - 1, 0),
+  GENMASK(PAGING_ADDR_PGN_HIBIT, PAGING_PAGE_SHIFT_DEFAULT),
+  DIV_ROUND_UP(PAGING_MAX_VA, PAGING_PAGESZ_DEFAULT),
+};
+
+/*paging_set_pagesz - set the page size of the run
+ *@pagesz: page size in bytes, a power of two in
+ *         [PAGING_PAGESZ_MIN, PAGING_PAGESZ_MAX]
+ *
+ * Must be called before any MEMPHY is formatted or mm created.
+ */
+int paging_set_pagesz(addr_t pagesz)
+{
+  int shift = 0;
+
+  if (pagesz < PAGING_PAGESZ_MIN || pagesz > PAGING_PAGESZ_MAX ||
+      (pagesz & (pagesz - 1)) != 0)
+    return -1;
+
+  while (((addr_t)1 << shift) < pagesz)
+    shift++;
+
+  paging_geom.pagesz = pagesz;
+  paging_geom.shift = shift;
+  paging_geom.offst_mask = pagesz - 1;
+  paging_geom.pgn_mask = GENMASK(PAGING_ADDR_PGN_HIBIT, shift);
+  paging_geom.max_pgn = DIV_ROUND_UP(PAGING_MAX_VA, pagesz);
+
+  return 0;
+}
+
+/*
+ * VMA index
+ *
+ * Every area of a mm is linked in two AVL trees, mm->vma_addr keyed by
+ * vm_start and mm->vma_id keyed by vm_id, so an area is found by address
+ * or by ID in O(log n). Start addresses are unique. mm->mmap keeps the
+ * areas in address order for walks and for the neighbour of an area.
+ * Address tree nodes also carry the largest hole below any area of their
+ * subtree, vm_mmap finds the highest hole that fits in O(log n) with it.
+ *
+ * The free regions of an area use the same trees, vm_freerg_addr keyed
+ * by rg_start and vm_freerg_size keyed by size then rg_start.
+ */
+enum vm_avl_kind {
+  VM_AVL_ADDR,    /* vm area by vm_start */
+  VM_AVL_ID,      /* vm area by vm_id */
+  VM_AVL_RG_ADDR, /* free region by rg_start */
+  VM_AVL_RG_SIZE  /* free region by size, then rg_start */
+};
+
+static struct vm_area_struct *vm_avl_entry(struct vm_avl *n, int kind)
+{
+  size_t off = (kind == VM_AVL_ID) ? offsetof(struct vm_area_struct, vm_id_node) :
+                                     offsetof(struct vm_area_struct, vm_addr_node);
+
+  return (struct vm_area_struct *)((char *)n - off);
+}
+
+static struct vm_rg_struct *vm_avl_rg(struct vm_avl *n, int kind)
+{
+  size_t off = (kind == VM_AVL_RG_SIZE) ? offsetof(struct vm_rg_struct, rg_size_node) :
+                                          offsetof(struct vm_rg_struct, rg_addr_node);
+
+  return (struct vm_rg_struct *)((char *)n - off);
+}
+
+static addr_t vm_avl_key(struct vm_avl *n, int kind)
+{
+  struct vm_rg_struct *rg;
+
+  switch (kind)
+  {
+  case VM_AVL_ADDR:
+    return vm_avl_entry(n, kind)->vm_start;
+  case VM_AVL_ID:
+    return (addr_t)vm_avl_entry(n, kind)->vm_id;
+  case VM_AVL_RG_ADDR:
+    return vm_avl_rg(n, kind)->rg_start;
+  default:
+    rg = vm_avl_rg(n, kind);
+    return rg->rg_end - rg->rg_start;
+  }
+}
+
+/* Order of two nodes, regions of one size by address */
+static int vm_avl_cmp(struct vm_avl *a, struct vm_avl *b, int kind)
+{
+  addr_t ka = vm_avl_key(a, kind), kb = vm_avl_key(b, kind);
+
+  if (ka == kb && kind == VM_AVL_RG_SIZE)
+  {
+    ka = vm_avl_rg(a, kind)->rg_start;
+    kb = vm_avl_rg(b, kind)->rg_start;
+  }
+
+  return (ka > kb) - (ka < kb);
+}
+
+static int vm_avl_height(struct vm_avl *n)
+{
+  return (n != NULL) ? n->height : 0;
+}
+
+static void vm_avl_fix(struct vm_avl *n, int kind)
+{
+  int hl = vm_avl_height(n->left), hr = vm_avl_height(n->right);
+
+  n->height = 1 + ((hl > hr) ? hl : hr);
+  if (kind != VM_AVL_ADDR)
+    return;
+
+  n->gap = vm_avl_entry(n, kind)->vm_gap;
+  if (n->left != NULL && n->left->gap > n->gap)
+    n->gap = n->left->gap;
+  if (n->right != NULL && n->right->gap > n->gap)
+    n->gap = n->right->gap;
+}
+
+static struct vm_avl *vm_avl_rotate(struct vm_avl *n, int toright, int kind)
+{
+  struct vm_avl *c = toright ? n->left : n->right;
+
+  if (toright)
+  {
+    n->left = c->right;
+    c->right = n;
+  }
+  else
+  {
+    n->right = c->left;
+    c->left = n;
+  }
+  vm_avl_fix(n, kind);
+  vm_avl_fix(c, kind);
+
+  return c;
+}
+
+/* Restore the height bound at n after one insert or erase below it */
+static struct vm_avl *vm_avl_balance(struct vm_avl *n, int kind)
+{
+  int bf;
+
+  vm_avl_fix(n, kind);
+  bf = vm_avl_height(n->left) - vm_avl_height(n->right);
+
+  if (bf > 1)
+  {
+    if (vm_avl_height(n->left->left) < vm_avl_height(n->left->right))
+      n->left = vm_avl_rotate(n->left, 0, kind);
+    return vm_avl_rotate(n, 1, kind);
+  }
+  if (bf < -1)
+  {
+    if (vm_avl_height(n->right->right) < vm_avl_height(n->right->left))
+      n->right = vm_avl_rotate(n->right, 1, kind);
+    return vm_avl_rotate(n, 0, kind);
+  }
+
+  return n;
+}
+
+static struct vm_avl *vm_avl_insert(struct vm_avl *root, struct vm_avl *node, int kind)
+{
+  if (root == NULL)
+  {
+    node->left = node->right = NULL;
+    vm_avl_fix(node, kind);
+    return node;
+  }
+
+  if (vm_avl_cmp(node, root, kind) < 0)
+    root->left = vm_avl_insert(root->left, node, kind);
+  else
+    root->right = vm_avl_insert(root->right, node, kind);
+
+  return vm_avl_balance(root, kind);
+}
+
+static struct vm_avl *vm_avl_take_min(struct vm_avl *root, struct vm_avl **min, int kind)
+{
+  if (root->left == NULL)
+  {
+    *min = root;
+    return root->right;
+  }
+
+  root->left = vm_avl_take_min(root->left, min, kind);
+  return vm_avl_balance(root, kind);
+}
+
+/* Unlink node, its key must not have changed since the insert */
+static struct vm_avl *vm_avl_erase(struct vm_avl *root, struct vm_avl *node, int kind)
+{
+  int c;
+
+  if (root == NULL)
+    return NULL;
+
+  c = vm_avl_cmp(node, root, kind);
+  if (c < 0)
+    root->left = vm_avl_erase(root->left, node, kind);
+  else if (c > 0)
+    root->right = vm_avl_erase(root->right, node, kind);
+  else
+  {
+    struct vm_avl *min;
+
+    if (root->right == NULL)
+      return root->left;
+
+    root->right = vm_avl_take_min(root->right, &min, kind);
+    min->left = root->left;
+    min->right = root->right;
+    root = min;
+  }
+
+  return vm_avl_balance(root, kind);
+}
+
+/* Recompute the subtree holes on the path down to an address */
+static void vm_avl_refresh(struct vm_avl *n, addr_t key)
+{
+  addr_t k;
+
+  if (n == NULL)
+    return;
+
+  k = vm_avl_key(n, VM_AVL_ADDR);
+  if (key < k)
+    vm_avl_refresh(n->left, key);
+  else if (key > k)
+    vm_avl_refresh(n->right, key);
+  vm_avl_fix(n, VM_AVL_ADDR);
+}
+
+/* Node with the largest key not above key, NULL if none */
+static struct vm_avl *vm_avl_floor(struct vm_avl *n, addr_t key, int kind)
+{
+  struct vm_avl *best = NULL;
+
+  while (n != NULL)
+  {
+    if (vm_avl_key(n, kind) <= key)
+    {
+      best = n;
+      n = n->right;
+    }
+    else
+      n = n->left;
+  }
+
+  return best;
+}
+
+/* First node with a key not below key, NULL if none */
+static struct vm_avl *vm_avl_ceil(struct vm_avl *n, addr_t key, int kind)
+{
+  struct vm_avl *best = NULL;
+
+  while (n != NULL)
+  {
+    if (vm_avl_key(n, kind) >= key)
+    {
+      best = n;
+      n = n->left;
+    }
+    else
+      n = n->right;
+  }
+
+  return best;
+}
+
+/* Area with the largest key not above key, NULL if none */
+static struct vm_area_struct *vma_floor(struct vm_avl *root, addr_t key, int kind)
+{
+  struct vm_avl *n = vm_avl_floor(root, key, kind);
+
+  return (n != NULL) ? vm_avl_entry(n, kind) : NULL;
+}
+
+/* Highest area with a hole of len below it that ends by top, NULL if none */
+static struct vm_area_struct *vm_avl_gap_find(struct vm_avl *n, addr_t len, addr_t top)
+{
+  struct vm_area_struct *vma, *found;
+  addr_t lower, end;
+
+  if (n == NULL || n->gap < len)
+    return NULL;
+
+  vma = vm_avl_entry(n, VM_AVL_ADDR);
+  if (vma->vm_end < top &&
+      (found = vm_avl_gap_find(n->right, len, top)) != NULL)
+    return found;
+
+  lower = vma->vm_start - vma->vm_gap;
+  end = (vma->vm_start < top) ? vma->vm_start : top;
+  if (end >= lower + len)
+    return vma;
+
+  return vm_avl_gap_find(n->left, len, top);
+}
+
+/* Area in front of vma in address order */
+static struct vm_area_struct *vma_prev(struct mm_struct *mm, struct vm_area_struct *vma)
+{
+  if (vma->vm_start == 0)
+    return NULL;
+
+  return vma_floor(mm->vma_addr, vma->vm_start - 1, VM_AVL_ADDR);
+}
+
+/* Set the hole below vma, the first page is never part of one */
+static void vma_set_gap(struct vm_area_struct *vma, struct vm_area_struct *prev)
+{
+  addr_t lower = (prev != NULL && prev->vm_end > PAGING_PAGESZ) ?
+                 prev->vm_end : PAGING_PAGESZ;
+
+  vma->vm_gap = (vma->vm_start > lower) ? vma->vm_start - lower : 0;
+}
+
+/* The end of vma moved, fix the hole above it */
+static void vma_gap_update(struct mm_struct *mm, struct vm_area_struct *vma)
+{
+  if (vma->vm_next == NULL)
+    return;
+
+  vma_set_gap(vma->vm_next, vma);
+  vm_avl_refresh(mm->vma_addr, vma->vm_next->vm_start);
+}
+
+/*vm_mmap_init - empty the area index of a mm
+ *@mm: memory management struct
+ *
+ */
+void vm_mmap_init(struct mm_struct *mm)
+{
+  mm->mmap = NULL;
+  mm->vma_addr = NULL;
+  mm->vma_id = NULL;
+  mm->map_count = 0;
+  mm->vma_next_id = 0;
+}
 
 /*get_vma_by_num - get vm area by numID
  *@mm: memory region
@@ -27,31 +385,94 @@
  */
 struct vm_area_struct *get_vma_by_num(struct mm_struct *mm, int vmaid)
 {
-  struct vm_area_struct *pvma = mm->mmap;
+  struct vm_area_struct *vma;
 
-  if (mm->mmap == NULL)
+  if (vmaid < 0)
     return NULL;
 
-  int vmait = pvma->vm_id;
+  vma = vma_floor(mm->vma_id, vmaid, VM_AVL_ID);
+  return (vma != NULL && vma->vm_id == (unsigned long)vmaid) ? vma : NULL;
+}
 
-  while (vmait < vmaid)
-  {
-    if (pvma == NULL)
-      return NULL;
+/*find_vma - get the vm area holding an address
+ *@mm: memory management struct
+ *@addr: virtual address
+ *
+ */
+struct vm_area_struct *find_vma(struct mm_struct *mm, addr_t addr)
+{
+  struct vm_area_struct *vma = vma_floor(mm->vma_addr, addr, VM_AVL_ADDR);
 
-    pvma = pvma->vm_next;
-    vmait = pvma->vm_id;
-  }
+  return (vma != NULL && addr < vma->vm_end) ? vma : NULL;
+}
 
-  return pvma;
+int __mm_swap_page(struct pcb_t *caller, addr_t vicfpn , int swptyp, addr_t swpfpn)
+{
+    __swap_cp_page(caller->krnl->mram, vicfpn, caller->krnl->mswp[swptyp], swpfpn);
+    return 0;
 }
 
-int __mm_swap_page(struct pcb_t *caller, addr_t vicfpn , addr_t swpfpn)
+int __mm_swap_in_page(struct pcb_t *caller, int swptyp, addr_t swpfpn , addr_t tgtfpn)
 {
-    __swap_cp_page(caller->krnl->mram, vicfpn, caller->krnl->active_mswp, swpfpn);
+    if (swptyp == PAGING_SWPTYP_ZSWAP)
+      return zswap_load(caller->krnl, swpfpn, caller->krnl->mram, tgtfpn);
+
+    __swap_cp_page(caller->krnl->mswp[swptyp], swpfpn, caller->krnl->mram, tgtfpn);
     return 0;
 }
 
+/*mm_swap_alloc - get a free frame from the swap devices
+ *@krnl: kernel
+ *@swptyp: preferred swap device (-1 for none), return the swap device id
+ *@swpfpn: preferred FPN in that device, return the FPN in that device
+ *
+ * The preferred frame is taken when free, it keeps neighbour pages
+ * contiguous in MEMSWP. Otherwise SWPSEL_PRIO fills the devices in id
+ * order, SWPSEL_STRIPE starts one past the device used last. A full
+ * device falls through to the next one; when all are full a frame held
+ * by the swap cache is taken back.
+ */
+int mm_swap_alloc(struct krnl_t *krnl, int *swptyp, addr_t *swpfpn)
+{
+  int start, it, id;
+
+  if (*swptyp >= 0 && *swptyp < PAGING_MAX_MMSWP &&
+      MEMPHY_get_freefp_at(krnl->mswp[*swptyp], *swpfpn) == 0)
+  {
+    id = *swptyp;
+    krnl->mmstat.swpcontig++;
+    goto found;
+  }
+
+  start = (krnl->mmparam.swpsel == SWPSEL_STRIPE) ?
+          (krnl->active_mswp_id + 1) % PAGING_MAX_MMSWP : 0;
+
+  for (it = 0; it < PAGING_MAX_MMSWP; it++)
+  {
+    id = (start + it) % PAGING_MAX_MMSWP;
+    if (MEMPHY_get_freefp(krnl->mswp[id], swpfpn) == 0)
+      break;
+  }
+
+  if (it == PAGING_MAX_MMSWP)
+  {
+    for (id = 0; id < PAGING_MAX_MMSWP; id++)
+      if (MEMPHY_swpcache_steal(krnl->mram, id, swpfpn) == 0)
+        break;
+
+    if (id == PAGING_MAX_MMSWP)
+      return -1; /* All swap devices are full */
+  }
+
+found:
+  krnl->active_mswp = krnl->mswp[id];
+  krnl->active_mswp_id = id;
+  krnl->mmstat.swpdev[id]++;
+  *swptyp = id;
+
+  return 0;
+}
+
 /*get_vm_area_node - get vm area for a number of pages
  *@caller: caller
  *@vmaid: ID vm area to alloc memory region
@@ -72,9 +493,9 @@ struct vm_rg_struct *get_vm_area_node_at_brk(struct pcb_t *caller, int vmaid, ad
   // newrg->rg_start = ...
   // newrg->rg_end = ...
   */
-  struct vm_area_struct *cur_vma = get_vma_by_num(caller->krnl->mm, vmaid);
+  struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
 
-  newrg = malloc(sizeof(struct vm_rg_struct));
+  newrg = kmem_cache_alloc(KMEM_VM_RG);
   newrg->rg_start = cur_vma->sbrk;
   newrg->rg_end = newrg->rg_start + size;
   /* END TODO */
@@ -99,28 +520,23 @@ int validate_overlap_vm_area(struct pcb_t *caller, int vmaid, addr_t vmastart, a
     return -1;
   }
 
-  struct vm_area_struct *vma = caller->krnl->mm->mmap;
-  if (vma == NULL)
+  struct mm_struct *mm = caller->mm;
+  struct vm_area_struct *cur_area = get_vma_by_num(mm, vmaid);
+  if (cur_area == NULL)
   {
     return -1;
   }
 
-  /* TODO validate the planned memory area is not overlapped */
+  /* Areas are disjoint and address ordered, only the neighbours can
+   * overlap the planned range */
+  struct vm_area_struct *prev = vma_prev(mm, cur_area);
+  struct vm_area_struct *next = cur_area->vm_next;
 
-  struct vm_area_struct *cur_area = get_vma_by_num(caller->krnl->mm, vmaid);
-  if (cur_area == NULL)
+  if ((prev != NULL && prev->vm_end > vmastart) ||
+      (next != NULL && next->vm_start < vmaend))
   {
     return -1;
   }
-
-  while (vma != NULL)
-  {
-    if (vma != cur_area && OVERLAP(cur_area->vm_start, cur_area->vm_end, vma->vm_start, vma->vm_end))
-    {
-      return -1;
-    }
-    vma = vma->vm_next;
-  }
   /* End TODO*/
 
   return 0;
@@ -131,38 +547,38 @@ int validate_overlap_vm_area(struct pcb_t *caller, int vmaid, addr_t vmastart, a
  *@vmaid: ID vm area to alloc memory region
  *@inc_sz: increment size
  *
+ * The new pages are mapped zero-filled right away when MEMRAM has their
+ * frames above its low watermark. Otherwise, and with huge pages on
+ * (a mapped page keeps its span from a PMD mapping), the fault maps
+ * each page on its first touch.
  */
 int inc_vma_limit(struct pcb_t *caller, int vmaid, addr_t inc_sz)
 {
-  struct vm_rg_struct * newrg = malloc(sizeof(struct vm_rg_struct));
+  struct vm_rg_struct newrg;
   struct vm_area_struct *cur_vma;
+  struct krnl_t *krnl;
   
   /* Defensive: ensure memory management structures are valid before use */
-  if (caller == NULL || caller->krnl == NULL || caller->krnl->mm == NULL)
-  {
-    free(newrg);
+  if (caller == NULL || caller->mm == NULL)
     return -1;
-  }
 
-  cur_vma = get_vma_by_num(caller->krnl->mm, vmaid);
+  cur_vma = get_vma_by_num(caller->mm, vmaid);
   
   if (cur_vma == NULL)
-  {
-    free(newrg);
     return -1;
-  }
 
   /* Align the size to page size */
   addr_t inc_amt = PAGING_PAGE_ALIGNSZ(inc_sz);
   int incnumpage = inc_amt / PAGING_PAGESZ;
 
-  /* Save old end for mapping */
+  /* Save old end for the rollback */
   addr_t old_sbrk = cur_vma->sbrk;
   addr_t old_end = cur_vma->vm_end;
   
   /* Update the VMA end and sbrk */
   cur_vma->vm_end += inc_amt;
   cur_vma->sbrk += inc_sz; // sbrk increases by actual requested size
+  vma_gap_update(caller->mm, cur_vma);
   
   /* Validate overlap of obtained region */
   if (validate_overlap_vm_area(caller, vmaid, cur_vma->vm_start, cur_vma->vm_end) < 0)
@@ -170,20 +586,15 @@ int inc_vma_limit(struct pcb_t *caller, int vmaid, addr_t inc_sz)
     /* Rollback changes */
     cur_vma->vm_end = old_end;
     cur_vma->sbrk = old_sbrk;
-    free(newrg);
+    vma_gap_update(caller->mm, cur_vma);
     return -1; /* Overlap and failed allocation */
   }
 
-  /* Map the memory to MEMRAM */
-  if (vm_map_ram(caller, old_end, cur_vma->vm_end, 
-                   old_end, incnumpage, newrg) < 0)
-  {
-    /* Rollback changes */
-    cur_vma->vm_end = old_end;
-    cur_vma->sbrk = old_sbrk;
-    free(newrg);
-    return -1; /* Map failed */
-  }
+  /* Map the memory to MEMRAM, a failed map leaves the rest to the fault */
+  krnl = caller->krnl;
+  if (krnl != NULL && krnl->mram != NULL && !krnl->mmparam.thp &&
+      krnl->mram->free_cnt >= incnumpage + krnl->mmparam.wmark_low)
+    vm_map_ram(caller, old_end, cur_vma->vm_end, old_end, incnumpage, &newrg);
 
   return 0;
 }
@@ -207,22 +618,45 @@ struct vm_area_struct *create_vm_area(int vmaid, addr_t vm_start, addr_t vm_end)
   new_vma->vm_end = vm_end;
   new_vma->sbrk = vm_start;
   new_vma->vm_mm = NULL;
-  new_vma->vm_freerg_list = NULL;
   new_vma->vm_next = NULL;
   
-  /* Initialize with a free region covering the entire area */
-  struct vm_rg_struct *init_rg = malloc(sizeof(struct vm_rg_struct));
-  if (init_rg != NULL)
-  {
-    init_rg->rg_start = vm_start;
-    init_rg->rg_end = vm_start; // Initially, no usable area
-    init_rg->rg_next = NULL;
-    new_vma->vm_freerg_list = init_rg;
-  }
+  /* Initially, no usable area */
+  vm_freerg_init(new_vma);
   
   return new_vma;
 }
 
+/* Index vma, already linked in mm->mmap behind prev */
+static void vma_index(struct mm_struct *mm, struct vm_area_struct *vma,
+                      struct vm_area_struct *prev)
+{
+  vma_set_gap(vma, prev);
+  if (vma->vm_next != NULL)
+    vma_set_gap(vma->vm_next, vma);
+  mm->vma_addr = vm_avl_insert(mm->vma_addr, &vma->vm_addr_node, VM_AVL_ADDR);
+  mm->vma_id = vm_avl_insert(mm->vma_id, &vma->vm_id_node, VM_AVL_ID);
+  if (vma->vm_next != NULL)
+    vm_avl_refresh(mm->vma_addr, vma->vm_next->vm_start);
+
+  if (vma->vm_id >= mm->vma_next_id)
+    mm->vma_next_id = vma->vm_id + 1;
+  mm->map_count++;
+}
+
+/* Drop vma from the index, already unlinked from mm->mmap behind prev */
+static void vma_unindex(struct mm_struct *mm, struct vm_area_struct *vma,
+                        struct vm_area_struct *prev)
+{
+  mm->vma_addr = vm_avl_erase(mm->vma_addr, &vma->vm_addr_node, VM_AVL_ADDR);
+  mm->vma_id = vm_avl_erase(mm->vma_id, &vma->vm_id_node, VM_AVL_ID);
+  if (vma->vm_next != NULL)
+  {
+    vma_set_gap(vma->vm_next, prev);
+    vm_avl_refresh(mm->vma_addr, vma->vm_next->vm_start);
+  }
+  mm->map_count--;
+}
+
 /*add_vm_area - add a new vm area to the mm struct
  *@mm: memory management struct
  *@new_vma: the vm area to add
@@ -231,42 +665,35 @@ struct vm_area_struct *create_vm_area(int vmaid, addr_t vm_start, addr_t vm_end)
  */
 int add_vm_area(struct mm_struct *mm, struct vm_area_struct *new_vma)
 {
+  struct vm_area_struct *prev, *next;
+
   if (mm == NULL || new_vma == NULL)
     return -1;
-  
-  /* Check for overlaps with existing VMAs */
-  struct vm_area_struct *cur = mm->mmap;
-  while (cur != NULL)
-  {
-    if (OVERLAP(cur->vm_start, cur->vm_end, new_vma->vm_start, new_vma->vm_end))
-      return -1; /* Overlap detected */
-    cur = cur->vm_next;
-  }
-  
+
+  if (get_vma_by_num(mm, new_vma->vm_id) != NULL)
+    return -1; /* ID in use */
+
+  /* Check for overlaps with the neighbours, a shared start counts */
+  prev = vma_floor(mm->vma_addr, new_vma->vm_start, VM_AVL_ADDR);
+  next = (prev != NULL) ? prev->vm_next : mm->mmap;
+  if (prev != NULL &&
+      (prev->vm_start == new_vma->vm_start || prev->vm_end > new_vma->vm_start))
+    return -1;
+  if (next != NULL && next->vm_start < new_vma->vm_end)
+    return -1;
+
   /* Set the mm pointer */
   new_vma->vm_mm = mm;
-  
-  /* Insert at the beginning or in sorted order by vm_id */
-  if (mm->mmap == NULL || mm->mmap->vm_id > new_vma->vm_id)
-  {
-    new_vma->vm_next = mm->mmap;
-    mm->mmap = new_vma;
-  }
-  else
-  {
-    struct vm_area_struct *prev = mm->mmap;
-    cur = mm->mmap->vm_next;
-    
-    while (cur != NULL && cur->vm_id < new_vma->vm_id)
-    {
-      prev = cur;
-      cur = cur->vm_next;
-    }
-    
-    new_vma->vm_next = cur;
+
+  /* Insert in address order */
+  new_vma->vm_next = next;
+  if (prev != NULL)
     prev->vm_next = new_vma;
-  }
-  
+  else
+    mm->mmap = new_vma;
+
+  vma_index(mm, new_vma, prev);
+
   return 0;
 }
 
@@ -280,32 +707,27 @@ int remove_vm_area(struct mm_struct *mm, int vmaid)
 {
   if (mm == NULL || mm->mmap == NULL)
     return -1;
-  
-  struct vm_area_struct *prev = NULL;
-  struct vm_area_struct *cur = mm->mmap;
-  
-  /* Find the VMA to remove */
-  while (cur != NULL && cur->vm_id != vmaid)
-  {
-    prev = cur;
-    cur = cur->vm_next;
-  }
-  
+
+  struct vm_area_struct *cur = get_vma_by_num(mm, vmaid);
+
   if (cur == NULL)
     return -1; /* VMA not found */
-  
-  /* Remove from list */
+
+  struct vm_area_struct *prev = vma_prev(mm, cur);
+
+  /* Remove from list and index */
   if (prev == NULL)
     mm->mmap = cur->vm_next;
   else
     prev->vm_next = cur->vm_next;
-  
+  vma_unindex(mm, cur, prev);
+
   /* Free the VMA and its free region list */
   struct vm_rg_struct *rg = cur->vm_freerg_list;
   while (rg != NULL)
   {
     struct vm_rg_struct *next_rg = rg->rg_next;
-    free(rg);
+    kmem_cache_free(KMEM_VM_RG, rg);
     rg = next_rg;
   }
   
@@ -313,6 +735,62 @@ int remove_vm_area(struct mm_struct *mm, int vmaid)
   return 0;
 }
 
+/*vm_mmap - create a new anonymous vm area
+ *@mm: memory management struct
+ *@len: area size, rounded up to pages
+ *
+ * Areas are placed top-down from VM_MMAP_TOP in the highest hole that
+ * fits, as mmap does. The first page stays unused so no area shares the
+ * start of the heap area. The whole area is a free region, pages come
+ * zero-filled on first touch.
+ *
+ *Return: the new area, NULL when no hole fits
+ */
+struct vm_area_struct *vm_mmap(struct mm_struct *mm, addr_t len)
+{
+  struct vm_area_struct *vma, *last;
+  struct vm_rg_struct *rg;
+  addr_t end, lower;
+
+  len = PAGING_PAGE_ALIGNSZ(len);
+  if (mm == NULL || len == 0 || len >= VM_MMAP_TOP)
+    return NULL;
+
+  /* Above the last area first, then the holes between areas */
+  last = vma_floor(mm->vma_addr, VM_MMAP_TOP - 1, VM_AVL_ADDR);
+  lower = (last != NULL && last->vm_end > PAGING_PAGESZ) ? last->vm_end : PAGING_PAGESZ;
+  if (lower <= VM_MMAP_TOP && VM_MMAP_TOP - lower >= len)
+    end = VM_MMAP_TOP;
+  else if ((last = vm_avl_gap_find(mm->vma_addr, len, VM_MMAP_TOP)) != NULL)
+    end = (last->vm_start < VM_MMAP_TOP) ? last->vm_start : VM_MMAP_TOP;
+  else
+    return NULL;
+
+  vma = create_vm_area(mm->vma_next_id, end - len, end);
+  rg = kmem_cache_alloc(KMEM_VM_RG);
+  if (vma == NULL || rg == NULL)
+  {
+    free(vma);
+    kmem_cache_free(KMEM_VM_RG, rg);
+    return NULL;
+  }
+
+  /* Fixed size, the area never grows through sbrk */
+  vma->sbrk = vma->vm_end;
+  rg->rg_start = vma->vm_start;
+  rg->rg_end = vma->vm_end;
+  vm_freerg_insert(vma, rg);
+
+  if (add_vm_area(mm, vma) < 0)
+  {
+    kmem_cache_free(KMEM_VM_RG, vma->vm_freerg_list);
+    free(vma);
+    return NULL;
+  }
+
+  return vma;
+}
+
 /*merge_vm_areas - merge two adjacent vm areas
  *@vma1: first vm area
  *@vma2: second vm area
@@ -355,9 +833,12 @@ int merge_vm_areas(struct vm_area_struct *vma1, struct vm_area_struct *vma2)
   
   /* Update the next pointer */
   vma1->vm_next = vma2->vm_next;
+  if (vma1->vm_mm != NULL)
+    vma_unindex(vma1->vm_mm, vma2, vma1);
   
   /* Don't free vma2's regions, as they're now part of vma1 */
-  vma2->vm_freerg_list = NULL;
+  vm_freerg_init(vma2);
+  vm_freerg_rebuild(vma1);
   
   return 0;
 }
@@ -383,19 +864,22 @@ int split_vm_area(struct vm_area_struct *vma, addr_t split_addr, struct vm_area_
   if (*new_vma == NULL)
     return -1;
   
-  (*new_vma)->vm_id = vma->vm_id + 1; /* New ID for split VMA */
+  /* New ID for split VMA, unique in the mm when there is one */
+  (*new_vma)->vm_id = vma->vm_mm ? vma->vm_mm->vma_next_id : vma->vm_id + 1;
   (*new_vma)->vm_start = split_addr;
   (*new_vma)->vm_end = vma->vm_end;
   (*new_vma)->sbrk = (vma->sbrk > split_addr) ? vma->sbrk : split_addr;
   (*new_vma)->vm_mm = vma->vm_mm;
   (*new_vma)->vm_next = vma->vm_next;
-  (*new_vma)->vm_freerg_list = NULL;
+  vm_freerg_init(*new_vma);
   
   /* Update original VMA */
   vma->vm_end = split_addr;
   if (vma->sbrk > split_addr)
     vma->sbrk = split_addr;
   vma->vm_next = *new_vma;
+  if (vma->vm_mm != NULL)
+    vma_index(vma->vm_mm, *new_vma, vma);
   
   /* Split the free region list */
   struct vm_rg_struct *rg = vma->vm_freerg_list;
@@ -417,7 +901,7 @@ int split_vm_area(struct vm_area_struct *vma, addr_t split_addr, struct vm_area_
     else if (rg->rg_end > split_addr)
     {
       /* Region spans the split, need to split it */
-      struct vm_rg_struct *new_rg = malloc(sizeof(struct vm_rg_struct));
+      struct vm_rg_struct *new_rg = kmem_cache_alloc(KMEM_VM_RG);
       if (new_rg != NULL)
       {
         new_rg->rg_start = split_addr;
@@ -434,7 +918,291 @@ int split_vm_area(struct vm_area_struct *vma, addr_t split_addr, struct vm_area_
     rg = rg->rg_next;
   }
 
+  vm_freerg_rebuild(vma);
+  vm_freerg_rebuild(*new_vma);
+
+  return 0;
+}
+
+/*
+ * Region handle table
+ *
+ * mm->symrgtbl maps a region ID to its range in O(1), 16 bytes per ID.
+ * The IDs are the register operands of the program, so a released slot
+ * is reused when the program names its ID again. The table doubles
+ * when an ID past its end gets used; a failed grow keeps the old table.
+ */
+static int symrg_grow(struct mm_struct *mm, int minsz)
+{
+  struct symrg_struct *tbl;
+  int sz = (mm->symrg_sz > 0) ? mm->symrg_sz : PAGING_SYMTBL_INIT_SZ;
+
+  while (sz < minsz)
+    sz *= 2;
+  if (sz > PAGING_SYMTBL_MAX_SZ)
+    return -1;
+
+  tbl = realloc(mm->symrgtbl, sz * sizeof(struct symrg_struct));
+  if (tbl == NULL)
+    return -1;
+
+  memset(tbl + mm->symrg_sz, 0, (sz - mm->symrg_sz) * sizeof(struct symrg_struct));
+  mm->symrgtbl = tbl;
+  mm->symrg_sz = sz;
+
+  return 0;
+}
+
+/*symrg_init - create the region handle table of a mm
+ *@mm: memory management struct
+ *
+ */
+int symrg_init(struct mm_struct *mm)
+{
+  mm->symrgtbl = NULL;
+  mm->symrg_sz = 0;
+
+  return symrg_grow(mm, PAGING_SYMTBL_INIT_SZ);
+}
+
+/*symrg_release - free the region handle table of a mm
+ *@mm: memory management struct
+ *
+ */
+void symrg_release(struct mm_struct *mm)
+{
+  free(mm->symrgtbl);
+  mm->symrgtbl = NULL;
+  mm->symrg_sz = 0;
+}
+
+/*symrg_get - get the entry of a region ID, growing the table to hold it
+ *@mm: memory management struct
+ *@rgid: region ID
+ *
+ * The pointer is valid until the table grows again.
+ */
+struct symrg_struct *symrg_get(struct mm_struct *mm, int rgid)
+{
+  if (rgid < 0)
+    return NULL;
+  if (rgid >= mm->symrg_sz && symrg_grow(mm, rgid + 1) < 0)
+    return NULL;
+
+  return &mm->symrgtbl[rgid];
+}
+
+/*symrg_put - release a region ID
+ *@mm: memory management struct
+ *@rgid: region ID
+ *
+ */
+int symrg_put(struct mm_struct *mm, int rgid)
+{
+  if (rgid < 0 || rgid >= mm->symrg_sz)
+    return -1;
+
+  mm->symrgtbl[rgid].rg_start = mm->symrgtbl[rgid].rg_end = 0;
+  mm->symrgtbl[rgid].vmaid = 0;
+
   return 0;
 }
 
 // #endif
+
+static void vm_freerg_unlink(struct vm_area_struct *vma, struct vm_rg_struct *rg)
+{
+  if (rg->rg_prev != NULL)
+    rg->rg_prev->rg_next = rg->rg_next;
+  else
+    vma->vm_freerg_list = rg->rg_next;
+  if (rg->rg_next != NULL)
+    rg->rg_next->rg_prev = rg->rg_prev;
+}
+
+/*vm_freerg_init - empty the free regions of a vm area
+ *@vma: vm area
+ *
+ */
+void vm_freerg_init(struct vm_area_struct *vma)
+{
+  vma->vm_freerg_list = NULL;
+  vma->vm_freerg_addr = NULL;
+  vma->vm_freerg_size = NULL;
+}
+
+/*vm_freerg_insert - give a region back to a vm area
+ *@vma: vm area
+ *@rgnode: freed region, owned by the vm area afterwards
+ *
+ * The neighbours come from the address tree and the region is merged
+ * with a free one on either side, so two free regions never touch.
+ */
+int vm_freerg_insert(struct vm_area_struct *vma, struct vm_rg_struct *rgnode)
+{
+  struct vm_rg_struct *prev = NULL, *next;
+  struct vm_avl *n;
+
+  /* Empty, or not a range of this area */
+  if (rgnode->rg_start >= rgnode->rg_end ||
+      rgnode->rg_start < vma->vm_start || rgnode->rg_end > vma->vm_end)
+    return -1;
+
+  n = vm_avl_floor(vma->vm_freerg_addr, rgnode->rg_start, VM_AVL_RG_ADDR);
+  if (n != NULL)
+    prev = vm_avl_rg(n, VM_AVL_RG_ADDR);
+  next = (prev != NULL) ? prev->rg_next : vma->vm_freerg_list;
+
+  /* Overlap with a free region, the region was freed twice */
+  if ((prev != NULL && prev->rg_end > rgnode->rg_start) ||
+      (next != NULL && next->rg_start < rgnode->rg_end))
+    return -1;
+
+  if (prev != NULL && prev->rg_end == rgnode->rg_start)
+  {
+    /* Extend the lower neighbour, it keeps its place by address */
+    vma->vm_freerg_size = vm_avl_erase(vma->vm_freerg_size, &prev->rg_size_node,
+                                       VM_AVL_RG_SIZE);
+    prev->rg_end = rgnode->rg_end;
+    kmem_cache_free(KMEM_VM_RG, rgnode);
+    rgnode = prev;
+  }
+  else
+  {
+    rgnode->rg_prev = prev;
+    rgnode->rg_next = next;
+    if (prev != NULL)
+      prev->rg_next = rgnode;
+    else
+      vma->vm_freerg_list = rgnode;
+    if (next != NULL)
+      next->rg_prev = rgnode;
+    vma->vm_freerg_addr = vm_avl_insert(vma->vm_freerg_addr, &rgnode->rg_addr_node,
+                                        VM_AVL_RG_ADDR);
+  }
+
+  if (next != NULL && next->rg_start == rgnode->rg_end)
+  {
+    /* Absorb the upper neighbour */
+    vma->vm_freerg_addr = vm_avl_erase(vma->vm_freerg_addr, &next->rg_addr_node,
+                                       VM_AVL_RG_ADDR);
+    vma->vm_freerg_size = vm_avl_erase(vma->vm_freerg_size, &next->rg_size_node,
+                                       VM_AVL_RG_SIZE);
+    rgnode->rg_end = next->rg_end;
+    vm_freerg_unlink(vma, next);
+    kmem_cache_free(KMEM_VM_RG, next);
+  }
+
+  vma->vm_freerg_size = vm_avl_insert(vma->vm_freerg_size, &rgnode->rg_size_node,
+                                      VM_AVL_RG_SIZE);
+
+  return 0;
+}
+
+/*vm_range_allocated - tell whether a range of a vm area is in use
+ *@vma: vm area
+ *@start: range start
+ *@end: range end
+ *
+ * Below the area limit every byte is in an allocated region or in a
+ * free one, so the range is allocated when no free region meets it:
+ * only the last free region starting before @end can.
+ */
+int vm_range_allocated(struct vm_area_struct *vma, addr_t start, addr_t end)
+{
+  struct vm_avl *n;
+
+  if (start >= end || start < vma->vm_start || end > vma->vm_end)
+    return 0;
+
+  n = vm_avl_floor(vma->vm_freerg_addr, end - 1, VM_AVL_RG_ADDR);
+
+  return n == NULL || vm_avl_rg(n, VM_AVL_RG_ADDR)->rg_end <= start;
+}
+
+/*vm_freerg_take - carve a region out of the free regions, best fit
+ *@vma: vm area
+ *@size: wanted size
+ *@newrg: return the region
+ *
+ * The smallest free region that fits, the lowest one among equal
+ * sizes, is the first of the size tree not below @size.
+ */
+int vm_freerg_take(struct vm_area_struct *vma, addr_t size, struct vm_rg_struct *newrg)
+{
+  struct vm_rg_struct *best;
+  struct vm_avl *n;
+
+  if (size == 0)
+    return -1;
+
+  n = vm_avl_ceil(vma->vm_freerg_size, size, VM_AVL_RG_SIZE);
+  if (n == NULL)
+    return -1;
+  best = vm_avl_rg(n, VM_AVL_RG_SIZE);
+
+  newrg->rg_start = best->rg_start;
+  newrg->rg_end = best->rg_start + size;
+
+  vma->vm_freerg_size = vm_avl_erase(vma->vm_freerg_size, n, VM_AVL_RG_SIZE);
+  if (best->rg_end - best->rg_start == size)
+  { /*Use up all space, remove current node */
+    vma->vm_freerg_addr = vm_avl_erase(vma->vm_freerg_addr, &best->rg_addr_node,
+                                       VM_AVL_RG_ADDR);
+    vm_freerg_unlink(vma, best);
+    kmem_cache_free(KMEM_VM_RG, best);
+  }
+  else
+  {
+    /* The start stays inside the old range, the address tree holds */
+    best->rg_start += size;
+    vma->vm_freerg_size = vm_avl_insert(vma->vm_freerg_size, n, VM_AVL_RG_SIZE);
+  }
+
+  return 0;
+}
+
+/*vm_freerg_rebuild - restore the free region invariants after the list
+ *                    was edited directly (vm area merge and split)
+ *@vma: vm area
+ *
+ */
+void vm_freerg_rebuild(struct vm_area_struct *vma)
+{
+  struct vm_rg_struct *rg = vma->vm_freerg_list, *prev = NULL;
+
+  vma->vm_freerg_addr = NULL;
+  vma->vm_freerg_size = NULL;
+
+  while (rg != NULL)
+  {
+    struct vm_rg_struct *next = rg->rg_next;
+
+    if (rg->rg_start >= rg->rg_end ||
+        (prev != NULL && prev->rg_end == rg->rg_start))
+    {
+      /* Empty region, or one touching the previous: fold it */
+      if (prev != NULL && rg->rg_end > prev->rg_end)
+        prev->rg_end = rg->rg_end;
+      if (prev != NULL)
+        prev->rg_next = next;
+      else
+        vma->vm_freerg_list = next;
+      kmem_cache_free(KMEM_VM_RG, rg);
+    }
+    else
+    {
+      rg->rg_prev = prev;
+      prev = rg;
+    }
+    rg = next;
+  }
+
+  for (rg = vma->vm_freerg_list; rg != NULL; rg = rg->rg_next)
+  {
+    vma->vm_freerg_addr = vm_avl_insert(vma->vm_freerg_addr, &rg->rg_addr_node,
+                                        VM_AVL_RG_ADDR);
+    vma->vm_freerg_size = vm_avl_insert(vma->vm_freerg_size, &rg->rg_size_node,
+                                        VM_AVL_RG_SIZE);
+  }
+}
@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2026 pdnguyen of HCMC University of Technology VNU-HCM
+ */
+
+/* LamiaAtrium release
+ * Source Code License Grant: The authors hereby grant to Licensee
+ * personal permission to use and modify the Licensed Source Code
+ * for the sole purpose of studying while attending the course CO2018.
+ */
+
+/*
+ * PAGING based Memory Management
+ * Compressed swap tier mm/mm-zswap.c
+ *
+ * Victim pages are kept compressed in kernel memory before they reach
+ * a MEMSWP device. A swapped PTE with SWPTYP == PAGING_SWPTYP_ZSWAP has
+ * the pool entry index in SWPOFF. Pages filled with one byte value keep
+ * only that byte. Other pages go through a run-length coder: a control
+ * byte with the top bit set is a run of (c & 0x7f) + 1 copies of the
+ * next byte, otherwise c + 1 literal bytes follow.
+ */
+
+#include "mm.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ZSWAP_RUN_MAX 128
+#define ZSWAP_LIT_MAX 128
+
+/* Keep a page only if it shrinks to 3/4 of its size */
+#define ZSWAP_MAX_CLEN (PAGING_PAGESZ * 3 / 4)
+
+struct zswap_entry {
+   BYTE *data;    /* compressed page, NULL when same-filled */
+   int clen;      /* compressed length in bytes */
+   BYTE fill;     /* byte value of a same-filled page */
+   int used;
+};
+
+struct zswap_struct {
+   struct zswap_entry *ent;
+   int nent;
+   int *freeidx;  /* stack of unused entry indices */
+   int nfree;
+   unsigned long pool_sz;  /* bytes held by compressed pages */
+   unsigned long max_sz;   /* pool budget */
+};
+
+static int zswap_compress(const BYTE *src, BYTE *dst, int dstmax)
+{
+   int si = 0, di = 0;
+
+   while (si < PAGING_PAGESZ)
+   {
+      int run = 1;
+      while (si + run < PAGING_PAGESZ && run < ZSWAP_RUN_MAX &&
+             src[si + run] == src[si])
+         run++;
+
+      if (run >= 3)
+      {
+         if (di + 2 > dstmax)
+            return -1;
+         dst[di++] = 0x80 | (run - 1);
+         dst[di++] = src[si];
+         si += run;
+         continue;
+      }
+
+      /* Literal stretch up to the next run of three */
+      int lit = 0;
+      while (si + lit < PAGING_PAGESZ && lit < ZSWAP_LIT_MAX &&
+             !(si + lit + 2 < PAGING_PAGESZ &&
+               src[si + lit] == src[si + lit + 1] &&
+               src[si + lit] == src[si + lit + 2]))
+         lit++;
+      if (lit == 0)
+         lit = 1;
+
+      if (di + 1 + lit > dstmax)
+         return -1;
+      dst[di++] = lit - 1;
+      memcpy(dst + di, src + si, lit);
+      di += lit;
+      si += lit;
+   }
+
+   return di;
+}
+
+static void zswap_decompress(const BYTE *src, int clen, BYTE *dst)
+{
+   int si = 0, di = 0;
+
+   while (si < clen && di < PAGING_PAGESZ)
+   {
+      BYTE c = src[si++];
+
+      if (c & 0x80)
+      {
+         memset(dst + di, src[si++], (c & 0x7f) + 1);
+         di += (c & 0x7f) + 1;
+      }
+      else
+      {
+         memcpy(dst + di, src + si, c + 1);
+         di += c + 1;
+         si += c + 1;
+      }
+   }
+}
+
+static int zswap_get_entry(struct zswap_struct *zs)
+{
+   if (zs->nfree == 0)
+   {
+      int nent = (zs->nent > 0) ? zs->nent * 2 : 64;
+      struct zswap_entry *ent = realloc(zs->ent, nent * sizeof(struct zswap_entry));
+      int *freeidx = realloc(zs->freeidx, nent * sizeof(int));
+
+      if (ent == NULL || freeidx == NULL)
+         return -1;
+
+      memset(ent + zs->nent, 0, (nent - zs->nent) * sizeof(struct zswap_entry));
+      for (int i = nent - 1; i >= zs->nent; i--)
+         freeidx[zs->nfree++] = i;
+
+      zs->ent = ent;
+      zs->freeidx = freeidx;
+      zs->nent = nent;
+   }
+
+   return zs->freeidx[--zs->nfree];
+}
+
+static void zswap_put_entry(struct zswap_struct *zs, int idx)
+{
+   struct zswap_entry *e = &zs->ent[idx];
+
+   zs->pool_sz -= e->clen;
+   free(e->data);
+   e->data = NULL;
+   e->clen = 0;
+   e->used = 0;
+   zs->freeidx[zs->nfree++] = idx;
+}
+
+/*
+ * zswap_init - Create the compressed swap pool
+ * @krnl: kernel
+ * @max_sz: pool budget in bytes
+ */
+int zswap_init(struct krnl_t *krnl, unsigned long max_sz)
+{
+   struct zswap_struct *zs = calloc(1, sizeof(struct zswap_struct));
+
+   if (zs == NULL)
+      return -1;
+
+   zs->max_sz = max_sz;
+   krnl->zswap = zs;
+
+   return 0;
+}
+
+/*
+ * zswap_store - Compress a frame into the pool
+ * @krnl: kernel
+ * @mp: memphy holding the page
+ * @fpn: frame page number of the page
+ * @idx: output - pool entry index
+ *
+ * Return -1 if the page does not shrink enough, the pool is full or
+ * the host is out of memory, the caller then writes it to a swap device.
+ */
+int zswap_store(struct krnl_t *krnl, struct memphy_struct *mp, addr_t fpn, addr_t *idx)
+{
+   struct zswap_struct *zs = krnl->zswap;
+   BYTE page[PAGING_PAGESZ_MAX], cbuf[PAGING_PAGESZ_MAX * 3 / 4];
+   BYTE *data = NULL;
+   int i, clen, eid;
+
+   if (zs == NULL)
+      return -1;
+
+   if (MEMPHY_read_page(mp, fpn, page) < 0)
+      return -1;
+
+   for (i = 1; i < PAGING_PAGESZ && page[i] == page[0]; i++)
+      ;
+
+   if (i == PAGING_PAGESZ)
+   {
+      clen = 0; /* same-filled, only the byte value is kept */
+   }
+   else
+   {
+      clen = zswap_compress(page, cbuf, ZSWAP_MAX_CLEN);
+      if (clen < 0 || zs->pool_sz + clen > zs->max_sz)
+      {
+         krnl->mmstat.zswap_reject++;
+         return -1;
+      }
+   }
+
+   /* No room for the copy, the page goes to a swap device instead */
+   if (clen > 0 && (data = malloc(clen)) == NULL)
+   {
+      krnl->mmstat.zswap_reject++;
+      return -1;
+   }
+
+   eid = zswap_get_entry(zs);
+   if (eid < 0)
+   {
+      free(data);
+      return -1;
+   }
+
+   struct zswap_entry *e = &zs->ent[eid];
+   e->used = 1;
+   e->clen = clen;
+   e->fill = page[0];
+   e->data = data;
+   if (clen > 0)
+      memcpy(e->data, cbuf, clen);
+   zs->pool_sz += clen;
+
+   krnl->mmstat.zswap_store++;
+   if (clen == 0)
+      krnl->mmstat.zswap_same++;
+   krnl->mmstat.zswap_saved += PAGING_PAGESZ - clen;
+
+   *idx = eid;
+   return 0;
+}
+
+/*
+ * zswap_load - Decompress a pool entry into a frame and release it
+ * @krnl: kernel
+ * @idx: pool entry index
+ * @mp: destination memphy
+ * @fpn: destination frame page number
+ */
+int zswap_load(struct krnl_t *krnl, addr_t idx, struct memphy_struct *mp, addr_t fpn)
+{
+   struct zswap_struct *zs = krnl->zswap;
+   BYTE page[PAGING_PAGESZ_MAX];
+
+   if (zs == NULL || idx >= (addr_t)zs->nent || !zs->ent[idx].used)
+      return -1;
+
+   struct zswap_entry *e = &zs->ent[idx];
+   if (e->clen == 0)
+      memset(page, e->fill, PAGING_PAGESZ);
+   else
+      zswap_decompress(e->data, e->clen, page);
+
+   if (MEMPHY_write_page(mp, fpn, page) < 0)
+      return -1;
+
+   zswap_put_entry(zs, idx);
+   krnl->mmstat.zswap_load++;
+
+   return 0;
+}
+
+/*
+ * zswap_drop - Release a pool entry without reading it
+ * @krnl: kernel
+ * @idx: pool entry index
+ */
+int zswap_drop(struct krnl_t *krnl, addr_t idx)
+{
+   struct zswap_struct *zs = krnl->zswap;
+
+   if (zs == NULL || idx >= (addr_t)zs->nent || !zs->ent[idx].used)
+      return -1;
+
+   zswap_put_entry(zs, idx);
+
+   return 0;
+}
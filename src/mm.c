@@ -16,13 +16,96 @@
 #include "mm.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
 
 #if !defined(MM64)
 /*
  * PAGING based Memory Management
  * Memory management unit mm/mm.c
+ *
+ * The page table is two-level: mm->pgd is a directory of PT32_ENTRIES
+ * page leaf tables, a leaf is allocated by the first non-zero PTE of
+ * its range and freed when its last PTE is cleared.
  */
 
+#define PT32_SHIFT 8
+#define PT32_ENTRIES (1 << PT32_SHIFT)
+#define PT32_LEAFSZ (PT32_ENTRIES * sizeof(uint32_t))
+#define PT32_NDIR DIV_ROUND_UP(PAGING_MAX_PGN, PT32_ENTRIES)
+
+/* Leaf tables of every mm */
+static struct {
+  pthread_mutex_t lock;
+  unsigned long live;
+  unsigned long alloc;
+  unsigned long freed;
+} pt32 = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0 };
+
+/* Leaf table holding the PTE of @pgn, allocated if @alloc is set */
+static uint32_t *pt32_leaf(struct mm_struct *mm, addr_t pgn, int alloc)
+{
+  uint32_t **slot;
+
+  if (mm == NULL || mm->pgd == NULL || pgn >= PAGING_MAX_PGN)
+    return NULL;
+
+  slot = &mm->pgd[pgn >> PT32_SHIFT];
+  if (*slot == NULL && alloc)
+  {
+    if ((*slot = calloc(PT32_ENTRIES, sizeof(uint32_t))) == NULL)
+      return NULL;
+    mm->pt_pages++;
+
+    pthread_mutex_lock(&pt32.lock);
+    pt32.live++;
+    pt32.alloc++;
+    pthread_mutex_unlock(&pt32.lock);
+  }
+
+  return *slot;
+}
+
+static void pt32_free_leaf(struct mm_struct *mm, addr_t dir, int emptied)
+{
+  free(mm->pgd[dir]);
+  mm->pgd[dir] = NULL;
+  mm->pt_nr[dir] = 0;
+  mm->pt_pages--;
+
+  pthread_mutex_lock(&pt32.lock);
+  pt32.live--;
+  pt32.freed += emptied;
+  pthread_mutex_unlock(&pt32.lock);
+}
+
+/* Pages from @pgn up to the end of its leaf table, at most @left */
+static int pt32_seg_len(addr_t pgn, int left)
+{
+  int n = PT32_ENTRIES - (int)(pgn % PT32_ENTRIES);
+
+  return (n < left) ? n : left;
+}
+
+/* Store a PTE value, keeping the leaf counters */
+static int pt32_store(struct mm_struct *mm, addr_t pgn, uint32_t val)
+{
+  uint32_t *leaf = pt32_leaf(mm, pgn, val != 0);
+  uint32_t *pte;
+
+  if (leaf == NULL)
+    return (val != 0) ? -1 : 0; /* nothing to clear */
+
+  pte = &leaf[pgn % PT32_ENTRIES];
+  mm->pt_nr[pgn >> PT32_SHIFT] += (val != 0) - (*pte != 0);
+  *pte = val;
+
+  if (mm->pt_nr[pgn >> PT32_SHIFT] == 0)
+    pt32_free_leaf(mm, pgn >> PT32_SHIFT, 1);
+
+  return 0;
+}
+
 /*
  * init_pte - Initialize PTE entry
  */
@@ -98,19 +181,15 @@ int get_pd_from_pagenum(addr_t pgn, addr_t* pgd, addr_t* p4d, addr_t* pud, addr_
  */
 int pte_set_swap(struct pcb_t *caller, addr_t pgn, int swptyp, addr_t swpoff)
 {
-  struct krnl_t *krnl = caller->krnl;
-  if (caller->mm == NULL || caller->mm->pgd == NULL) return -1;
-  if (pgn >= PAGING_MAX_PGN) return -1;
+  uint32_t pte = pte_get_entry(caller, pgn);
 
-  addr_t *pte = &caller->mm->pgd[pgn];
-	
-  SETBIT(*pte, PAGING_PTE_PRESENT_MASK);
-  SETBIT(*pte, PAGING_PTE_SWAPPED_MASK);
+  SETBIT(pte, PAGING_PTE_PRESENT_MASK);
+  SETBIT(pte, PAGING_PTE_SWAPPED_MASK);
 
-  SETVAL(*pte, swptyp, PAGING_PTE_SWPTYP_MASK, PAGING_PTE_SWPTYP_LOBIT);
-  SETVAL(*pte, swpoff, PAGING_PTE_SWPOFF_MASK, PAGING_PTE_SWPOFF_LOBIT);
+  SETVAL(pte, swptyp, PAGING_PTE_SWPTYP_MASK, PAGING_PTE_SWPTYP_LOBIT);
+  SETVAL(pte, swpoff, PAGING_PTE_SWPOFF_MASK, PAGING_PTE_SWPOFF_LOBIT);
 
-  return 0;
+  return pt32_store(caller->mm, pgn, pte);
 }
 
 /*
@@ -120,18 +199,14 @@ int pte_set_swap(struct pcb_t *caller, addr_t pgn, int swptyp, addr_t swpoff)
  */
 int pte_set_fpn(struct pcb_t *caller, addr_t pgn, addr_t fpn)
 {
-  struct krnl_t *krnl = caller->krnl;
-  if (caller->mm == NULL || caller->mm->pgd == NULL) return -1;
-  if (pgn >= PAGING_MAX_PGN) return -1;
+  uint32_t pte = pte_get_entry(caller, pgn);
 
-  addr_t *pte = &caller->mm->pgd[pgn];
+  SETBIT(pte, PAGING_PTE_PRESENT_MASK);
+  CLRBIT(pte, PAGING_PTE_SWAPPED_MASK);
 
-  SETBIT(*pte, PAGING_PTE_PRESENT_MASK);
-  CLRBIT(*pte, PAGING_PTE_SWAPPED_MASK);
+  SETVAL(pte, fpn, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT);
 
-  SETVAL(*pte, fpn, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT);
-
-  return 0;
+  return pt32_store(caller->mm, pgn, pte);
 }
 
 
@@ -142,10 +217,9 @@ int pte_set_fpn(struct pcb_t *caller, addr_t pgn, addr_t fpn)
  **/
 pte_t pte_get_entry(struct pcb_t *caller, addr_t pgn)
 {
-  struct krnl_t *krnl = caller->krnl;
-  if (caller->mm == NULL || caller->mm->pgd == NULL) return 0;
-  if (pgn >= PAGING_MAX_PGN) return 0;
-  return (pte_t)caller->mm->pgd[pgn];
+  uint32_t *leaf = pt32_leaf(caller->mm, pgn, 0);
+
+  return (leaf != NULL) ? (pte_t)leaf[pgn % PT32_ENTRIES] : 0;
 }
 
 /* Set PTE page table entry
@@ -155,32 +229,166 @@ pte_t pte_get_entry(struct pcb_t *caller, addr_t pgn)
  **/
 int pte_set_entry(struct pcb_t *caller, addr_t pgn, pte_t pte_val)
 {
-	struct krnl_t *krnl = caller->krnl;
-	if (caller->mm == NULL || caller->mm->pgd == NULL) return -1;
-	if (pgn >= PAGING_MAX_PGN) return -1;
-	caller->mm->pgd[pgn] = pte_val;
-	
-	return 0;
+  return pt32_store(caller->mm, pgn, pte_val);
 }
 
 /*
- * vmap_pgd_memset - map a range of page at aligned address
+ * pte_set_huge - Huge mappings need a PMD level, none in 32-bit mode
  */
-int vmap_pgd_memset(struct pcb_t *caller,           // process call
-                    addr_t addr,                       // start address which is aligned to pagesz
-                    int pgnum)                      // num of mapping page
+int pte_set_huge(struct pcb_t *caller, addr_t pgn, addr_t fpn)
 {
-  int pgit = 0;
-  addr_t pgn;
+  return -1;
+}
 
-  for (pgit = 0; pgit < pgnum; pgit++)
+/*
+ * pte_split_huge - Nothing is ever huge in 32-bit mode
+ */
+int pte_split_huge(struct pcb_t *caller, addr_t pgn)
+{
+  return 0;
+}
+
+/*
+ * pte_range_set_fpn - Map consecutive pages to a frame list
+ * @caller : caller
+ * @pgn    : first page number
+ * @pgnum  : number of pages
+ * @frames : frames, one per page; the mapping stops at the list end
+ *
+ * Return the number of pages mapped.
+ */
+int pte_range_set_fpn(struct pcb_t *caller, addr_t pgn, int pgnum,
+                      struct framephy_struct *frames)
+{
+  struct mm_struct *mm = caller->mm;
+  int done = 0, n, j;
+
+  if (mm == NULL || mm->pgd == NULL) return -1;
+  if (pgn + pgnum > PAGING_MAX_PGN) pgnum = PAGING_MAX_PGN - pgn;
+
+  /* One leaf lookup per run of PT32_ENTRIES pages */
+  while (done < pgnum && frames != NULL)
+  {
+    addr_t dir = pgn >> PT32_SHIFT;
+    uint32_t *leaf = pt32_leaf(mm, pgn, 1);
+
+    if (leaf == NULL)
+      break;
+
+    n = pt32_seg_len(pgn, pgnum - done);
+    for (j = pgn % PT32_ENTRIES; n > 0 && frames != NULL; j++, n--)
+    {
+      uint32_t val = leaf[j] & ~(PAGING_PTE_SWAPPED_MASK | PAGING_PTE_FPN_MASK);
+
+      SETBIT(val, PAGING_PTE_PRESENT_MASK);
+      SETVAL(val, frames->fpn, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT);
+      mm->pt_nr[dir] += (leaf[j] == 0);
+      leaf[j] = val;
+
+      frames = frames->fp_next;
+      pgn++;
+      done++;
+    }
+  }
+
+  return done;
+}
+
+/*
+ * pte_range_protect - Change bits of the populated PTEs of a range
+ * @caller : caller
+ * @pgn    : first page number
+ * @pgnum  : number of pages
+ * @clr    : bits to clear
+ * @set    : bits to set
+ *
+ * Missing leaf tables are skipped, nothing is populated there.
+ */
+int pte_range_protect(struct pcb_t *caller, addr_t pgn, int pgnum, pte_t clr, pte_t set)
+{
+  struct mm_struct *mm = caller->mm;
+  int n, j;
+
+  if (mm == NULL || mm->pgd == NULL) return -1;
+  if (pgn + pgnum > PAGING_MAX_PGN) pgnum = PAGING_MAX_PGN - pgn;
+
+  for (; pgnum > 0; pgn += n, pgnum -= n)
+  {
+    addr_t dir = pgn >> PT32_SHIFT;
+    uint32_t *leaf = pt32_leaf(mm, pgn, 0);
+    int first = pgn % PT32_ENTRIES;
+
+    n = pt32_seg_len(pgn, pgnum);
+    if (leaf == NULL)
+      continue;
+
+    for (j = first; j < first + n; j++)
+    {
+      uint32_t val;
+
+      if (leaf[j] == 0)
+        continue;
+      val = (leaf[j] & ~(uint32_t)clr) | (uint32_t)set;
+      mm->pt_nr[dir] -= (val == 0);
+      leaf[j] = val;
+    }
+
+    if (mm->pt_nr[dir] == 0)
+      pt32_free_leaf(mm, dir, 1);
+  }
+
+  return 0;
+}
+
+/*
+ * pte_range_clear - Clear the PTEs of a range, freeing the leaf tables
+ * it empties
+ */
+int pte_range_clear(struct pcb_t *caller, addr_t pgn, int pgnum)
+{
+  return pte_range_protect(caller, pgn, pgnum, ~(pte_t)0, 0);
+}
+
+/*
+ * pte_range_for_each - Call fn on every PTE of a range
+ * @fn : callback, gets 0 for an empty PTE; a non zero return stops
+ *       the walk; it must not change the page table
+ */
+int pte_range_for_each(struct pcb_t *caller, addr_t pgn, int pgnum,
+                       int (*fn)(addr_t pgn, pte_t pte, void *arg), void *arg)
+{
+  int n, j, ret;
+
+  if (caller->mm == NULL || caller->mm->pgd == NULL) return -1;
+  if (pgn + pgnum > PAGING_MAX_PGN) pgnum = PAGING_MAX_PGN - pgn;
+
+  for (; pgnum > 0; pgn += n, pgnum -= n)
   {
-    pgn = PAGING_PGN(addr + pgit * PAGING_PAGESZ);
-    pte_set_entry(caller, pgn, 0);
+    uint32_t *leaf = pt32_leaf(caller->mm, pgn, 0);
+
+    n = pt32_seg_len(pgn, pgnum);
+    for (j = 0; j < n; j++)
+    {
+      pte_t pte = (leaf != NULL) ? leaf[pgn % PT32_ENTRIES + j] : 0;
+
+      if ((ret = fn(pgn + j, pte, arg)) != 0)
+        return ret;
+    }
   }
+
   return 0;
 }
 
+/*
+ * vmap_pgd_memset - map a range of page at aligned address
+ */
+int vmap_pgd_memset(struct pcb_t *caller,           // process call
+                    addr_t addr,                       // start address which is aligned to pagesz
+                    int pgnum)                      // num of mapping page
+{
+  return pte_range_clear(caller, PAGING_PGN(addr), pgnum);
+}
+
 /*
  * vmap_page_range - map a range of page at aligned address
  */
@@ -202,11 +410,17 @@ addr_t vmap_page_range(struct pcb_t *caller,           // process call
   }
 
   /* Map range of frames to address space */
-  for (pgit = 0; pgit < pgnum && fpit != NULL; pgit++)
+  pgnum = pte_range_set_fpn(caller, PAGING_PGN(addr), pgnum, frames);
+  if (pgnum < 0)
+    return -1;
+  if (ret_rg != NULL)
+    ret_rg->rg_end = addr + pgnum * PAGING_PAGESZ;
+
+  for (pgit = 0; pgit < pgnum; pgit++)
   {
-    pgn = PAGING_PGN(addr + pgit * PAGING_PAGESZ);
-    pte_set_fpn(caller, pgn, fpit->fpn);
-    enlist_pgn_node(&caller->mm->fifo_pgn, pgn);
+    pgn = PAGING_PGN(addr) + pgit;
+    MEMPHY_rmap_set(caller->krnl->mram, fpit->fpn, caller->mm, pgn);
+    pgrepl_insert(caller->mm, pgn);
     fpit = fpit->fp_next;
   }
 
@@ -223,17 +437,22 @@ addr_t vmap_page_range(struct pcb_t *caller,           // process call
 addr_t alloc_pages_range(struct pcb_t *caller, int req_pgnum, struct framephy_struct **frm_lst)
 {
   addr_t fpn;
-  int pgit;
+  int pgit, run, i;
   struct framephy_struct *newfp_str = NULL;
   struct framephy_struct *last_fp = NULL;
 
-  for (pgit = 0; pgit < req_pgnum; pgit++)
+  /* Take the frames in physically contiguous runs when possible */
+  for (pgit = 0; pgit < req_pgnum; pgit += run)
   {
-    if (MEMPHY_get_freefp(caller->krnl->mram, &fpn) == 0)
+    run = MEMPHY_get_freefp_range(caller->krnl->mram, req_pgnum - pgit, &fpn);
+    if (run < 0)
+      return -3000; // Out of memory
+
+    for (i = 0; i < run; i++)
     {
       newfp_str = malloc(sizeof(struct framephy_struct));
       if (newfp_str == NULL) return -1;
-      newfp_str->fpn = fpn;
+      newfp_str->fpn = fpn + i;
       newfp_str->fp_next = NULL;
       newfp_str->owner = caller->mm;
       
@@ -244,8 +463,6 @@ addr_t alloc_pages_range(struct pcb_t *caller, int req_pgnum, struct framephy_st
         last_fp->fp_next = newfp_str;
         last_fp = newfp_str;
       }
-    } else {
-      return -3000; // Out of memory
     }
   }
 
@@ -263,17 +480,41 @@ addr_t alloc_pages_range(struct pcb_t *caller, int req_pgnum, struct framephy_st
  */
 addr_t vm_map_ram(struct pcb_t *caller, addr_t astart, addr_t aend, addr_t mapstart, int incpgnum, struct vm_rg_struct *ret_rg)
 {
-  struct framephy_struct *frm_lst = NULL;
-  addr_t ret_alloc = 0;
+  struct framephy_struct *frm_lst = NULL, *fp;
+  struct vm_rg_struct rg;
+  addr_t ret_alloc = 0, mapped = 0;
+  int ret = 0;
 
+  /* No swapping here, the caller checks MEMRAM has the frames */
   ret_alloc = alloc_pages_range(caller, incpgnum, &frm_lst);
 
-  if (ret_alloc < 0 && ret_alloc != -3000) return -1;
-  if (ret_alloc == -3000) return -1;
+  if (ret_alloc == 0)
+  {
+    for (fp = frm_lst; fp != NULL; fp = fp->fp_next)
+      MEMPHY_zero_page(caller->krnl->mram, fp->fpn);
+    if (vmap_page_range(caller, mapstart, incpgnum, frm_lst, &rg) == 0)
+      mapped = (rg.rg_end - rg.rg_start) / PAGING_PAGESZ;
+    if (ret_rg != NULL)
+    {
+      ret_rg->rg_start = rg.rg_start;
+      ret_rg->rg_end = rg.rg_end;
+    }
+  }
+  if (ret_alloc != 0 || mapped < (addr_t)incpgnum)
+    ret = -1;
 
-  vmap_page_range(caller, mapstart, incpgnum, frm_lst, ret_rg);
+  /* Frames left unmapped go back to MEMRAM */
+  while ((fp = frm_lst) != NULL)
+  {
+    frm_lst = fp->fp_next;
+    if (mapped > 0)
+      mapped--;
+    else
+      MEMPHY_put_freefp(caller->krnl->mram, fp->fpn);
+    free(fp);
+  }
 
-  return 0;
+  return ret;
 }
 
 /* Swap copy content page from source frame to destination frame
@@ -285,19 +526,8 @@ addr_t vm_map_ram(struct pcb_t *caller, addr_t astart, addr_t aend, addr_t mapst
 int __swap_cp_page(struct memphy_struct *mpsrc, addr_t srcfpn,
                    struct memphy_struct *mpdst, addr_t dstfpn)
 {
-  int cellidx;
-  addr_t addrsrc, addrdst;
-  for (cellidx = 0; cellidx < PAGING_PAGESZ; cellidx++)
-  {
-    addrsrc = srcfpn * PAGING_PAGESZ + cellidx;
-    addrdst = dstfpn * PAGING_PAGESZ + cellidx;
-
-    BYTE data;
-    MEMPHY_read(mpsrc, addrsrc, &data);
-    MEMPHY_write(mpdst, addrdst, data);
-  }
-
-  return 0;
+  /* Whole page at once instead of PAGING_PAGESZ single byte accesses */
+  return MEMPHY_copy_page(mpsrc, srcfpn, mpdst, dstfpn);
 }
 
 /*
@@ -309,37 +539,39 @@ int init_mm(struct mm_struct *mm, struct pcb_t *caller)
 {
   struct vm_area_struct *vma0 = malloc(sizeof(struct vm_area_struct));
   
-  /* Initialize page table directory */
-  mm->pgd = malloc(sizeof(uint32_t) * PAGING_MAX_PGN);
-  for(int i=0; i<PAGING_MAX_PGN; i++) mm->pgd[i] = 0;
+  /* Initialize page table directory, the leaf tables come on demand */
+  mm->pgd = calloc(PT32_NDIR, sizeof(uint32_t *));
+  mm->pt_nr = calloc(PT32_NDIR, sizeof(uint16_t));
+  mm->pt_pages = 0;
 
   /* By default the owner comes with at least one vma */
   vma0->vm_id = 0;
   vma0->vm_start = 0;
   vma0->vm_end = vma0->vm_start;
   vma0->sbrk = vma0->vm_start;
-  struct vm_rg_struct *first_rg = init_vm_rg(vma0->vm_start, vma0->vm_end);
-  enlist_vm_rg_node(&vma0->vm_freerg_list, first_rg);
+  vm_freerg_init(vma0);
 
-  vma0->vm_next = NULL;
-  vma0->vm_mm = mm; 
-  mm->mmap = vma0;
+  vm_mmap_init(mm);
+  add_vm_area(mm, vma0);
   
-  /* Initialize symbol region table */
-  for (int i = 0; i < PAGING_MAX_SYMTBL_SZ; i++) {
-    mm->symrgtbl[i].rg_start = 0;
-    mm->symrgtbl[i].rg_end = 0;
-    mm->symrgtbl[i].rg_next = NULL;
-  }
+  /* Initialize symbol region table, it grows with the region IDs used */
+  if (symrg_init(mm) < 0)
+    return -1;
+
+  /* Swap readahead starts with the faulting page only */
+  mm->ra_win = 1;
+  mm->ra_next = 0;
   
-  mm->fifo_pgn = NULL;
+  if (pgrepl_init(mm, caller->krnl->mmparam.pgrepl,
+                  caller->krnl->mmparam.pgscope == PGSCOPE_GLOBAL ? &caller->krnl->pgrepl : NULL) < 0)
+    return -1;
 
   return 0;
 }
 
 struct vm_rg_struct *init_vm_rg(addr_t rg_start, addr_t rg_end)
 {
-  struct vm_rg_struct *rgnode = malloc(sizeof(struct vm_rg_struct));
+  struct vm_rg_struct *rgnode = kmem_cache_alloc(KMEM_VM_RG);
   rgnode->rg_start = rg_start;
   rgnode->rg_end = rg_end;
   rgnode->rg_next = NULL;
@@ -457,6 +689,58 @@ int print_pgtbl(struct pcb_t *caller, addr_t start, addr_t end)
   return 0;
 }
 
+/*
+ * pgtbl_for_each - Call fn on every non-zero PTE of a mm
+ * @mm  : memory management struct
+ * @fn  : callback, a non zero return stops the walk; it must not
+ *        change the page table
+ * @arg : callback argument
+ */
+int pgtbl_for_each(struct mm_struct *mm, int (*fn)(addr_t pgn, pte_t pte, void *arg), void *arg)
+{
+  addr_t dir, i;
+  int ret;
+
+  if (mm == NULL || mm->pgd == NULL)
+    return -1;
+
+  for (dir = 0; dir < PT32_NDIR; dir++)
+  {
+    uint32_t *leaf = mm->pgd[dir];
+
+    for (i = 0; leaf != NULL && i < PT32_ENTRIES; i++)
+      if (leaf[i] != 0 && (ret = fn(dir * PT32_ENTRIES + i, leaf[i], arg)) != 0)
+        return ret;
+  }
+
+  return 0;
+}
+
+/*
+ * pgtbl_bytes - Memory held by the page table of a mm
+ * @mm : memory management struct
+ */
+unsigned long pgtbl_bytes(struct mm_struct *mm)
+{
+  if (mm == NULL || mm->pgd == NULL)
+    return 0;
+
+  return PT32_NDIR * (sizeof(uint32_t *) + sizeof(uint16_t)) + mm->pt_pages * PT32_LEAFSZ;
+}
+
+/*
+ * pgtbl_report - Print the leaf table counters of every mm
+ */
+int pgtbl_report(void)
+{
+  pthread_mutex_lock(&pt32.lock);
+  printf("Page Table Leaves: %lu in use (%lu KB), %lu allocated, %lu freed when emptied\n",
+         pt32.live, pt32.live * PT32_LEAFSZ / 1024, pt32.alloc, pt32.freed);
+  pthread_mutex_unlock(&pt32.lock);
+
+  return 0;
+}
+
 /*
  * free_mm - Free all memory management structures (32-bit mode)
  * @mm: memory management struct to free
@@ -469,8 +753,15 @@ int free_mm(struct mm_struct *mm)
   /* Free page table */
   if (mm->pgd != NULL)
   {
+    addr_t dir;
+
+    for (dir = 0; dir < PT32_NDIR; dir++)
+      if (mm->pgd[dir] != NULL)
+        pt32_free_leaf(mm, dir, 0);
     free(mm->pgd);
+    free(mm->pt_nr);
     mm->pgd = NULL;
+    mm->pt_nr = NULL;
   }
   
   /* Free VMAs */
@@ -484,24 +775,18 @@ int free_mm(struct mm_struct *mm)
     while (rg != NULL)
     {
       struct vm_rg_struct *next_rg = rg->rg_next;
-      free(rg);
+      kmem_cache_free(KMEM_VM_RG, rg);
       rg = next_rg;
     }
     
     free(vma);
     vma = next_vma;
   }
-  mm->mmap = NULL;
+  vm_mmap_init(mm);
+  symrg_release(mm);
   
-  /* Free FIFO page list */
-  struct pgn_t *pgn = mm->fifo_pgn;
-  while (pgn != NULL)
-  {
-    struct pgn_t *next_pgn = pgn->pg_next;
-    free(pgn);
-    pgn = next_pgn;
-  }
-  mm->fifo_pgn = NULL;
+  /* Free page replacement state */
+  pgrepl_release(mm);
   
   return 0;
 }
@@ -17,7 +17,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
-#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 
 #if defined(MM64)
 
@@ -100,153 +101,811 @@ int get_pd_from_pagenum(addr_t pgn, addr_t* pgd, addr_t* p4d, addr_t* pud, addr_
 
 
 /*
- * pte_set_swap - Set PTE entry for swapped page
- * @pte    : target page table entry (PTE)
- * @swptyp : swap type
- * @swpoff : swap offset
+ * Page-table pages
+ *
+ * Every level of the 5-level tree is a PT_ENTRIES entry table taken
+ * from a pool of PT_PAGESZ aligned pages. The pool carves chunks of
+ * PTPOOL_CHUNK_PAGES pages aligned to the chunk size; the first page of
+ * a chunk is its header with the metadata of every table in it, so a
+ * table finds its metadata from its own address. The metadata is the
+ * number of non-zero entries and a bitmap of them, which lets teardown
+ * and whole-tree walks visit populated entries only. Pool pages are
+ * kept zeroed: a table goes back only when its last entry is cleared
+ * or after teardown cleared its entries, so a new table needs no
+ * clearing.
  */
-int pte_set_swap(struct pcb_t *caller, addr_t pgn, int swptyp, addr_t swpoff)
+#define PT_LEVELS 5
+#define PT_ENTRIES 512
+#define PT_PAGESZ (PT_ENTRIES * sizeof(uint64_t))
+#define PT_MAPWORDS (PT_ENTRIES / 64)
+#define PTPOOL_CHUNK_PAGES 32
+#define PTPOOL_CHUNK_SZ (PTPOOL_CHUNK_PAGES * PT_PAGESZ)
+
+struct pt_meta {
+  uint64_t map[PT_MAPWORDS];  /* non-zero entries */
+  int nr;                     /* number of bits set in map */
+};
+
+struct ptpool_chunk {
+  struct ptpool_chunk *next;
+  struct pt_meta meta[PTPOOL_CHUNK_PAGES];  /* slot 0 is the header */
+};
+
+static struct {
+  pthread_mutex_t lock;
+  uint64_t *free;           /* free tables linked through entry 0 */
+  struct ptpool_chunk *chunk;
+  unsigned long nchunk;
+  unsigned long nfree;
+  unsigned long reclaim;    /* tables given back by their last clear */
+} ptpool = { PTHREAD_MUTEX_INITIALIZER, NULL, NULL, 0, 0, 0 };
+
+/* Translation counters, kept like the rest of the MM state under mmvm_lock */
+static struct {
+  unsigned long walks;
+  unsigned long levels;     /* tables read */
+  unsigned long pwc_hit;
+  unsigned long hlookups;   /* hashed page table lookups */
+  unsigned long hprobes;    /* slots read by them */
+} ptwalk;
+
+static struct pt_meta *pt_meta(uint64_t *tbl)
 {
-  struct krnl_t *krnl = caller->krnl;
-
-  addr_t pgd_idx=0;
-  addr_t p4d_idx=0;
-  addr_t pud_idx=0;
-  addr_t pmd_idx=0;
-  addr_t pt_idx=0;
-	
-#ifdef MM64	
-  /* Get page directory indices from page number */
-  get_pd_from_pagenum(pgn, &pgd_idx, &p4d_idx, &pud_idx, &pmd_idx, &pt_idx);
-  
-  /* Navigate through page table hierarchy */
-  if (caller->mm->pgd == NULL)
+  uintptr_t base = (uintptr_t)tbl & ~(uintptr_t)(PTPOOL_CHUNK_SZ - 1);
+
+  return &((struct ptpool_chunk *)base)->meta[((uintptr_t)tbl - base) / PT_PAGESZ];
+}
+
+/* Entry @i of @tbl becomes non-zero */
+static void pt_mark(uint64_t *tbl, addr_t i)
+{
+  struct pt_meta *m = pt_meta(tbl);
+
+  m->map[i / 64] |= 1ULL << (i % 64);
+  m->nr++;
+}
+
+/* Entry @i of @tbl becomes zero, return the entries left */
+static int pt_unmark(uint64_t *tbl, addr_t i)
+{
+  struct pt_meta *m = pt_meta(tbl);
+
+  m->map[i / 64] &= ~(1ULL << (i % 64));
+  return --m->nr;
+}
+
+/* Get a zeroed table, NULL when out of memory */
+static uint64_t *pt_alloc(struct mm_struct *mm)
+{
+  uint64_t *tbl;
+  int i;
+
+  pthread_mutex_lock(&ptpool.lock);
+  if (ptpool.free == NULL)
+  {
+    BYTE *base = aligned_alloc(PTPOOL_CHUNK_SZ, PTPOOL_CHUNK_SZ);
+    struct ptpool_chunk *ch = (struct ptpool_chunk *)base;
+
+    if (base == NULL)
+    {
+      pthread_mutex_unlock(&ptpool.lock);
+      return NULL;
+    }
+    memset(base, 0, PTPOOL_CHUNK_SZ);
+    ch->next = ptpool.chunk;
+    ptpool.chunk = ch;
+    ptpool.nchunk++;
+
+    for (i = PTPOOL_CHUNK_PAGES - 1; i > 0; i--)
+    {
+      tbl = (uint64_t *)(base + i * PT_PAGESZ);
+      tbl[0] = (uint64_t)(uintptr_t)ptpool.free;
+      ptpool.free = tbl;
+      ptpool.nfree++;
+    }
+  }
+
+  tbl = ptpool.free;
+  ptpool.free = (uint64_t *)(uintptr_t)tbl[0];
+  ptpool.nfree--;
+  pthread_mutex_unlock(&ptpool.lock);
+
+  tbl[0] = 0;
+  mm->pt_pages++;
+
+  return tbl;
+}
+
+/* Give an empty table back, @reclaim when its last clear emptied it */
+static void pt_free(struct mm_struct *mm, uint64_t *tbl, int reclaim)
+{
+  mm->pt_pages--;
+
+  pthread_mutex_lock(&ptpool.lock);
+  if (reclaim)
+    ptpool.reclaim++;
+  tbl[0] = (uint64_t)(uintptr_t)ptpool.free;
+  ptpool.free = tbl;
+  ptpool.nfree++;
+  pthread_mutex_unlock(&ptpool.lock);
+}
+
+/*
+ * Huge mappings
+ *
+ * A PMD entry with the present bit set maps PT_ENTRIES contiguous
+ * frames instead of pointing to a PT; table pointers never have bit 63
+ * set. Reads see a PTE built from it for every page of the span, any
+ * change to a single page first splits it back into a PT.
+ */
+#define PT_HUGE(e) (((e) & PAGING_PTE_PRESENT_MASK) != 0)
+
+/* The PTE of page @pgn inside the huge mapping @pmd */
+static pte_t pt_huge_pte(uint64_t pmd, addr_t pgn)
+{
+  pte_t pte = pmd;
+
+  SETVAL(pte, (PAGING_FPN(pmd) + pgn % PT_ENTRIES), PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT);
+  return pte;
+}
+
+/* Replace the huge mapping in entry @i of the PMD table by a full PT */
+static int pt_split(struct mm_struct *mm, uint64_t *pmd, addr_t i)
+{
+  uint64_t *pt = pt_alloc(mm);
+  struct pt_meta *m;
+  addr_t j;
+
+  if (pt == NULL)
     return -1;
-  
-  /* Access or allocate P4D */
-  uint64_t **p4d_table = (uint64_t **)&caller->mm->pgd[pgd_idx];
-  if (*p4d_table == NULL)
+
+  for (j = 0; j < PT_ENTRIES; j++)
+    pt[j] = pt_huge_pte(pmd[i], j) & ~PAGING_PTE_HUGE_MASK;
+  m = pt_meta(pt);
+  memset(m->map, 0xff, sizeof(m->map));
+  m->nr = PT_ENTRIES;
+
+  pmd[i] = (uint64_t)(uintptr_t)pt;
+  return 0;
+}
+
+/* pt_walk modes */
+#define PT_READ  0   /* a huge mapping is returned as is */
+#define PT_WRITE 1   /* a huge mapping is split */
+#define PT_ALLOC 2   /* split, and create the missing tables */
+
+/*
+ * pt_descend - Walk the tables of a page down to level @last
+ * @mm    : address space
+ * @mode  : PT_READ, PT_WRITE or PT_ALLOC
+ * @path  : output - table of every level, PGD first
+ * @idx   : entry of every level
+ * @last  : level of the table wanted
+ *
+ * Return the table at level @last, NULL when a table is missing. In
+ * PT_READ mode a huge mapping stops the walk: the PMD table is
+ * returned and path[PT_LEVELS - 1] is NULL.
+ */
+static uint64_t *pt_descend(struct mm_struct *mm, int mode, uint64_t **path,
+                            addr_t *idx, int last)
+{
+  uint64_t *tbl = mm->pgd;
+  int lv;
+
+  for (lv = 0; lv < last; lv++)
   {
-    *p4d_table = malloc(sizeof(uint64_t) * 512);
-    if (*p4d_table == NULL) return -1;
-    for (int i = 0; i < 512; i++) (*p4d_table)[i] = 0;
+    uint64_t *next;
+
+    ptwalk.levels++;
+    path[lv] = tbl;
+    if (lv == PT_LEVELS - 2 && PT_HUGE(tbl[idx[lv]]))
+    {
+      if (mode == PT_READ)
+      {
+        path[PT_LEVELS - 1] = NULL;
+        return tbl;
+      }
+      if (pt_split(mm, tbl, idx[lv]) < 0)
+        return NULL;
+    }
+
+    next = (uint64_t *)(uintptr_t)tbl[idx[lv]];
+    if (next == NULL)
+    {
+      if (mode != PT_ALLOC || (next = pt_alloc(mm)) == NULL)
+        return NULL;
+      tbl[idx[lv]] = (uint64_t)(uintptr_t)next;
+      pt_mark(tbl, idx[lv]);
+    }
+    tbl = next;
   }
-  
-  /* Access or allocate PUD */
-  uint64_t **pud_table = (uint64_t **)&(*p4d_table)[p4d_idx];
-  if (*pud_table == NULL)
+  path[lv] = tbl;
+  ptwalk.levels++;
+
+  return tbl;
+}
+
+/*
+ * pt_walk - Find the PTE of a page
+ * @mm    : address space
+ * @pgn   : page number
+ * @mode  : PT_READ, PT_WRITE or PT_ALLOC
+ * @path  : output - table of every level, PGD first
+ * @idx   : output - entry used in every level
+ *
+ * The page-walk cache of the mm keeps the tables of recently walked
+ * 512 page spans, a hit reads the PT only.
+ *
+ * Return the PTE, or NULL when a table is missing (and not created).
+ * In PT_READ mode a huge mapping gives its PMD entry, with
+ * path[PT_LEVELS - 1] set to NULL.
+ */
+static uint64_t *pt_walk(struct mm_struct *mm, addr_t pgn, int mode,
+                         uint64_t **path, addr_t *idx)
+{
+  struct pgtbl_pwc *c = &mm->pwc[(pgn / PT_ENTRIES) % PGTBL_PWC_SZ];
+  uint64_t *tbl;
+
+  if (mm->pgd == NULL)
+    return NULL;
+
+  get_pd_from_pagenum(pgn, &idx[0], &idx[1], &idx[2], &idx[3], &idx[4]);
+  ptwalk.walks++;
+
+  if (mm->pwc_on && c->tag == pgn / PT_ENTRIES + 1)
   {
-    *pud_table = malloc(sizeof(uint64_t) * 512);
-    if (*pud_table == NULL) return -1;
-    for (int i = 0; i < 512; i++) (*pud_table)[i] = 0;
+    memcpy(path, c->path, sizeof(c->path));
+    ptwalk.pwc_hit++;
+    ptwalk.levels++;
+    return &path[PT_LEVELS - 1][idx[PT_LEVELS - 1]];
   }
-  
-  /* Access or allocate PMD */
-  uint64_t **pmd_table = (uint64_t **)&(*pud_table)[pud_idx];
-  if (*pmd_table == NULL)
+
+  tbl = pt_descend(mm, mode, path, idx, PT_LEVELS - 1);
+  if (tbl == NULL)
+    return NULL;
+  if (path[PT_LEVELS - 1] == NULL)
+    return &tbl[idx[PT_LEVELS - 2]]; /* huge, never cached */
+
+  if (mm->pwc_on)
   {
-    *pmd_table = malloc(sizeof(uint64_t) * 512);
-    if (*pmd_table == NULL) return -1;
-    for (int i = 0; i < 512; i++) (*pmd_table)[i] = 0;
+    c->tag = pgn / PT_ENTRIES + 1;
+    memcpy(c->path, path, sizeof(c->path));
   }
-  
-  /* Access or allocate PT */
-  uint64_t **pt_table = (uint64_t **)&(*pmd_table)[pmd_idx];
-  if (*pt_table == NULL)
+
+  return &tbl[idx[PT_LEVELS - 1]];
+}
+
+/* Clear the PTE at the end of @path, giving back the tables it empties.
+ * The PGD stays even when empty. */
+static void pt_clear(struct mm_struct *mm, uint64_t **path, addr_t *idx)
+{
+  int lv;
+
+  for (lv = PT_LEVELS - 1; lv >= 0; lv--)
   {
-    *pt_table = malloc(sizeof(uint64_t) * 512);
-    if (*pt_table == NULL) return -1;
-    for (int i = 0; i < 512; i++) (*pt_table)[i] = 0;
+    path[lv][idx[lv]] = 0;
+    if (pt_unmark(path[lv], idx[lv]) > 0 || lv == 0)
+      break;
+
+    if (lv == PT_LEVELS - 1)
+    {
+      /* Only a span whose PT is freed can hold a freed upper table */
+      addr_t span = (idx[0] << 27) | (idx[1] << 18) | (idx[2] << 9) | idx[3];
+      struct pgtbl_pwc *c = &mm->pwc[span % PGTBL_PWC_SZ];
+
+      if (c->tag == span + 1)
+        c->tag = 0;
+    }
+    pt_free(mm, path[lv], 1);
   }
-  
-  /* Get the actual PTE */
-  addr_t *pte = (addr_t *)&(*pt_table)[pt_idx];
-#else
-  addr_t *pte = &krnl->mm->pgd[pgn];
-#endif
-	
-  SETBIT(*pte, PAGING_PTE_PRESENT_MASK);
-  SETBIT(*pte, PAGING_PTE_SWAPPED_MASK);
-
-  SETVAL(*pte, swptyp, PAGING_PTE_SWPTYP_MASK, PAGING_PTE_SWPTYP_LOBIT);
-  SETVAL(*pte, swpoff, PAGING_PTE_SWPOFF_MASK, PAGING_PTE_SWPOFF_LOBIT);
+}
+
+/*
+ * Hashed page table
+ *
+ * With pgtbl=hash the PTEs of a mm live in an open addressing hash of
+ * page number to PTE instead of the radix tree. Probing is linear, the
+ * table doubles at 3/4 load and a removal shifts the following entries
+ * back, so no tombstones are left. The metadata is 16 bytes a slot
+ * however sparse the address space is. There are no huge mappings.
+ */
+#define PTH_MIN_SLOTS 64
+
+/* A page table is there, radix or hashed */
+#define PT_LIVE(mm) ((mm)->pgd != NULL || (mm)->pth != NULL)
+
+static addr_t pth_home(struct mm_struct *mm, addr_t pgn)
+{
+  uint64_t h = pgn * 0x9E3779B97F4A7C15ULL;
+
+  return (h ^ (h >> 29)) & (mm->pth_size - 1);
+}
+
+/* Slot of @pgn, or the empty slot ending its probe sequence */
+static struct pgtbl_hent *pth_find(struct mm_struct *mm, addr_t pgn)
+{
+  addr_t i = pth_home(mm, pgn);
+
+  ptwalk.hlookups++;
+  for (;;)
+  {
+    struct pgtbl_hent *e = &mm->pth[i];
+
+    ptwalk.hprobes++;
+    if (e->pte == 0 || e->pgn == pgn)
+      return e;
+    i = (i + 1) & (mm->pth_size - 1);
+  }
+}
+
+static int pth_alloc(struct mm_struct *mm, addr_t size)
+{
+  struct pgtbl_hent *old = mm->pth;
+  addr_t oldsz = mm->pth_size, i;
+
+  mm->pth = calloc(size, sizeof(struct pgtbl_hent));
+  if (mm->pth == NULL)
+  {
+    mm->pth = old;
+    return -1;
+  }
+  mm->pth_size = size;
+
+  for (i = 0; i < oldsz; i++)
+    if (old[i].pte != 0)
+      *pth_find(mm, old[i].pgn) = old[i];
+  free(old);
+
+  return 0;
+}
+
+/* Empty slot @e, moving back the entries whose probe went past it */
+static void pth_remove(struct mm_struct *mm, struct pgtbl_hent *e)
+{
+  addr_t mask = mm->pth_size - 1;
+  addr_t i = e - mm->pth, j = i;
+
+  for (;;)
+  {
+    addr_t home;
+
+    j = (j + 1) & mask;
+    if (mm->pth[j].pte == 0)
+      break;
+
+    /* The entry at j may move to i if i is on its probe path */
+    home = pth_home(mm, mm->pth[j].pgn);
+    if (((j - home) & mask) >= ((j - i) & mask))
+    {
+      mm->pth[i] = mm->pth[j];
+      i = j;
+    }
+  }
+  mm->pth[i].pte = 0;
+  mm->pth_used--;
+}
+
+static int pth_store(struct mm_struct *mm, addr_t pgn, pte_t clr, pte_t set)
+{
+  struct pgtbl_hent *e = pth_find(mm, pgn);
+  uint64_t val = (e->pte & ~clr) | set;
+
+  if (val == 0)
+  {
+    if (e->pte != 0)
+      pth_remove(mm, e);
+    /* Shrink at 1/8 load, half the size keeps it under 1/4 */
+    if (mm->pth_size > PTH_MIN_SLOTS && mm->pth_used * 8 < mm->pth_size)
+      pth_alloc(mm, mm->pth_size / 2);
+    return 0;
+  }
+
+  if (e->pte == 0)
+  {
+    if ((mm->pth_used + 1) * 4 > mm->pth_size * 3)
+    {
+      if (pth_alloc(mm, mm->pth_size * 2) < 0)
+        return -1;
+      e = pth_find(mm, pgn);
+    }
+    e->pgn = pgn;
+    mm->pth_used++;
+  }
+  e->pte = val;
+
+  return 0;
+}
+
+static pte_t pth_get(struct mm_struct *mm, addr_t pgn)
+{
+  return pth_find(mm, pgn)->pte;
+}
+
+/* Store a PTE value, keeping the table counters */
+static int pte_store(struct mm_struct *mm, addr_t pgn, pte_t clr, pte_t set)
+{
+  uint64_t *path[PT_LEVELS];
+  addr_t idx[PT_LEVELS];
+  uint64_t *pte, val;
+
+  if (mm->pth != NULL)
+    return pth_store(mm, pgn, clr, set);
+
+  pte = pt_walk(mm, pgn, (set != 0) ? PT_ALLOC : PT_WRITE, path, idx);
+  if (pte == NULL)
+    return (set != 0) ? -1 : 0; /* nothing to clear */
+
+  val = (*pte & ~clr) | set;
+  if (val == 0)
+  {
+    if (*pte != 0)
+      pt_clear(mm, path, idx);
+    return 0;
+  }
+
+  if (*pte == 0)
+    pt_mark(path[PT_LEVELS - 1], idx[PT_LEVELS - 1]);
+  *pte = val;
 
   return 0;
 }
 
 /*
- * pte_set_fpn - Set PTE entry for on-line page
- * @pte   : target page table entry (PTE)
- * @fpn   : frame page number (FPN)
+ * pt_for_each - Call fn on every non-zero PTE below a table
+ * @tbl  : table at level @lv
+ * @lv   : 0 for the PGD, PT_LEVELS - 1 for a PT
+ * @pgn  : first page number covered by @tbl
+ *
+ * Only populated entries are visited, in address order.
  */
-int pte_set_fpn(struct pcb_t *caller, addr_t pgn, addr_t fpn)
+static int pt_for_each(uint64_t *tbl, int lv, addr_t pgn,
+                       int (*fn)(addr_t pgn, pte_t pte, void *arg), void *arg)
 {
-  struct krnl_t *krnl = caller->krnl;
-
-  addr_t pgd_idx=0;
-  addr_t p4d_idx=0;
-  addr_t pud_idx=0;
-  addr_t pmd_idx=0;
-  addr_t pt_idx=0;
-	
-#ifdef MM64	
-  /* Get page directory indices from page number */
-  get_pd_from_pagenum(pgn, &pgd_idx, &p4d_idx, &pud_idx, &pmd_idx, &pt_idx);
-  
-  /* Navigate through page table hierarchy */
-  if (caller->mm->pgd == NULL)
+  struct pt_meta *m = pt_meta(tbl);
+  int shift = (PT_LEVELS - 1 - lv) * 9;
+  int w, ret;
+
+  for (w = 0; w < PT_MAPWORDS; w++)
+  {
+    uint64_t bits = m->map[w];
+
+    while (bits != 0)
+    {
+      addr_t i = w * 64 + __builtin_ctzll(bits);
+      addr_t sub = pgn | (i << shift);
+
+      bits &= bits - 1;
+      if (lv == PT_LEVELS - 1)
+        ret = fn(sub, (pte_t)tbl[i], arg);
+      else if (lv == PT_LEVELS - 2 && PT_HUGE(tbl[i]))
+      {
+        addr_t j;
+
+        for (j = 0, ret = 0; j < PT_ENTRIES && ret == 0; j++)
+          ret = fn(sub | j, pt_huge_pte(tbl[i], j), arg);
+      }
+      else
+        ret = pt_for_each((uint64_t *)(uintptr_t)tbl[i], lv + 1, sub, fn, arg);
+      if (ret != 0)
+        return ret;
+    }
+  }
+
+  return 0;
+}
+
+/* Give back every table below @tbl, then @tbl itself */
+static void pt_teardown(struct mm_struct *mm, uint64_t *tbl, int lv)
+{
+  struct pt_meta *m = pt_meta(tbl);
+  int w;
+
+  for (w = 0; w < PT_MAPWORDS; w++)
+  {
+    uint64_t bits = m->map[w];
+
+    while (bits != 0)
+    {
+      addr_t i = w * 64 + __builtin_ctzll(bits);
+
+      bits &= bits - 1;
+      if (lv < PT_LEVELS - 1 && !(lv == PT_LEVELS - 2 && PT_HUGE(tbl[i])))
+        pt_teardown(mm, (uint64_t *)(uintptr_t)tbl[i], lv + 1);
+      tbl[i] = 0;
+    }
+    m->map[w] = 0;
+  }
+  m->nr = 0;
+
+  pt_free(mm, tbl, 0);
+}
+
+/*
+ * pgtbl_for_each - Call fn on every non-zero PTE of a mm
+ * @mm  : memory management struct
+ * @fn  : callback, a non zero return stops the walk; it must not
+ *        change the page table
+ * @arg : callback argument
+ *
+ * The cost follows the populated tables, not the address space size.
+ * A hashed page table is visited in slot order.
+ */
+int pgtbl_for_each(struct mm_struct *mm, int (*fn)(addr_t pgn, pte_t pte, void *arg), void *arg)
+{
+  addr_t i;
+  int ret;
+
+  if (mm == NULL || !PT_LIVE(mm))
     return -1;
-  
-  /* Access or allocate P4D */
-  uint64_t **p4d_table = (uint64_t **)&caller->mm->pgd[pgd_idx];
-  if (*p4d_table == NULL)
+
+  if (mm->pth != NULL)
   {
-    *p4d_table = malloc(sizeof(uint64_t) * 512);
-    if (*p4d_table == NULL) return -1;
-    for (int i = 0; i < 512; i++) (*p4d_table)[i] = 0;
+    for (i = 0; i < mm->pth_size; i++)
+      if (mm->pth[i].pte != 0 && (ret = fn(mm->pth[i].pgn, mm->pth[i].pte, arg)) != 0)
+        return ret;
+    return 0;
   }
-  
-  /* Access or allocate PUD */
-  uint64_t **pud_table = (uint64_t **)&(*p4d_table)[p4d_idx];
-  if (*pud_table == NULL)
+
+  return pt_for_each(mm->pgd, 0, 0, fn, arg);
+}
+
+/*
+ * PTE range operations
+ *
+ * A range is walked from the PGD once per leaf table; the PTEs inside
+ * a leaf are then handled in one pass.
+ */
+
+/* Pages from pgn up to the end of its leaf table, at most npg */
+static addr_t pt_seg_len(addr_t pgn, addr_t npg)
+{
+  addr_t left = PT_ENTRIES - (pgn % PT_ENTRIES);
+
+  return (npg < left) ? npg : left;
+}
+
+/*
+ * pte_range_set_fpn - Map consecutive pages to a frame list
+ * @caller : caller
+ * @pgn    : first page number
+ * @pgnum  : number of pages
+ * @frames : frames, one per page; the mapping stops at the list end
+ *
+ * Return the number of pages mapped, -1 when a table cannot be made.
+ */
+int pte_range_set_fpn(struct pcb_t *caller, addr_t pgn, int pgnum,
+                      struct framephy_struct *frames)
+{
+  struct mm_struct *mm = caller->mm;
+  uint64_t *path[PT_LEVELS];
+  addr_t idx[PT_LEVELS];
+  addr_t left = pgnum, n, j;
+  int done = 0;
+
+  if (mm->pth != NULL)
   {
-    *pud_table = malloc(sizeof(uint64_t) * 512);
-    if (*pud_table == NULL) return -1;
-    for (int i = 0; i < 512; i++) (*pud_table)[i] = 0;
+    for (; done < pgnum && frames != NULL; done++, frames = frames->fp_next)
+      if (pte_set_fpn(caller, pgn + done, frames->fpn) < 0)
+        return -1;
+    return done;
   }
-  
-  /* Access or allocate PMD */
-  uint64_t **pmd_table = (uint64_t **)&(*pud_table)[pud_idx];
-  if (*pmd_table == NULL)
+  if (mm->pgd == NULL)
+    return -1;
+
+  while (left > 0 && frames != NULL)
   {
-    *pmd_table = malloc(sizeof(uint64_t) * 512);
-    if (*pmd_table == NULL) return -1;
-    for (int i = 0; i < 512; i++) (*pmd_table)[i] = 0;
+    uint64_t *pt;
+
+    if (pt_walk(mm, pgn, PT_ALLOC, path, idx) == NULL)
+      return -1;
+    pt = path[PT_LEVELS - 1];
+    n = pt_seg_len(pgn, left);
+
+    for (j = idx[PT_LEVELS - 1]; n > 0 && frames != NULL; j++, n--)
+    {
+      pte_t val = pt[j] & ~(PAGING_PTE_SWAPPED_MASK | PAGING_PTE_FPN_MASK);
+
+      SETBIT(val, PAGING_PTE_PRESENT_MASK);
+      SETVAL(val, frames->fpn, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT);
+      if (pt[j] == 0)
+        pt_mark(pt, j);
+      pt[j] = val;
+
+      frames = frames->fp_next;
+      pgn++;
+      left--;
+      done++;
+    }
   }
-  
-  /* Access or allocate PT */
-  uint64_t **pt_table = (uint64_t **)&(*pmd_table)[pmd_idx];
-  if (*pt_table == NULL)
+
+  return done;
+}
+
+/*
+ * pte_range_protect - Change bits of the populated PTEs of a range
+ * @caller : caller
+ * @pgn    : first page number
+ * @pgnum  : number of pages
+ * @clr    : bits to clear
+ * @set    : bits to set
+ *
+ * Empty PTEs are left alone; a PTE that ends up zero is cleared.
+ */
+int pte_range_protect(struct pcb_t *caller, addr_t pgn, int pgnum, pte_t clr, pte_t set)
+{
+  struct mm_struct *mm = caller->mm;
+  uint64_t *path[PT_LEVELS];
+  addr_t idx[PT_LEVELS];
+  addr_t left = pgnum, n, j;
+
+  if (mm->pth != NULL)
   {
-    *pt_table = malloc(sizeof(uint64_t) * 512);
-    if (*pt_table == NULL) return -1;
-    for (int i = 0; i < 512; i++) (*pt_table)[i] = 0;
+    for (j = 0; j < left; j++)
+    {
+      struct pgtbl_hent *e = pth_find(mm, pgn + j);
+
+      if (e->pte != 0)
+        pth_store(mm, pgn + j, clr, set);
+    }
+    return 0;
   }
-  
-  /* Get the actual PTE */
-  addr_t *pte = (addr_t *)&(*pt_table)[pt_idx];
-#else
-  addr_t *pte = &krnl->mm->pgd[pgn];
-#endif
+  if (mm->pgd == NULL)
+    return -1;
+
+  for (; left > 0; pgn += n, left -= n)
+  {
+    uint64_t *pt;
 
-  SETBIT(*pte, PAGING_PTE_PRESENT_MASK);
-  CLRBIT(*pte, PAGING_PTE_SWAPPED_MASK);
+    uint64_t *e;
 
-  SETVAL(*pte, fpn, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT);
+    n = pt_seg_len(pgn, left);
+    e = pt_walk(mm, pgn, PT_READ, path, idx);
+    if (e == NULL)
+      continue; /* no leaf table, nothing populated */
+    if (path[PT_LEVELS - 1] == NULL)
+    {
+      /* The dirty bit of a huge mapping covers the whole span */
+      if (((clr | set) & ~PAGING_PTE_DIRTY_MASK) == 0)
+      {
+        *e = (*e & ~clr) | set;
+        continue;
+      }
+      if (pt_walk(mm, pgn, PT_WRITE, path, idx) == NULL)
+        return -1;
+    }
+    pt = path[PT_LEVELS - 1];
+
+    for (j = idx[PT_LEVELS - 1]; j < idx[PT_LEVELS - 1] + n; j++)
+    {
+      if (pt[j] == 0)
+        continue;
+      if (((pt[j] & ~clr) | set) != 0)
+      {
+        pt[j] = (pt[j] & ~clr) | set;
+      }
+      else if (pt_meta(pt)->nr > 1)
+      {
+        pt[j] = 0;
+        pt_unmark(pt, j);
+      }
+      else
+      {
+        /* Last entry of the leaf, the tables it empties go back */
+        idx[PT_LEVELS - 1] = j;
+        pt_clear(mm, path, idx);
+        break;
+      }
+    }
+  }
 
   return 0;
 }
 
+/*
+ * pte_range_clear - Clear the PTEs of a range
+ * @caller : caller
+ * @pgn    : first page number
+ * @pgnum  : number of pages
+ *
+ * Tables emptied by the clear go back to the pool.
+ */
+int pte_range_clear(struct pcb_t *caller, addr_t pgn, int pgnum)
+{
+  return pte_range_protect(caller, pgn, pgnum, ~(pte_t)0, 0);
+}
+
+/*
+ * pte_range_for_each - Call fn on every PTE of a range
+ * @caller : caller
+ * @pgn    : first page number
+ * @pgnum  : number of pages
+ * @fn     : callback, gets 0 for an empty PTE; a non zero return stops
+ *           the walk; it must not change the page table
+ * @arg    : callback argument
+ */
+int pte_range_for_each(struct pcb_t *caller, addr_t pgn, int pgnum,
+                       int (*fn)(addr_t pgn, pte_t pte, void *arg), void *arg)
+{
+  struct mm_struct *mm = caller->mm;
+  uint64_t *path[PT_LEVELS];
+  addr_t idx[PT_LEVELS];
+  addr_t left = pgnum, n, j;
+  int ret;
+
+  if (mm->pth != NULL)
+  {
+    for (j = 0; j < left; j++)
+      if ((ret = fn(pgn + j, pth_get(mm, pgn + j), arg)) != 0)
+        return ret;
+    return 0;
+  }
+  if (mm->pgd == NULL)
+    return -1;
+
+  for (; left > 0; left -= n)
+  {
+    uint64_t *pt = NULL, *e;
+    pte_t huge = 0;
+
+    n = pt_seg_len(pgn, left);
+    if ((e = pt_walk(mm, pgn, PT_READ, path, idx)) != NULL)
+    {
+      if (path[PT_LEVELS - 1] == NULL)
+        huge = *e;
+      else
+        pt = path[PT_LEVELS - 1] + idx[PT_LEVELS - 1];
+    }
+
+    for (j = 0; j < n; j++, pgn++)
+    {
+      pte_t pte = pt ? (pte_t)pt[j] : (huge ? pt_huge_pte(huge, pgn) : 0);
+
+      if ((ret = fn(pgn, pte, arg)) != 0)
+        return ret;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * pte_set_swap - Set PTE entry for swapped page
+ * @pte    : target page table entry (PTE)
+ * @swptyp : swap type
+ * @swpoff : swap offset
+ */
+int pte_set_swap(struct pcb_t *caller, addr_t pgn, int swptyp, addr_t swpoff)
+{
+  pte_t set = PAGING_PTE_PRESENT_MASK | PAGING_PTE_SWAPPED_MASK;
+
+  if (!PT_LIVE(caller->mm))
+    return -1;
+
+  SETVAL(set, (pte_t)swptyp, PAGING_PTE_SWPTYP_MASK, PAGING_PTE_SWPTYP_LOBIT);
+  SETVAL(set, swpoff, PAGING_PTE_SWPOFF_MASK, PAGING_PTE_SWPOFF_LOBIT);
+
+  return pte_store(caller->mm, pgn,
+                   PAGING_PTE_SWPTYP_MASK | PAGING_PTE_SWPOFF_MASK, set);
+}
+
+/*
+ * pte_set_fpn - Set PTE entry for on-line page
+ * @pte   : target page table entry (PTE)
+ * @fpn   : frame page number (FPN)
+ */
+int pte_set_fpn(struct pcb_t *caller, addr_t pgn, addr_t fpn)
+{
+  pte_t set = PAGING_PTE_PRESENT_MASK;
+
+  if (!PT_LIVE(caller->mm))
+    return -1;
+
+  SETVAL(set, fpn, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT);
+
+  return pte_store(caller->mm, pgn,
+                   PAGING_PTE_SWAPPED_MASK | PAGING_PTE_FPN_MASK, set);
+}
+
 
 /* Get PTE page table entry
  * @caller : caller
@@ -255,107 +914,117 @@ int pte_set_fpn(struct pcb_t *caller, addr_t pgn, addr_t fpn)
  **/
 pte_t pte_get_entry(struct pcb_t *caller, addr_t pgn)
 {
-  struct krnl_t *krnl = caller->krnl;
-  pte_t pte = 0;
-  addr_t pgd_idx=0;
-  addr_t p4d_idx=0;
-  addr_t pud_idx=0;
-  addr_t pmd_idx=0;
-  addr_t pt_idx=0;
-	
-  /* Perform multi-level page mapping */
-  get_pd_from_pagenum(pgn, &pgd_idx, &p4d_idx, &pud_idx, &pmd_idx, &pt_idx);
-  
-  /* Navigate through page table hierarchy */
-  if (caller->mm->pgd == NULL)
-    return 0;
-  
-  /* Check P4D */
-  uint64_t **p4d_table = (uint64_t **)&caller->mm->pgd[pgd_idx];
-  if (*p4d_table == NULL)
-    return 0;
-  
-  /* Check PUD */
-  uint64_t **pud_table = (uint64_t **)&(*p4d_table)[p4d_idx];
-  if (*pud_table == NULL)
-    return 0;
-  
-  /* Check PMD */
-  uint64_t **pmd_table = (uint64_t **)&(*pud_table)[pud_idx];
-  if (*pmd_table == NULL)
-    return 0;
-  
-  /* Check PT */
-  uint64_t **pt_table = (uint64_t **)&(*pmd_table)[pmd_idx];
-  if (*pt_table == NULL)
+  uint64_t *path[PT_LEVELS];
+  addr_t idx[PT_LEVELS];
+  uint64_t *pte;
+
+  if (caller->mm->pth != NULL)
+    return pth_get(caller->mm, pgn);
+
+  pte = pt_walk(caller->mm, pgn, PT_READ, path, idx);
+  if (pte == NULL)
     return 0;
-  
-  /* Get the actual PTE */
-  pte = (pte_t)(*pt_table)[pt_idx];
-	
-  return pte;
+  if (path[PT_LEVELS - 1] == NULL)
+    return pt_huge_pte(*pte, pgn);
+
+  return (pte_t)*pte;
 }
 
 /* Set PTE page table entry
  * @caller : caller
  * @pgn    : page number
  * @pte_val: page table entry value (64-bit in MM64 mode)
+ *
+ * A zero value clears the entry and gives back the tables it empties.
  **/
 int pte_set_entry(struct pcb_t *caller, addr_t pgn, pte_t pte_val)
 {
-  struct krnl_t *krnl = caller->krnl;
-  
-  addr_t pgd_idx=0;
-  addr_t p4d_idx=0;
-  addr_t pud_idx=0;
-  addr_t pmd_idx=0;
-  addr_t pt_idx=0;
+  if (!PT_LIVE(caller->mm))
+    return -1;
 
-  /* Get page directory indices */
-  get_pd_from_pagenum(pgn, &pgd_idx, &p4d_idx, &pud_idx, &pmd_idx, &pt_idx);
+  return pte_store(caller->mm, pgn, ~(pte_t)0, pte_val);
+}
 
-  /* Navigate through page table hierarchy */
-  if (caller->mm->pgd == NULL)
+/*
+ * pte_set_huge - Map a 2 MiB span with one PMD entry
+ * @caller : caller
+ * @pgn    : first page of the span, PAGING_HUGE_NRPG aligned
+ * @fpn    : first of PAGING_HUGE_NRPG contiguous frames, aligned too
+ *
+ * Return -1 when a PT already covers part of the span.
+ */
+int pte_set_huge(struct pcb_t *caller, addr_t pgn, addr_t fpn)
+{
+  struct mm_struct *mm = caller->mm;
+  uint64_t *path[PT_LEVELS];
+  addr_t idx[PT_LEVELS];
+  uint64_t *pmd, e = 0;
+
+  if (mm->pgd == NULL || (pgn | fpn) % PAGING_HUGE_NRPG != 0)
     return -1;
-  
-  /* Access or allocate P4D */
-  uint64_t **p4d_table = (uint64_t **)&caller->mm->pgd[pgd_idx];
-  if (*p4d_table == NULL)
-  {
-    *p4d_table = malloc(sizeof(uint64_t) * 512);
-    if (*p4d_table == NULL) return -1;
-    for (int i = 0; i < 512; i++) (*p4d_table)[i] = 0;
-  }
 
-  /* Access or allocate PUD */
-  uint64_t **pud_table = (uint64_t **)&(*p4d_table)[p4d_idx];
-  if (*pud_table == NULL)
-  {
-    *pud_table = malloc(sizeof(uint64_t) * 512);
-    if (*pud_table == NULL) return -1;
-    for (int i = 0; i < 512; i++) (*pud_table)[i] = 0;
-  }
+  get_pd_from_pagenum(pgn, &idx[0], &idx[1], &idx[2], &idx[3], &idx[4]);
+  pmd = pt_descend(mm, PT_ALLOC, path, idx, PT_LEVELS - 2);
+  if (pmd == NULL || pmd[idx[PT_LEVELS - 2]] != 0)
+    return -1;
 
-  /* Access or allocate PMD */
-  uint64_t **pmd_table = (uint64_t **)&(*pud_table)[pud_idx];
-  if (*pmd_table == NULL)
-  {
-    *pmd_table = malloc(sizeof(uint64_t) * 512);
-    if (*pmd_table == NULL) return -1;
-    for (int i = 0; i < 512; i++) (*pmd_table)[i] = 0;
-  }
+  SETBIT(e, PAGING_PTE_PRESENT_MASK | PAGING_PTE_HUGE_MASK);
+  SETVAL(e, fpn, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT);
+  pmd[idx[PT_LEVELS - 2]] = e;
+  pt_mark(pmd, idx[PT_LEVELS - 2]);
 
-  /* Access or allocate PT */
-  uint64_t **pt_table = (uint64_t **)&(*pmd_table)[pmd_idx];
-  if (*pt_table == NULL)
-  {
-    *pt_table = malloc(sizeof(uint64_t) * 512);
-    if (*pt_table == NULL) return -1;
-    for (int i = 0; i < 512; i++) (*pt_table)[i] = 0;
-  }
+  return 0;
+}
+
+/*
+ * pte_split_huge - Turn the huge mapping holding a page into 512 PTEs
+ * @caller : caller
+ * @pgn    : any page of the span
+ *
+ * Return 1 if a huge mapping was split, 0 if there was none.
+ */
+int pte_split_huge(struct pcb_t *caller, addr_t pgn)
+{
+  uint64_t *path[PT_LEVELS];
+  addr_t idx[PT_LEVELS];
+
+  if (pt_walk(caller->mm, pgn, PT_READ, path, idx) == NULL ||
+      path[PT_LEVELS - 1] != NULL)
+    return 0;
+
+  return (pt_walk(caller->mm, pgn, PT_WRITE, path, idx) != NULL) ? 1 : -1;
+}
+
+/*
+ * pgtbl_bytes - Memory held by the page table of a mm
+ * @mm : memory management struct
+ */
+unsigned long pgtbl_bytes(struct mm_struct *mm)
+{
+  if (mm == NULL)
+    return 0;
+  if (mm->pth != NULL)
+    return mm->pth_size * sizeof(struct pgtbl_hent);
 
-  /* Set the PTE value */
-  (*pt_table)[pt_idx] = (uint64_t)pte_val;
+  return mm->pt_pages * PT_PAGESZ;
+}
+
+/*
+ * pgtbl_report - Print the page-table page pool counters
+ */
+int pgtbl_report(void)
+{
+  pthread_mutex_lock(&ptpool.lock);
+  printf("Page Table Pages: %lu in use, %lu pooled, %lu reclaimed (%lu KB reserved)\n",
+         ptpool.nchunk * (PTPOOL_CHUNK_PAGES - 1) - ptpool.nfree, ptpool.nfree,
+         ptpool.reclaim, ptpool.nchunk * (unsigned long)PTPOOL_CHUNK_SZ / 1024);
+  pthread_mutex_unlock(&ptpool.lock);
+  printf("Page Walks: %lu, %.2f levels per walk (%.1f%% page-walk cache hits)\n",
+         ptwalk.walks, ptwalk.walks ? (double)ptwalk.levels / ptwalk.walks : 0.0,
+         ptwalk.walks ? 100.0 * ptwalk.pwc_hit / ptwalk.walks : 0.0);
+  if (ptwalk.hlookups > 0)
+    printf("Hashed Page Table Lookups: %lu, %.2f slots per lookup\n",
+           ptwalk.hlookups, (double)ptwalk.hprobes / ptwalk.hlookups);
 
   return 0;
 }
@@ -368,24 +1037,8 @@ int vmap_pgd_memset(struct pcb_t *caller,           // process call
                     addr_t addr,                       // start address which is aligned to pagesz
                     int pgnum)                      // num of mapping page
 {
-  int pgit = 0;
-  addr_t pgn;
-
-  /* Initialize page table entries for the given range */
-  for (pgit = 0; pgit < pgnum; pgit++)
-  {
-    /* Calculate page number from address */
-    pgn = PAGING_PGN(addr + pgit * PAGING_PAGESZ);
-    
-    /* Initialize PTE with default values (not present, not swapped) */
-    pte_t pte_val = 0;
-    if (pte_set_entry(caller, pgn, pte_val) < 0)
-    {
-      return -1; /* Failed to set PTE */
-    }
-  }
-
-  return 0;
+  /* Reset the PTEs of the range (not present, not swapped) */
+  return pte_range_clear(caller, PAGING_PGN(addr), pgnum);
 }
 
 /*
@@ -408,21 +1061,22 @@ addr_t vmap_page_range(struct pcb_t *caller,           // process call
     ret_rg->rg_end = addr + pgnum * PAGING_PAGESZ;
   }
 
-  /* Map range of frames to address space [addr to addr + pgnum*PAGING_PAGESZ] */
-  for (pgit = 0; pgit < pgnum && fpit != NULL; pgit++)
+  /* Map range of frames to address space [addr to addr + pgnum*PAGING_PAGESZ],
+   * one walk per leaf table */
+  pgnum = pte_range_set_fpn(caller, PAGING_PGN(addr), pgnum, frames);
+  if (pgnum < 0)
+    return -1; /* Failed to set PTE */
+  if (ret_rg != NULL)
+    ret_rg->rg_end = addr + pgnum * PAGING_PAGESZ;
+
+  for (pgit = 0; pgit < pgnum; pgit++)
   {
-    /* Calculate page number from address */
-    pgn = PAGING_PGN(addr + pgit * PAGING_PAGESZ);
-    
-    /* Set the page table entry to map page to frame */
-    if (pte_set_fpn(caller, pgn, fpit->fpn) < 0)
-    {
-      return -1; /* Failed to set PTE */
-    }
-    
+    pgn = PAGING_PGN(addr) + pgit;
+
     /* Tracking for later page replacement activities (if needed)
      * Enqueue new usage page */
-    enlist_pgn_node(&caller->mm->fifo_pgn, pgn);
+    MEMPHY_rmap_set(caller->krnl->mram, fpit->fpn, caller->mm, pgn);
+    pgrepl_insert(caller->mm, pgn);
     
     /* Move to next frame */
     fpit = fpit->fp_next;
@@ -441,22 +1095,28 @@ addr_t vmap_page_range(struct pcb_t *caller,           // process call
 addr_t alloc_pages_range(struct pcb_t *caller, int req_pgnum, struct framephy_struct **frm_lst)
 {
   addr_t fpn;
-  int pgit;
+  int pgit, run, i;
   struct framephy_struct *newfp_str = NULL;
   struct framephy_struct *last_fp = NULL;
 
-  /* Allocate the requested number of frames */
-  for (pgit = 0; pgit < req_pgnum; pgit++)
+  /* Allocate the requested number of frames, in physically contiguous
+   * runs when the buddy allocator has them */
+  for (pgit = 0; pgit < req_pgnum; pgit += run)
   {
-    /* Try to get a free frame from RAM */
-    if (MEMPHY_get_freefp(caller->krnl->mram, &fpn) == 0)
+    run = MEMPHY_get_freefp_range(caller->krnl->mram, req_pgnum - pgit, &fpn);
+    if (run < 0)
+    {
+      /* Failed to get frame - need swapping or out of memory */
+      return -3000; /* Out of memory error code */
+    }
+
+    for (i = 0; i < run; i++)
     {
-      /* Successfully got a frame */
       newfp_str = malloc(sizeof(struct framephy_struct));
       if (newfp_str == NULL)
         return -1; /* Memory allocation failed */
       
-      newfp_str->fpn = fpn;
+      newfp_str->fpn = fpn + i;
       newfp_str->fp_next = NULL;
       newfp_str->owner = caller->mm;
       
@@ -472,12 +1132,6 @@ addr_t alloc_pages_range(struct pcb_t *caller, int req_pgnum, struct framephy_st
         last_fp = newfp_str;
       }
     }
-    else
-    {
-      /* Failed to get frame - need swapping or out of memory */
-      /* TODO: Implement page swapping mechanism */
-      return -3000; /* Out of memory error code */
-    }
   }
 
   return 0;
@@ -494,9 +1148,10 @@ addr_t alloc_pages_range(struct pcb_t *caller, int req_pgnum, struct framephy_st
  */
 addr_t vm_map_ram(struct pcb_t *caller, addr_t astart, addr_t aend, addr_t mapstart, int incpgnum, struct vm_rg_struct *ret_rg)
 {
-  struct framephy_struct *frm_lst = NULL;
-  addr_t ret_alloc = 0;
-//  int pgnum = incpgnum;
+  struct framephy_struct *frm_lst = NULL, *fp;
+  struct vm_rg_struct rg;
+  addr_t ret_alloc = 0, mapped = 0;
+  int ret = 0;
 
   /*@bksysnet: author provides a feasible solution of getting frames
    *FATAL logic in here, wrong behaviour if we have not enough page
@@ -504,23 +1159,43 @@ addr_t vm_map_ram(struct pcb_t *caller, addr_t astart, addr_t aend, addr_t mapst
    *Don't try to perform that case in this simple work, it will result
    *in endless procedure of swap-off to get frame and we have not provide
    *duplicate control mechanism, keep it simple
+   *
+   * Nothing is swapped out here: the caller only maps eagerly when
+   * MEMRAM has the frames, and fails over to the fault otherwise.
    */
-  // ret_alloc = alloc_pages_range(caller, pgnum, &frm_lst);
-
-  if (ret_alloc < 0 && ret_alloc != -3000)
-    return -1;
+  ret_alloc = alloc_pages_range(caller, incpgnum, &frm_lst);
 
-  /* Out of memory */
-  if (ret_alloc == -3000)
+  if (ret_alloc == 0)
   {
-    return -1;
+    /* New frames are zero-filled, as the fault does it */
+    for (fp = frm_lst; fp != NULL; fp = fp->fp_next)
+      MEMPHY_zero_page(caller->krnl->mram, fp->fpn);
+
+    if (vmap_page_range(caller, mapstart, incpgnum, frm_lst, &rg) == 0)
+      mapped = (rg.rg_end - rg.rg_start) / PAGING_PAGESZ;
+    if (ret_rg != NULL)
+    {
+      ret_rg->rg_start = rg.rg_start;
+      ret_rg->rg_end = rg.rg_end;
+    }
   }
 
-  /* it leaves the case of memory is enough but half in ram, half in swap
-   * do the swaping all to swapper to get the all in ram */
-   vmap_page_range(caller, mapstart, incpgnum, frm_lst, ret_rg);
+  /* Out of memory, or part of the range could not be mapped */
+  if (ret_alloc != 0 || mapped < (addr_t)incpgnum)
+    ret = -1;
 
-  return 0;
+  /* Frames left unmapped go back to MEMRAM, the list itself is freed */
+  while ((fp = frm_lst) != NULL)
+  {
+    frm_lst = fp->fp_next;
+    if (mapped > 0)
+      mapped--;
+    else
+      MEMPHY_put_freefp(caller->krnl->mram, fp->fpn);
+    free(fp);
+  }
+
+  return ret;
 }
 
 /* Swap copy content page from source frame to destination frame
@@ -532,19 +1207,8 @@ addr_t vm_map_ram(struct pcb_t *caller, addr_t astart, addr_t aend, addr_t mapst
 int __swap_cp_page(struct memphy_struct *mpsrc, addr_t srcfpn,
                    struct memphy_struct *mpdst, addr_t dstfpn)
 {
-  int cellidx;
-  addr_t addrsrc, addrdst;
-  for (cellidx = 0; cellidx < PAGING_PAGESZ; cellidx++)
-  {
-    addrsrc = srcfpn * PAGING_PAGESZ + cellidx;
-    addrdst = dstfpn * PAGING_PAGESZ + cellidx;
-
-    BYTE data;
-    MEMPHY_read(mpsrc, addrsrc, &data);
-    MEMPHY_write(mpdst, addrdst, data);
-  }
-
-  return 0;
+  /* Whole page at once instead of PAGING_PAGESZ single byte accesses */
+  return MEMPHY_copy_page(mpsrc, srcfpn, mpdst, dstfpn);
 }
 
 /*
@@ -561,23 +1225,26 @@ int init_mm(struct mm_struct *mm, struct pcb_t *caller)
 
   /* Initialize page table directory - allocate page tables */
   /* For 64-bit 5-level paging */
-  mm->pgd = malloc(sizeof(uint64_t) * 512); // 512 entries for PGD
+  mm->pt_pages = 0;
+  mm->pwc_on = caller->krnl->mmparam.pwc;
+  memset(mm->pwc, 0, sizeof(mm->pwc));
+  mm->pgd = NULL;
+  mm->pth = NULL;
+  mm->pth_size = mm->pth_used = 0;
+  if (caller->krnl->mmparam.pgtbl == PGTBL_HASH)
+    pth_alloc(mm, PTH_MIN_SLOTS);
+  else
+    mm->pgd = pt_alloc(mm); // 512 entries for PGD
   mm->p4d = NULL; // Allocated on demand
   mm->pud = NULL; // Allocated on demand  
   mm->pmd = NULL; // Allocated on demand
   mm->pt = NULL;  // Allocated on demand
   
-  if (mm->pgd == NULL)
+  if (!PT_LIVE(mm))
   {
     free(vma0);
     return -1;
   }
-  
-  /* Initialize page table entries to 0 */
-  for (int i = 0; i < 512; i++)
-  {
-    mm->pgd[i] = 0;
-  }
 
   /* By default the owner comes with at least one vma (heap/data segment) */
   vma0->vm_id = 0;
@@ -585,42 +1252,38 @@ int init_mm(struct mm_struct *mm, struct pcb_t *caller)
   vma0->vm_end = vma0->vm_start;
   vma0->sbrk = vma0->vm_start;
   
-  /* Initialize the free region list */
-  struct vm_rg_struct *first_rg = init_vm_rg(vma0->vm_start, vma0->vm_end);
-  if (first_rg == NULL)
-  {
-    free(mm->pgd);
-    free(vma0);
-    return -1;
-  }
-  enlist_vm_rg_node(&vma0->vm_freerg_list, first_rg);
-
-  /* Initialize VMA next pointer - initially no next VMA */
-  vma0->vm_next = NULL;
+  /* Initialize the free region list, empty until the heap grows */
+  vm_freerg_init(vma0);
 
-  /* Point vma owner backward */
-  vma0->vm_mm = mm; 
-
-  /* Update mmap to point to the first VMA */
-  mm->mmap = vma0;
+  /* The heap area is the first one of an empty index */
+  vm_mmap_init(mm);
+  add_vm_area(mm, vma0);
+  
+  /* Swap readahead starts with the faulting page only */
+  mm->ra_win = 1;
+  mm->ra_next = 0;
   
-  /* Initialize symbol region table */
-  for (int i = 0; i < PAGING_MAX_SYMTBL_SZ; i++)
+  /* Initialize the symbol region table, it grows with the region IDs
+   * used, and the resident page tracking for page replacement */
+  if (symrg_init(mm) < 0 ||
+      pgrepl_init(mm, caller->krnl->mmparam.pgrepl,
+                  caller->krnl->mmparam.pgscope == PGSCOPE_GLOBAL ? &caller->krnl->pgrepl : NULL) < 0)
   {
-    mm->symrgtbl[i].rg_start = 0;
-    mm->symrgtbl[i].rg_end = 0;
-    mm->symrgtbl[i].rg_next = NULL;
+    if (mm->pgd != NULL)
+      pt_free(mm, mm->pgd, 0);
+    free(mm->pth);
+    free(vma0);
+    vm_mmap_init(mm);
+    symrg_release(mm);
+    return -1;
   }
-  
-  /* Initialize FIFO page list for page replacement */
-  mm->fifo_pgn = NULL;
 
   return 0;
 }
 
 struct vm_rg_struct *init_vm_rg(addr_t rg_start, addr_t rg_end)
 {
-  struct vm_rg_struct *rgnode = malloc(sizeof(struct vm_rg_struct));
+  struct vm_rg_struct *rgnode = kmem_cache_alloc(KMEM_VM_RG);
 
   rgnode->rg_start = rg_start;
   rgnode->rg_end = rg_end;
@@ -711,43 +1374,9 @@ int print_list_pgn(struct pgn_t *ip)
 }
 
 
-// Redefining cleanly:
-
-static void print_pgtbl_recursive(struct pcb_t *caller, uint64_t *table, int level, uint64_t virtual_addr_base, 
-                                  uint64_t pgd_val, uint64_t p4d_val, uint64_t pud_val, uint64_t pmd_val)
-{
-    int i;
-    if (table == NULL) return;
-
-    for (i = 0; i < 512; i++) {
-         if (table[i] == 0) continue;
-
-         uint64_t entry_val = table[i];
-         int shift = 12 + (4 - level) * 9; 
-         uint64_t current_va = virtual_addr_base | ((uint64_t)i << shift);
-
-         if (level == 0) { // PGD Loop. entry_val is PGD Entry.
-             print_pgtbl_recursive(caller, (uint64_t*)entry_val, level + 1, current_va, entry_val, 0, 0, 0);
-         }
-         else if (level == 1) { // P4D Loop. entry_val is P4D Entry.
-             print_pgtbl_recursive(caller, (uint64_t*)entry_val, level + 1, current_va, pgd_val, entry_val, 0, 0);
-         }
-         else if (level == 2) { // PUD Loop. entry_val is PUD Entry.
-             print_pgtbl_recursive(caller, (uint64_t*)entry_val, level + 1, current_va, pgd_val, p4d_val, entry_val, 0);
-         }
-         else if (level == 3) { // PMD Loop. entry_val is PMD Entry.
-             print_pgtbl_recursive(caller, (uint64_t*)entry_val, level + 1, current_va, pgd_val, p4d_val, pud_val, entry_val);
-         }
-         else if (level == 4) { // PT Loop. entry_val is PTE.
-             // We have pgd_val, p4d_val, pud_val, pmd_val from args.
-             printf(" PDG=%016llx P4g=%016llx PUD=%016llx PMD=%016llx\n", pgd_val, p4d_val, pud_val, pmd_val);
-         }
-    }
-}
-
 int print_pgtbl(struct pcb_t *caller, addr_t start, addr_t end)
 {
-  if (caller == NULL || caller->mm == NULL || caller->mm->pgd == NULL) return -1;
+  if (caller == NULL || caller->mm == NULL || !PT_LIVE(caller->mm)) return -1;
   
   printf("print_pgtbl:\n");
   
@@ -785,57 +1414,23 @@ int print_pgtbl(struct pcb_t *caller, addr_t start, addr_t end)
  * free_mm - Free all memory management structures
  * @mm: memory management struct to free
  * 
- * This function recursively frees all 5-level page tables and VMAs
+ * This function frees all 5-level page tables and VMAs
  */
 int free_mm(struct mm_struct *mm)
 {
-  int i, j, k, l;
-  
   if (mm == NULL)
     return -1;
   
-  /* Free 5-level page tables recursively */
+  /* Free the page tables, populated entries only */
   if (mm->pgd != NULL)
   {
-    for (i = 0; i < 512; i++)
-    {
-      uint64_t **p4d_table = (uint64_t **)&mm->pgd[i];
-      if (*p4d_table != NULL)
-      {
-        for (j = 0; j < 512; j++)
-        {
-          uint64_t **pud_table = (uint64_t **)&(*p4d_table)[j];
-          if (*pud_table != NULL)
-          {
-            for (k = 0; k < 512; k++)
-            {
-              uint64_t **pmd_table = (uint64_t **)&(*pud_table)[k];
-              if (*pmd_table != NULL)
-              {
-                for (l = 0; l < 512; l++)
-                {
-                  uint64_t **pt_table = (uint64_t **)&(*pmd_table)[l];
-                  if (*pt_table != NULL)
-                  {
-                    free(*pt_table);
-                    *pt_table = NULL;
-                  }
-                }
-                free(*pmd_table);
-                *pmd_table = NULL;
-              }
-            }
-            free(*pud_table);
-            *pud_table = NULL;
-          }
-        }
-        free(*p4d_table);
-        *p4d_table = NULL;
-      }
-    }
-    free(mm->pgd);
+    pt_teardown(mm, mm->pgd, 0);
     mm->pgd = NULL;
   }
+  free(mm->pth);
+  mm->pth = NULL;
+  mm->pth_size = mm->pth_used = 0;
+  memset(mm->pwc, 0, sizeof(mm->pwc));
   
   /* Free VMAs */
   struct vm_area_struct *vma = mm->mmap;
@@ -848,24 +1443,18 @@ int free_mm(struct mm_struct *mm)
     while (rg != NULL)
     {
       struct vm_rg_struct *next_rg = rg->rg_next;
-      free(rg);
+      kmem_cache_free(KMEM_VM_RG, rg);
       rg = next_rg;
     }
     
     free(vma);
     vma = next_vma;
   }
-  mm->mmap = NULL;
+  vm_mmap_init(mm);
+  symrg_release(mm);
   
-  /* Free FIFO page list */
-  struct pgn_t *pgn = mm->fifo_pgn;
-  while (pgn != NULL)
-  {
-    struct pgn_t *next_pgn = pgn->pg_next;
-    free(pgn);
-    pgn = next_pgn;
-  }
-  mm->fifo_pgn = NULL;
+  /* Free page replacement state */
+  pgrepl_release(mm);
   
   return 0;
 }
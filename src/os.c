@@ -19,8 +19,8 @@ static int done = 0;
 static struct krnl_t os;
 
 #ifdef MM_PAGING
-static int memramsz;
-static int memswpsz[PAGING_MAX_MMSWP];
+static uint64_t memramsz;
+static uint64_t memswpsz[PAGING_MAX_MMSWP];
 
 struct mmpaging_ld_args {
 	/* A dispatched argument struct to compact many-fields passing to loader */
@@ -59,6 +59,15 @@ static void sigsegv_handler(int sig)
 }
 
 
+/* Slots the process still has to wait on a device */
+static inline uint32_t proc_io_wait(struct pcb_t * proc) {
+#ifdef MM_PAGING
+	return proc->io_stall;
+#else
+	return 0;
+#endif
+}
+
 static void * cpu_routine(void * args) {
 	struct timer_id_t * timer_id = ((struct cpu_args*)args)->timer_id;
 	int id = ((struct cpu_args*)args)->id;
@@ -81,10 +90,26 @@ static void * cpu_routine(void * args) {
 				next_slot(timer_id);
 				continue; /* First load failed. skip dummy load */
 			}
-		}else if (proc->pc == proc->code->size) {
+		}else if (proc->pc == proc->code->size && proc_io_wait(proc) == 0) {
 			/* The porcess has finish it job */
 			printf("\tCPU %d: Processed %2d has finished\n",
 				id ,proc->pid);
+#ifdef MM_PAGING
+			if (os.mmparam.stat) {
+				unsigned long ptb = pgtbl_bytes(proc->mm);
+
+				printf("\tCPU %d: Process %2d page table: %lu bytes\n",
+					id, proc->pid, ptb);
+				os.mmstat.pt_procs++;
+				os.mmstat.pt_bytes += ptb;
+				if (ptb > os.mmstat.pt_bytes_max)
+					os.mmstat.pt_bytes_max = ptb;
+			}
+			/* Give back its frames, swap slots and page tables */
+			free_pcb_memph(proc);
+			free_mm(proc->mm);
+			free(proc->mm);
+#endif
 			free(proc);
 			proc = get_proc();
 			time_left = 0;
@@ -116,7 +141,22 @@ static void * cpu_routine(void * args) {
 		}
 		
 		/* Run current process */
+#ifdef MM_PAGING
+		if (proc->io_stall > 0) {
+			/* Still waiting on a device, the slot goes by idle */
+			proc->io_stall--;
+			os.mmstat.io_stall++;
+		} else {
+			uint64_t slotns = os.mmparam.slotus * 1000;
+
+			run(proc);
+			proc->io_ns += MEMPHY_io_take();
+			proc->io_stall = proc->io_ns / slotns;
+			proc->io_ns %= slotns;
+		}
+#else
 		run(proc);
+#endif
 		
 		/* Signal next CPU after completing scheduling work and running process */
 		signal_next_cpu(id);
@@ -170,6 +210,7 @@ static void * ld_routine(void * args) {
 		krnl->mram = mram;
 		krnl->mswp = mswp;
 		krnl->active_mswp = active_mswp;
+		krnl->active_mswp_id = ((struct mmpaging_ld_args *)args)->active_mswp_id;
 #endif
 		printf("\tLoaded a process at %s, PID: %d PRIO: %ld\n",
 			ld_processes.path[i], proc->pid, ld_processes.prio[i]);
@@ -190,6 +231,139 @@ static void * ld_routine(void * args) {
 	pthread_exit(NULL);
 }
 
+#ifdef MM_PAGING
+/* Kernel parameters follow the configure file as name=value pairs */
+/* Per swap device values "v0,v1,...", the last one repeats */
+static void read_kparam_list(const char * val, unsigned long * list) {
+	char * end;
+	int sit = 0;
+
+	do {
+		list[sit++] = strtoul(val, &end, 0);
+		val = end + 1;
+	} while (*end == ',' && sit < PAGING_MAX_MMSWP);
+
+	for (; sit < PAGING_MAX_MMSWP; sit++)
+		list[sit] = list[sit - 1];
+}
+
+static void read_kparams(int argc, char * argv[]) {
+	char name[32], val[32];
+	int i;
+
+	os.mmparam.pgrepl = PGREPL_FIFO;
+	os.mmparam.pgscope = PGSCOPE_LOCAL;
+	os.mmparam.swpsel = SWPSEL_PRIO;
+	os.mmparam.swapra = 1;
+	os.mmparam.zswap = 0;
+	os.mmparam.kswapd = 0;
+	os.mmparam.wmark_low = 0;
+	os.mmparam.wmark_high = 0;
+	os.mmparam.stat = 0;
+	os.mmparam.swpfile = NULL;
+	os.mmparam.swpstream = 0;
+	os.mmparam.pwc = 1;
+	os.mmparam.pgtbl = PGTBL_RADIX;
+	os.mmparam.thp = 0;
+	os.mmparam.pagesz = PAGING_PAGESZ_DEFAULT;
+	os.mmparam.slotus = 1000;
+	os.mmparam.ramlat = 0;
+	os.mmparam.rambw = 0;
+	memset(os.mmparam.swplat, 0, sizeof(os.mmparam.swplat));
+	memset(os.mmparam.swpbw, 0, sizeof(os.mmparam.swpbw));
+
+	for (i = 2; i < argc; i++) {
+		if (sscanf(argv[i], "%31[^=]=%31s", name, val) != 2) {
+			printf("Invalid kernel parameter '%s'\n", argv[i]);
+			exit(1);
+		}
+		if (!strcmp(name, "pgrepl")) {
+			os.mmparam.pgrepl = pgrepl_policy_by_name(val);
+			if (os.mmparam.pgrepl < 0) {
+				printf("Unknown page replacement policy '%s'\n", val);
+				exit(1);
+			}
+		} else if (!strcmp(name, "pgscope")) {
+			if (!strcmp(val, "local"))
+				os.mmparam.pgscope = PGSCOPE_LOCAL;
+			else if (!strcmp(val, "global"))
+				os.mmparam.pgscope = PGSCOPE_GLOBAL;
+			else {
+				printf("Unknown victim scope '%s'\n", val);
+				exit(1);
+			}
+		} else if (!strcmp(name, "swpsel")) {
+			if (!strcmp(val, "prio"))
+				os.mmparam.swpsel = SWPSEL_PRIO;
+			else if (!strcmp(val, "stripe"))
+				os.mmparam.swpsel = SWPSEL_STRIPE;
+			else {
+				printf("Unknown swap selection '%s'\n", val);
+				exit(1);
+			}
+		} else if (!strcmp(name, "swapra")) {
+			os.mmparam.swapra = atoi(val);
+		} else if (!strcmp(name, "zswap")) {
+			os.mmparam.zswap = strtoul(val, NULL, 0);
+		} else if (!strcmp(name, "kswapd")) {
+			os.mmparam.kswapd = atoi(val);
+		} else if (!strcmp(name, "wmark_low")) {
+			os.mmparam.wmark_low = atoi(val);
+		} else if (!strcmp(name, "wmark_high")) {
+			os.mmparam.wmark_high = atoi(val);
+		} else if (!strcmp(name, "mmstat")) {
+			os.mmparam.stat = atoi(val);
+		} else if (!strcmp(name, "swpfile")) {
+			/* Keep the whole path, val is cut at 31 chars */
+			os.mmparam.swpfile = strchr(argv[i], '=') + 1;
+		} else if (!strcmp(name, "swpstream")) {
+			os.mmparam.swpstream = atoi(val);
+		} else if (!strcmp(name, "pwc")) {
+			os.mmparam.pwc = atoi(val);
+		} else if (!strcmp(name, "pgtbl")) {
+			if (!strcmp(val, "radix"))
+				os.mmparam.pgtbl = PGTBL_RADIX;
+			else if (!strcmp(val, "hash"))
+				os.mmparam.pgtbl = PGTBL_HASH;
+			else {
+				printf("Unknown page table structure '%s'\n", val);
+				exit(1);
+			}
+		} else if (!strcmp(name, "thp")) {
+			os.mmparam.thp = atoi(val);
+		} else if (!strcmp(name, "pagesz")) {
+			os.mmparam.pagesz = strtoul(val, NULL, 0);
+		} else if (!strcmp(name, "slotus")) {
+			os.mmparam.slotus = strtoul(val, NULL, 0);
+			if (os.mmparam.slotus == 0)
+				os.mmparam.slotus = 1;
+		} else if (!strcmp(name, "ramlat")) {
+			os.mmparam.ramlat = strtoul(val, NULL, 0);
+		} else if (!strcmp(name, "rambw")) {
+			os.mmparam.rambw = strtoul(val, NULL, 0);
+		} else if (!strcmp(name, "swplat")) {
+			read_kparam_list(strchr(argv[i], '=') + 1, os.mmparam.swplat);
+		} else if (!strcmp(name, "swpbw")) {
+			read_kparam_list(strchr(argv[i], '=') + 1, os.mmparam.swpbw);
+		} else {
+			printf("Unknown kernel parameter '%s'\n", name);
+			exit(1);
+		}
+	}
+
+	/* Huge mappings live in the PMD level of the radix tree */
+	if (os.mmparam.pgtbl == PGTBL_HASH)
+		os.mmparam.thp = 0;
+
+	/* Before read_config, the memory sizes are checked against it */
+	if (paging_set_pagesz(os.mmparam.pagesz) < 0) {
+		printf("Invalid page size %lu, a power of two from %d to %d\n",
+		       os.mmparam.pagesz, PAGING_PAGESZ_MIN, PAGING_PAGESZ_MAX);
+		exit(1);
+	}
+}
+#endif
+
 static void read_config(const char * path) {
 	FILE * file;
 	if ((file = fopen(path, "r")) == NULL) {
@@ -212,16 +386,14 @@ static void read_config(const char * path) {
 	long current_pos = ftell(file);
 	char line[256];
 	if (fgets(line, sizeof(line), file) != NULL) {
-		int ram, swp[PAGING_MAX_MMSWP];
-		int count = sscanf(line, "%d %d %d %d %d", &ram, &swp[0], &swp[1], &swp[2], &swp[3]);
+		unsigned long long ram, swp[PAGING_MAX_MMSWP];
+		int count = sscanf(line, "%llu %llu %llu %llu %llu", &ram, &swp[0], &swp[1], &swp[2], &swp[3]);
 		
 		if (count == 5) {
 			/* Found memory configuration line, update values */
 			memramsz = ram;
-#ifdef MM64
 			/* Force minimum RAM size to 1 page if configured size is too small */
 			if (memramsz < PAGING_PAGESZ) memramsz = PAGING_PAGESZ;
-#endif
 			for (sit = 0; sit < PAGING_MAX_MMSWP; sit++)
 				memswpsz[sit] = swp[sit];
 		} else {
@@ -256,10 +428,18 @@ static void read_config(const char * path) {
 
 int main(int argc, char * argv[]) {
 	/* Read config */
+	if (argc < 2) {
+		printf("Usage: os [path to configure file] [param=value ...]\n");
+		return 1;
+	}
+#ifdef MM_PAGING
+	read_kparams(argc, argv);
+#else
 	if (argc != 2) {
 		printf("Usage: os [path to configure file]\n");
 		return 1;
 	}
+#endif
 
 	/* Install debug SIGSEGV handler (has no effect when program exits
 	 * normally, but gives us a backtrace if a rare crash occurs). */
@@ -295,23 +475,51 @@ int main(int argc, char * argv[]) {
 
 	struct memphy_struct mram;
 	struct memphy_struct mswp[PAGING_MAX_MMSWP];
+	struct memphy_struct *mswp_list[PAGING_MAX_MMSWP];
 
 	/* Create MEM RAM */
 	init_memphy(&mram, memramsz, rdmflag);
+	MEMPHY_set_timing(&mram, os.mmparam.ramlat, os.mmparam.rambw);
 
         /* Create all MEM SWAP */ 
 	int sit;
-	for(sit = 0; sit < PAGING_MAX_MMSWP; sit++)
-	       init_memphy(&mswp[sit], memswpsz[sit], rdmflag);
+	for(sit = 0; sit < PAGING_MAX_MMSWP; sit++) {
+	       init_memphy(&mswp[sit], memswpsz[sit],
+	                   os.mmparam.swpstream ? 0 : rdmflag);
+	       mswp_list[sit] = &mswp[sit];
+	       MEMPHY_set_timing(&mswp[sit], os.mmparam.swplat[sit], os.mmparam.swpbw[sit]);
+
+	       /* Swap device sit lives in the host file <swpfile><sit> */
+	       if (os.mmparam.swpfile != NULL && memswpsz[sit] > 0) {
+		       char swppath[256];
+		       snprintf(swppath, sizeof(swppath), "%s%d", os.mmparam.swpfile, sit);
+		       if (MEMPHY_attach_file(&mswp[sit], swppath) < 0) {
+			       printf("Cannot use swap file %s\n", swppath);
+			       exit(1);
+		       }
+	       }
+	}
 
 	/* In Paging mode, it needs passing the system mem to each PCB through loader*/
 	struct mmpaging_ld_args *mm_ld_args = malloc(sizeof(struct mmpaging_ld_args));
 
 	mm_ld_args->timer_id = ld_event;
 	mm_ld_args->mram = (struct memphy_struct *) &mram;
-	mm_ld_args->mswp = (struct memphy_struct**) &mswp;
+	mm_ld_args->mswp = mswp_list;
 	mm_ld_args->active_mswp = (struct memphy_struct *) &mswp[0];
         mm_ld_args->active_mswp_id = 0;
+
+	if (os.mmparam.zswap > 0)
+		zswap_init(&os, os.mmparam.zswap);
+
+	if (os.mmparam.kswapd) {
+		/* The daemon reclaims before any process is loaded */
+		os.mram = mm_ld_args->mram;
+		os.mswp = mm_ld_args->mswp;
+		os.active_mswp = mm_ld_args->active_mswp;
+		os.active_mswp_id = mm_ld_args->active_mswp_id;
+		mm_kswapd_start(&os);
+	}
 #endif
 
 	/* Init scheduler */
@@ -333,10 +541,18 @@ int main(int argc, char * argv[]) {
 		pthread_join(cpu[i], NULL);
 	}
 	pthread_join(ld, NULL);
+#ifdef MM_PAGING
+	mm_kswapd_stop(&os);
+#endif
 
 	/* Stop timer */
 	stop_timer();
 
+#ifdef MM_PAGING
+	if (os.mmparam.stat)
+		print_mmstat(&os);
+#endif
+
 	return 0;
 
 }
@@ -12,6 +12,7 @@
 #include "syscall.h"
 #include "libmem.h"
 #include "queue.h"
+#include "cpu.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -26,6 +27,7 @@
 int __sys_memmap(struct krnl_t *krnl, uint32_t pid, struct sc_regs* regs)
 {
    int memop = regs->a1;
+   int ret = 0;
    BYTE value;
    
    /* Create a minimal PCB wrapper that points back to the kernel.
@@ -43,6 +45,11 @@ int __sys_memmap(struct krnl_t *krnl, uint32_t pid, struct sc_regs* regs)
    caller->krnl = krnl;
    caller->pid  = pid;
 
+   /* The address space is the one of the process this CPU runs, never
+    * taken from the arguments */
+   if (current_proc != NULL && current_proc->pid == pid)
+      caller->mm = current_proc->mm;
+
    /*
     * @bksysnet: Please note in the dual spacing design
     *            syscall implementations are in kernel space.
@@ -54,10 +61,13 @@ int __sys_memmap(struct krnl_t *krnl, uint32_t pid, struct sc_regs* regs)
 			vmap_pgd_memset(caller, regs->a2, regs->a3);
             break;
    case SYSMEM_INC_OP:
-            inc_vma_limit(caller, regs->a2, regs->a3);
+            ret = inc_vma_limit(caller, regs->a2, regs->a3);
             break;
    case SYSMEM_SWP_OP:
-            __mm_swap_page(caller, regs->a2, regs->a3);
+            __mm_swap_page(caller, regs->a2, regs->a4, regs->a3);
+            break;
+   case SYSMEM_SWPIN_OP:
+            __mm_swap_in_page(caller, regs->a4, regs->a2, regs->a3);
             break;
    case SYSMEM_IO_READ:
             MEMPHY_read(caller->krnl->mram, regs->a2, &value);
@@ -74,7 +84,7 @@ int __sys_memmap(struct krnl_t *krnl, uint32_t pid, struct sc_regs* regs)
    /* Caller wrapper is no longer needed */
    free(caller);
 
-   return 0;
+   return ret;
 }
 
 